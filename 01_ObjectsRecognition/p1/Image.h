@@ -23,20 +23,118 @@
 #ifndef _IMAGE
 #define _IMAGE
 
+#include <stdint.h>
+#include <cstdio>
+#include <vector>
+#include <functional>
 #include "Database.h"
 
+/*
+  applies macro M to every supported pixel type
+  (used for explicit instantiations);
+*/
+#define FOR_EACH_PIXEL_TYPE(M) M(uint8_t) M(uint16_t) M(uint32_t) M(int32_t) M(float)
+
+/*
+  non-owning view of a rectangle of pixels of type T (const T for
+  read-only views): pointer to the first pixel, size, and the number
+  of pixels between the starts of two consecutive rows; the pixels
+  must outlive the view;
+*/
+template <typename T>
+class ImageView{
+ private:
+  T *data; /* first pixel of the view */
+  int Nrows; /* number of rows */
+  int Ncols; /* number of columns */
+  int stride; /* number of pixels between the starts of two consecutive rows */
+
+ public:
+  ImageView() : data(0), Nrows(0), Ncols(0), stride(0) {};
+  ImageView(T *first, int rows, int columns, int rowStride)
+    : data(first), Nrows(rows), Ncols(columns), stride(rowStride) {};
+/*
+  converts a view of T to a view of const T;
+*/
+  template <typename U>
+  ImageView(const ImageView<U> &v)
+    : data(v.getData()), Nrows(v.getNRows()), Ncols(v.getNCols()), stride(v.getStride()) {};
+
+  int getNRows()const{return Nrows;};
+  int getNCols()const{return Ncols;};
+  int getStride()const{return stride;};
+  T *getData()const{return data;};
+/*
+  returns pointer to the first pixel of row i (no bounds checking);
+*/
+  T *row(int i)const{return data + i*stride;};
+/*
+  returns reference to the pixel at row i and column j
+  (no bounds checking);
+*/
+  T &operator()(int i, int j)const{return data[i*stride + j];};
+/*
+  returns view of rows x columns pixels starting at row i and
+  column j, clipped to this view; the result is empty if the
+  rectangle lies outside of this view;
+*/
+  ImageView subview(int i, int j, int rows, int columns)const{
+    int iEnd = i + rows;
+    int jEnd = j + columns;
+    if (i < 0) i = 0;
+    if (j < 0) j = 0;
+    if (iEnd > Nrows) iEnd = Nrows;
+    if (jEnd > Ncols) jEnd = Ncols;
+    if (iEnd <= i || jEnd <= j)
+      return ImageView();
+    return ImageView(data + i*stride + j, iEnd - i, jEnd - j, stride);
+  };
+/*
+  sets all pixels of the view to value;
+*/
+  void fill(T value)const{
+    for (int i=0; i<Nrows; i++){
+      T *pixels = row(i);
+      for (int j=0; j<Ncols; j++)
+        pixels[j] = value;
+    }
+  };
+};
+
+/*
+  image with pixels of type T: uint8_t for 8-bit PGM images and
+  binary masks, int32_t for label maps, ...; the checked accessors
+  (setPixel, getPixel) work on int values and test the coordinates,
+  inner loops use row(), operator() or the iterators instead;
+*/
+template <typename T>
 class Image{
  private:
   int Nrows; /* number of rows */
   int Ncols; /* number of columns */
   int Ncolors; /* number of gray level colors */
-  int **image;
+  int stride; /* number of pixels between the starts of two consecutive rows */
+  T *image; /* all rows stored one after another in a single block */
 
  public:
+  typedef T PixelType;
+
   Image();
   Image (const Image &im);
+  Image (Image &&im);
   ~Image();
 
+/*
+  copy assignment; reuses the current pixel buffer if it has
+  the size of im;
+*/
+  Image &operator=(const Image &im);
+/*
+  move assignment; frees the current pixel buffer and takes over
+  the one of im, which is left empty;
+*/
+  Image &operator=(Image &&im);
+
 /*
  Functions applied to "struct image"
 */
@@ -44,6 +142,8 @@ class Image{
 /*
    sets the size of the image to the given
     height (# of rows) and width (# of columns);
+    keeps the current buffer if it already holds
+    rows x columns pixels;
     returns 0 if OK or -1 if fails;
 */
 int setSize(int rows, int columns);
@@ -57,6 +157,74 @@ int getNCols()const{return Ncols;};
 returns the number of rows in the image;
 */
 int getNRows()const{return Nrows;};
+/*
+  returns the number of pixels between the starts of two
+  consecutive rows;
+*/
+int getStride()const{return stride;};
+/*
+  returns pointer to the first pixel of row i (no bounds checking);
+  pixels of the row are contiguous, next row starts getStride()
+  pixels later;
+*/
+T *row(int i){return image + i*stride;};
+const T *row(int i)const{return image + i*stride;};
+/*
+  returns reference to the pixel at row i and column j
+  (no bounds checking);
+*/
+T &operator()(int i, int j){return image[i*stride + j];};
+const T &operator()(int i, int j)const{return image[i*stride + j];};
+/*
+  iterator over all pixels in row-major order (no bounds checking);
+  steps over the gap between the end of a row and the start of the
+  next one;
+*/
+template <typename P>
+class PixelIterator{
+ public:
+  PixelIterator(P *first, int columns, int rowStride)
+    : ptr(first), rowEnd(first + columns), gap(rowStride - columns), stride(rowStride) {};
+  P &operator*()const{return *ptr;};
+  P *operator->()const{return ptr;};
+  PixelIterator &operator++(){
+    if (++ptr == rowEnd){
+      ptr += gap;
+      rowEnd += stride;
+    }
+    return *this;
+  };
+  bool operator==(const PixelIterator &other)const{return ptr == other.ptr;};
+  bool operator!=(const PixelIterator &other)const{return ptr != other.ptr;};
+ private:
+  P *ptr;
+  P *rowEnd;
+  int gap;
+  int stride;
+};
+typedef PixelIterator<T> iterator;
+typedef PixelIterator<const T> const_iterator;
+/*
+  return iterators to the first pixel and past the last pixel;
+*/
+iterator begin(){return iterator(image, Ncols, stride);};
+iterator end(){return iterator(image + Nrows*stride, Ncols, stride);};
+const_iterator begin()const{return const_iterator(image, Ncols, stride);};
+const_iterator end()const{return const_iterator(image + Nrows*stride, Ncols, stride);};
+/*
+  return view of the whole image, or of rows x columns pixels
+  starting at row i and column j clipped to the image;
+*/
+ImageView<T> view(){return ImageView<T>(image, Nrows, Ncols, stride);};
+ImageView<const T> view()const{return ImageView<const T>(image, Nrows, Ncols, stride);};
+ImageView<T> view(int i, int j, int rows, int columns){return view().subview(i, j, rows, columns);};
+ImageView<const T> view(int i, int j, int rows, int columns)const{return view().subview(i, j, rows, columns);};
+/*
+  returns pointer to the pixel buffer (getNRows()*getStride() pixels,
+  row 0 followed by rows 1, 2, ...) or NULL if size has not been set;
+*/
+T *getData(){return image;};
+const T *getData()const{return image;};
 /*
   sets the number of gray-level colors in the image
     (not counting 0);
@@ -70,38 +238,552 @@ int getNRows()const{return Nrows;};
 /*
   sets the pixel in the image at row i and column j
   to a particular color;
+  returns the color or -1 if (i,j) is outside the image;
 */
  int setPixel( int i, int j, int color );
 /*
-  returns the color of the pixel in the image at row i and column j;
+  returns the color of the pixel in the image at row i and column j
+  or -1 if (i,j) is outside the image;
 */
  int getPixel( int i, int j )const;
 
 };
 
 
+/*
+  returns the number of bits of word that are 1;
+*/
+inline int
+countBits(uint64_t word)
+{
+#if defined(__GNUC__)
+  return __builtin_popcountll(word);
+#else
+  int n = 0;
+  for (; word; word &= word - 1)
+    n++;
+  return n;
+#endif
+}
+/*
+  returns the index of the lowest bit of word that is 1; word must not
+  be 0;
+*/
+inline int
+countTrailingZeros(uint64_t word)
+{
+#if defined(__GNUC__)
+  return __builtin_ctzll(word);
+#else
+  int n = 0;
+  for (; !(word & 1); word >>= 1)
+    n++;
+  return n;
+#endif
+}
+
+/*
+  binary image packed 1 bit per pixel in 64-bit words: pixel j of a row
+  is bit j % 64 of word j / 64 of the row; every row starts at a new word,
+  padding bits at the end of a row are 0; whole words are combined by the
+  logical operations, counted with popcount and scanned with
+  count-trailing-zeros, so 64 pixels of background are skipped at a time;
+  PBM (P4) files, which hold 8 pixels per byte with the leftmost one in
+  the most significant bit, are converted when they are read and written;
+*/
+class BinaryImage{
+ private:
+  int Nrows; /* number of rows */
+  int Ncols; /* number of columns */
+  int wordsPerRow; /* (Ncols + 63) / 64 */
+  std::vector<uint64_t> words; /* all rows stored one after another */
+
+ public:
+  BinaryImage() : Nrows(0), Ncols(0), wordsPerRow(0) {};
+/*
+  sets the size of the image to rows x columns and sets all pixels to 0;
+  returns rows*columns or -2 if rows or columns <=0;
+*/
+  int setSize(int rows, int columns);
+  int getNRows()const{return Nrows;};
+  int getNCols()const{return Ncols;};
+  int getWordsPerRow()const{return wordsPerRow;};
+/*
+  returns pointer to the first word of row i (no bounds checking);
+*/
+  uint64_t *row(int i){return &words[size_t(i) * wordsPerRow];};
+  const uint64_t *row(int i)const{return &words[size_t(i) * wordsPerRow];};
+/*
+  returns/sets the pixel at row i and column j (no bounds checking);
+*/
+  bool get(int i, int j)const{return (row(i)[j >> 6] >> (j & 63)) & 1;};
+  void set(int i, int j, bool value){
+    uint64_t mask = uint64_t(1) << (j & 63);
+    uint64_t &word = row(i)[j >> 6];
+    word = value ? (word | mask) : (word & ~mask);
+  };
+/*
+  sets padding bits at the end of every row to 0;
+*/
+  void clearPadding();
+/*
+  returns the number of pixels that are 1 (the area of the objects);
+*/
+  long countPixels()const;
+/*
+  sets every pixel to the AND, OR or exclusive OR of itself and the pixel
+  of other at the same position;
+  returns 0 if OK or -1 if other has another size;
+*/
+  int andWith(const BinaryImage &other);
+  int orWith(const BinaryImage &other);
+  int xorWith(const BinaryImage &other);
+/*
+  inverts every pixel (NOT);
+*/
+  void invert();
+/*
+  moves every pixel n columns to the right (to the left if n < 0) or n
+  rows down (up if n < 0); pixels moved out of the image are lost, the
+  columns or rows left empty are 0;
+*/
+  void shiftColumns(int n);
+  void shiftRows(int n);
+/*
+  calls f(j) with the column j of every pixel of row i that is 1, from
+  left to right;
+*/
+  template <typename F>
+  void forEachPixelInRow(int i, F f)const{
+    const uint64_t *w = row(i);
+    for (int k=0; k<wordsPerRow; k++)
+      for (uint64_t bits = w[k]; bits; bits &= bits - 1)
+        f((k << 6) + countTrailingZeros(bits));
+  };
+};
+
+/*
+  binary image stored as runs: a run is the pixels start..end (both
+  included) of one row that are 1, and the runs of row i are row(i)[0] ..
+  row(i)[getNumberOfRuns(i)-1], left to right; a run takes 8 bytes however
+  long it is, so object masks, which are mostly long horizontal runs, are
+  labeled and measured a run at a time instead of a pixel at a time;
+*/
+class RunLengthImage{
+ public:
+  struct Run{
+    int start; /* first column of the run */
+    int end; /* last column of the run */
+  };
+
+ private:
+  int Nrows; /* number of rows */
+  int Ncols; /* number of columns */
+  std::vector<Run> runs; /* runs of all rows, row by row */
+  std::vector<int> firstRun; /* runs of row i are runs[firstRun[i]] .. runs[firstRun[i+1]-1] */
+
+ public:
+  RunLengthImage() : Nrows(0), Ncols(0) {};
+/*
+  sets the runs to those of binary image im, found 64 pixels at a time
+  with count-trailing-zeros;
+  returns the number of runs;
+*/
+  int encode(const BinaryImage &im);
+/*
+  appends the runs of a row of columns pixels, packed like a row of
+  BinaryImage (padding bits 0), to rowRuns;
+  returns the number of runs appended;
+*/
+  static int encodeRow(const uint64_t *words, int columns, std::vector<Run> &rowRuns);
+/*
+  sets binary image im to the pixels of the runs;
+  returns 0 if OK or -1 if the image is empty;
+*/
+  int decode(BinaryImage *im)const;
+  int getNRows()const{return Nrows;};
+  int getNCols()const{return Ncols;};
+/*
+  returns the number of runs of the image or of row i;
+*/
+  int getNumberOfRuns()const{return int(runs.size());};
+  int getNumberOfRuns(int i)const{return firstRun[i+1] - firstRun[i];};
+/*
+  returns pointer to the first run of row i (no bounds checking); runs of
+  the following rows come right after it;
+*/
+  const Run *row(int i)const{return runs.data() + firstRun[i];};
+/*
+  returns the number of pixels that are 1 (the area of the objects);
+*/
+  long countPixels()const;
+};
+
+/*
+  labeler of a binary image that arrives row by row and may never end, such
+  as the rows of a line-scan camera: rows are labeled like labelRuns,
+  keeping only the runs of the previous row and the sums of the objects
+  that touch it, so memory is O(width + live objects); an object that has
+  no pixel in the current row can't grow any more, its properties are
+  calculated like Database::calculateProperties and it is passed to the
+  callback right away, one row after its last pixel, e.g. to be recognized
+  with Database::recognizeObject;
+*/
+class StreamingLabeler{
+ public:
+/*
+  called with the record of every finished object; rowCenter is the row
+  number since start, the sums of i are taken from the first row of the
+  object;
+*/
+  typedef std::function<void(const Database::Record &)> Callback;
+
+ private:
+  struct LabeledRun{
+    int start; /* first column of the run */
+    int end; /* last column of the run */
+    int object; /* slot of the object of the run */
+  };
+
+  int Ncols; /* number of columns */
+  int rowIndex; /* number of the next row */
+  Callback callback; /* called with every finished object */
+  std::vector<LabeledRun> above, current; /* runs of the previous and of the current row */
+  std::vector<RunLengthImage::Run> rowRuns; /* runs of a packed row */
+  std::vector<Database::Record> objects; /* sums of the live objects, by slot */
+  std::vector<int> firstRow; /* first row of the object of every slot */
+  std::vector<int> lastRow; /* last row with a pixel of the object of every slot */
+  std::vector<int> parent; /* slot an object was merged into during the current row, or itself */
+  std::vector<int> freeSlots; /* slots of finished and merged objects, reused for new objects */
+  std::vector<int> merged; /* slots merged into others during the current row */
+  int numOfLiveObjects; /* number of objects not finished yet */
+  long numOfFinishedObjects; /* number of objects passed to the callback since start */
+
+  int newObject();
+  int findObject(int slot);
+  int mergeObjects(int slot1, int slot2);
+  void finishObject(int slot);
+
+ public:
+  StreamingLabeler() : Ncols(0), rowIndex(0), numOfLiveObjects(0), numOfFinishedObjects(0) {};
+/*
+  starts a new stream of rows of columns pixels; objects finished by addRow
+  and finish are passed to callback;
+  returns 0 if OK or -1 if columns <=0;
+*/
+  int start(int columns, Callback finished);
+/*
+  labels the next row, given as its runs (left to right) or packed like a
+  row of BinaryImage;
+  returns the number of objects finished by this row;
+*/
+  int addRow(const RunLengthImage::Run *runs, int numOfRuns);
+  int addRow(const uint64_t *words);
+/*
+  ends the stream: the objects of the last row are finished too;
+  returns their number;
+*/
+  int finish();
+  int getNumberOfRows()const{return rowIndex;};
+  int getNumberOfLiveObjects()const{return numOfLiveObjects;};
+  long getNumberOfFinishedObjects()const{return numOfFinishedObjects;};
+};
+
+/*
+  row kernels of the thresholding functions; the overloads for uint8_t
+  and int32_t pixels use SSE2 or AVX2 instructions, the best the CPU has
+  (checked once at run time), and give exactly the results of the scalar
+  loops of the templates, which are used for the other pixel types and
+  for the ends of rows;
+*/
+
+/*
+  sets the pixels of a row of nCols pixels that are greater than
+  threshold to 1, the others to 0;
+*/
+template <typename T>
+void
+binarizeRow(T *pixels, int nCols, int threshold)
+{
+  for (int j=0; j<nCols; j++)
+    pixels[j] = (int(pixels[j])<=threshold) ? 0 : 1;
+}
+void
+binarizeRow(uint8_t *pixels, int nCols, int threshold);
+void
+binarizeRow(int32_t *pixels, int nCols, int threshold);
+/*
+  packs a row of nCols pixels into words, 64 per word with pixel j in bit
+  j % 64 (rows of BinaryImage); pixels greater than threshold are 1, the
+  padding bits of the last word are 0;
+*/
+template <typename T>
+void
+packBinaryRow(const T *pixels, int nCols, int threshold, uint64_t *words)
+{
+  for (int j=0; j<nCols; j+=64) {
+    const T *p = pixels + j;
+    int n = (nCols - j < 64) ? nCols - j : 64;
+    uint64_t word = 0;
+    for (int k=0; k<n; k++)
+      word |= uint64_t(int(p[k]) > threshold) << k;
+    words[j >> 6] = word;
+  }
+}
+void
+packBinaryRow(const uint8_t *pixels, int nCols, int threshold, uint64_t *words);
+/*
+  returns the instruction set used by the row kernels: "avx2", "sse2"
+  or "scalar";
+*/
+const char *
+getRowKernelInstructionSet();
+
+/*
+  histogram of the gray levels of an image, with a bin for every sample
+  value of its file: 256 bins, or 65536 for images with more than 255
+  gray levels; pixel j of a row is counted in partial histogram j % 4, so
+  that runs of pixels of the same gray level do not wait on each other's
+  counter updates; the partial histograms are added up when the counts
+  are read;
+*/
+class Histogram{
+ private:
+  int Nbins; /* number of bins */
+  std::vector<uint32_t> partial; /* 4 partial histograms of Nbins bins, one after another */
+  std::vector<uint64_t> counts; /* sum of the partial histograms */
+  bool summed; /* counts holds the sum of the partial histograms */
+
+ public:
+  Histogram() : Nbins(0), summed(true) {};
+/*
+  sets the bins for the pixels of an image with levels gray levels and
+  sets all counts to 0 (has to be called before counting pixels);
+*/
+  void reset(int levels);
+  int getNBins()const{return Nbins;};
+/*
+  counts a row of nCols pixels; pixels outside of the bins are counted
+  in the first or the last bin;
+*/
+  template <typename T>
+  void addRow(const T *pixels, int nCols){
+    for (int j=0; j<nCols; j++) {
+      int value = int(pixels[j]);
+      value = (value < 0) ? 0 : (value >= Nbins) ? Nbins - 1 : value;
+      partial[size_t(j & 3) * Nbins + value]++;
+    }
+    summed = false;
+  };
+  void addRow(const uint8_t *pixels, int nCols);
+/*
+  returns the number of pixels of every gray level;
+*/
+  const std::vector<uint64_t> &getCounts();
+/*
+  returns the threshold that separates the pixels into the two classes
+  of least variance (Otsu's method): pixels not greater than the
+  threshold are one class;
+*/
+  int getOtsuThreshold();
+/*
+  returns the lowest threshold such that percent % of the pixels are not
+  greater than it;
+*/
+  int getPercentileThreshold(double percent);
+};
+
+/*
+  threshold given on the command line: a gray level such as "120", or
+  "auto" to choose it for every image from the image's histogram with
+  Otsu's method, or "auto:P" to choose it as the P-th percentile of the
+  gray levels (with "auto:90" the brightest 10% of the pixels are above
+  it);
+*/
+class Threshold{
+ private:
+  enum Mode {FIXED, OTSU, PERCENTILE};
+  Mode mode; /* how the threshold is chosen */
+  int level; /* the fixed threshold */
+  double percent; /* the percentile */
+
+ public:
+/*
+  fixed threshold value; gray levels convert to Threshold, so they can
+  be given directly to the functions that take a Threshold;
+*/
+  Threshold(int value = 0) : mode(FIXED), level(value), percent(0) {};
+/*
+  sets the threshold from arg: a gray level, "auto" or "auto:P" with P
+  between 0 and 100;
+  returns 0 if OK or -1 if arg is none of these;
+*/
+  int parse(const char *arg);
+/*
+  returns true if the threshold is chosen from the histogram of every
+  image;
+*/
+  bool isAuto()const{return mode!=FIXED;};
+/*
+  returns the fixed threshold, or the threshold chosen from histogram
+  (printed on stderr);
+*/
+  int choose(Histogram &histogram)const;
+};
+
 /*
  functions for read-write pgm images
 */
 
+/*
+  opens fname like fopen; "-" stands for stdin (modes starting with 'r') or
+  stdout (other modes), so images and text files can be piped from one
+  program to the next; messages of the functions below go to stderr;
+  returns the file or NULL if it cannot be opened
+*/
+FILE *
+openFile(const char *fname, const char *mode);
+/*
+  closes file opened by openFile; stdin and stdout are left open (stdout is
+  flushed);
+  returns 0 if OK or EOF if something goes wrong
+*/
 int
-readImage(Image *im, const char *filename);
+closeFile(FILE *file);
+
+/*
+  reads the header of a binary PGM image ("P5", width, height and # of gray
+  levels, separated by white space and possibly comments) from input, leaves
+  input at the first pixel; returns 0 if OK or -1 if something goes wrong
+*/
 int
-readAsBinaryImage(Image *im, const char *filename, int threshold);
+readPgmHeader(FILE *input, int &nRows, int &nCols, int &levels);
+/*
+  reads the header of a binary PGM ("P5") or PBM ("P4") image from input;
+  format is set to 5 or 4, levels to 1 for PBM images (they have no # of
+  gray levels in the header); returns 0 if OK or -1 if something goes wrong
+*/
 int
-readAndLabelBinaryImage(Image *im, const char *fname);
+readPnmHeader(FILE *input, int &format, int &nRows, int &nCols, int &levels);
+/*
+  skips the white space after an image of input; several images may be
+  concatenated in one file or stream (a multi-image PGM stream) and read one
+  after another with the functions below that take an open file; returns 1
+  if another image follows or 0 at the end of input
+*/
 int
-readLabeledImage(Image *im, const char *filename, Database &db);
+hasNextImage(FILE *input);
+/*
+  reads getNRows() x getNCols() pixels from input into im, a whole row per
+  fread; pixels of images with more than 255 gray levels are 16-bit, most
+  significant byte first; if histogram is not NULL, it is set to the
+  histogram of the pixels, counted row by row as they are read; returns 0
+  if OK or -1 if the file is short
+*/
+template <typename T>
 int
-addPositionAndOrientation(Image *im, Database &db, bool recognizedOnly);
+readPgmPixels(FILE *input, Image<T> *im, int levels, Histogram *histogram = NULL);
+template <typename T>
+int
+readImage(Image<T> *im, const char *filename);
+/*
+  reads image from filename and thresholds it into 0's and 1's; an
+  automatic threshold is chosen from the histogram counted while the
+  image is read; returns 0 if OK or -1 if something goes wrong
+*/
+template <typename T>
+int
+readAsBinaryImage(Image<T> *im, const char *filename, const Threshold &threshold);
+/*
+  reads PGM image from filename and thresholds it (pixels greater than
+  threshold are 1), or reads PBM image from filename, into packed binary
+  image im; rows are packed as they are read, except with an automatic
+  threshold, which needs the histogram of the whole image first; returns
+  0 if OK or -1 if something goes wrong
+*/
+int
+readAsBinaryImage(BinaryImage *im, const char *filename, const Threshold &threshold);
+/*
+  the same for the next image of input; input is left at the end of the image
+*/
+int
+readAsBinaryImage(BinaryImage *im, FILE *input, const Threshold &threshold);
+/*
+  reads binary image (PBM, or PGM with 1 color) from fname and labels it;
+  returns 0 if OK or -1 if something goes wrong
+*/
+template <typename T>
+int
+readAndLabelBinaryImage(Image<T> *im, const char *fname);
+/*
+  the same for the next image of input; input is left at the end of the image
+*/
+template <typename T>
+int
+readAndLabelBinaryImage(Image<T> *im, FILE *input);
+/*
+  labels the runs of runs: labels[r] is set to the label of run r (counted
+  row by row from runs.row(0)), objects are numbered from 1 in the order of
+  their first pixels; a run joins the runs of the row above that hold the N
+  or NW neighbour of one of its pixels, found by one merge of the runs of
+  both rows;
+  returns the number of objects
+*/
+int
+labelRuns(const RunLengthImage &runs, std::vector<int> &labels);
+/*
+  labels packed binary image binary like readAndLabelBinaryImage, saves the
+  labeled image in im and objects' info in db in the same pass, so the
+  labels need not be written and read back to measure the objects;
+  returns 0 if OK or -1 if something goes wrong
+*/
+template <typename T>
+int
+labelAndMeasureBinaryImage(const BinaryImage *binary, Image<T> *im, Database &db);
+/*
+  reads labeled image from filename (8-, 16- or 32-bit, see
+  writeLabeledImage), saves objects' info in db; a binary image (PBM, or PGM
+  with 1 color) is labeled like labelAndMeasureBinaryImage;
+  returns 0 if OK or -1 if something goes wrong
+*/
+template <typename T>
+int
+readLabeledImage(Image<T> *im, const char *filename, Database &db);
+/*
+  the same for the next image of input; input is left at the end of the image
+*/
+template <typename T>
+int
+readLabeledImage(Image<T> *im, FILE *input, Database &db);
+template <typename T>
+int
+addPositionAndOrientation(Image<T> *im, Database &db, bool recognizedOnly);
+template <typename T>
+int
+writeImage(const Image<T> *im, const char *filename);
+/*
+  writes labeled image im into filename without losing labels: like
+  writeImage for up to 65535 objects, with 32-bit pixels (most significant
+  byte first) for more; such files are read by readLabeledImage only;
+  returns 0 if OK or -1 if something goes wrong
+*/
+template <typename T>
+int
+writeLabeledImage(const Image<T> *im, const char *filename);
+/*
+  writes packed binary image im into filename: as PBM (P4, 1 bit per
+  pixel) if filename ends with ".pbm", otherwise as PGM with 1 color;
+  returns 0 if OK or -1 if something goes wrong
+*/
 int
-writeImage(const Image *im, const char *filename);
+writeImage(const BinaryImage *im, const char *filename);
 
 /*
 function for drawing a line
 */
 
+template <typename T>
 int
-line(Image *&im, int x0, int y0, int x1, int y1, int color);
+line(Image<T> *&im, int x0, int y0, int x1, int y1, int color);
 
 #endif
@@ -7,14 +7,20 @@
  Usage          : ./p1 <arg1> <arg2> <arg3>
                   where:
                   <arg1> is an input gray–level image
-                  <arg2> is an input gray–level threshold
+                  <arg2> is an input gray–level threshold, or auto (chosen for the image
+                  with Otsu's method) or auto:P (the P-th percentile of its gray levels)
                   <arg3> is an output binary image
+ Batch usage    : ./p1 -batch <inputs> <arg2> <arg3>
+                  runs the program on every image of <inputs> (see showUsage)
  Comments       : The background in the input image is darker than the objects.
                   The background in the output image is black (0) and the objects are white
                   (255).
  ******************************************************************************************/
 
+#include <vector>
+#include <cstring>
 #include "Image.h"
+#include "Batch.h"
 #include <cassert>
 #include <string>
 #include <iostream>
@@ -26,29 +32,91 @@ using namespace std;
  */
 void showUsage(string fileName);
 
+/**
+ * Runs the program on every image of a batch (see showUsage).
+ */
+int runBatch(int argc, char * argv[]);
+
 /******************************************************************************************
  * MAIN
  ******************************************************************************************/
 int main(int argc, char **argv) {
 
+    if (argc>1 && strcmp(argv[1], "-batch")==0) {
+        return runBatch(argc, argv);
+    }
+
     if (argc!=4) {
 		showUsage(argv[0]);
 		return 0;
 	}
-	Image *im;
-	im=new Image;
-	assert(im!=0);
-    if (readAsBinaryImage(im, argv[1], atoi(argv[2]))!=0) {
-		printf("Can't open file %s\n", argv[1]);
+	BinaryImage im;
+	Threshold threshold;
+	if (threshold.parse(argv[2])) {
+		fprintf(stderr, "Invalid threshold %s\n", argv[2]);
+		return 0;
+	}
+    if (readAsBinaryImage(&im, argv[1], threshold)!=0) {
+		fprintf(stderr, "Can't open file %s\n", argv[1]);
 		return 0;
 	}
 
-	if (writeImage(im, argv[3])!=0) {
-		printf("Can't write to file %s\n", argv[3]);
+	if (writeImage(&im, argv[3])!=0) {
+		fprintf(stderr, "Can't write to file %s\n", argv[3]);
 		return 0;
 	}
 }
 
+/******************************************************************************************
+ * runBatch
+ ******************************************************************************************/
+int runBatch(int argc, char * argv[]) {
+    
+    if (argc!=5) {
+        showUsage(argv[0]);
+        return 0;
+    }
+    
+    BatchTimer timer;
+    BatchInputs inputs;
+    if (inputs.open(argv[2])) {
+        return 0;
+    }
+    
+    /* decode and threshold the next images while the current one is saved */
+    Threshold threshold; /* an automatic one is chosen for every frame */
+    if (threshold.parse(argv[3])) {
+        fprintf(stderr, "Invalid threshold %s\n", argv[3]);
+        return 0;
+    }
+    struct Frame {
+        BinaryImage im;
+    };
+    BatchPrefetcher<Frame> frames(inputs, [&](Frame *frame, FILE *input, int k) {
+        return readAsBinaryImage(&frame->im, input, threshold);
+    });
+    
+    Frame *frame;
+    int k, status;
+    while ((frame = frames.next(k, status)) != NULL) {
+        if (status) {
+            fprintf(stderr, "Can't load frame %d (%s)\n", k, inputs.getName(k).c_str());
+            timer.countFrame(false);
+            continue;
+        }
+        string outputName = makeBatchName(argv[4], inputs.getName(k), k);
+        if (writeImage(&frame->im, outputName.c_str())) {
+            fprintf(stderr, "Can't write to file %s\n", outputName.c_str());
+            timer.countFrame(false);
+            continue;
+        }
+        timer.countFrame(true);
+    }
+    timer.report();
+    
+    return 0;
+}
+
 /******************************************************************************************
  * showUsage
  ******************************************************************************************/
@@ -58,7 +126,16 @@ void showUsage(string fileName) {
          << "********************************************************************************\n"
          << "where:\n"
          << "\t<arg1> is an input gray–level image\n"
-         << "\t<arg2> is an input gray–level threshold\n"
+         << "\t<arg2> is an input gray–level threshold, or auto (chosen for every image with\n"
+         << "\tOtsu's method) or auto:P (the P-th percentile of its gray levels, 0 <= P <= 100)\n"
          << "\t<arg3> is an output binary image\n"
-         << "example:\n\t" << fileName <<  " input.pgm 100 output.pgm\n";
+         << "\t(a <arg3> ending in .pbm is written as a packed PBM image)\n"
+         << "batch:\t" << fileName << " -batch <inputs> <arg2> <arg3>\n"
+         << "\t<inputs> is a directory, a quoted glob pattern, a numbered sequence such as frame_%05d.pgm,\n"
+         << "\t@list (a file listing images), or an image file or - holding one or more images;\n"
+         << "\toutput names (and other per-frame image names) are patterns: %s is the input name\n"
+         << "\twithout directory and extension, %d (or %05d) the frame number\n"
+         << "example:\n\t" << fileName <<  " input.pgm 100 output.pgm\n"
+         << "\t" << fileName << " -batch 'scenes/*.pgm' 120 binary/%s_B.pgm\n"
+         << "\t" << fileName << " -batch 'scenes/*.pgm' auto binary/%s_B.pgm\n";
 }
@@ -0,0 +1,247 @@
+/******************************************************************************************
+ Title          : Batch.h
+ Description    : Header file for running one program on many images (batch mode): lists
+                  of input images, names of output files, decoding of the next images on
+                  background threads, and throughput reporting.
+ ******************************************************************************************/
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <cstdio>
+#include <climits>
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+/*
+  adds the names of the input images given by spec to names: spec is an image
+  name, a directory (all .pgm and .pbm files in it), a glob pattern such as
+  "frame_*.pgm" (quoted, so that the shell does not expand it), a numbered
+  sequence such as "frame_%05d.pgm" (frames 0, 1, ..., or 1, 2, ..., up to
+  the first missing file), or @list, a text file ("@-" for stdin) with one
+  name per line; names from directories and glob patterns are sorted;
+  returns 0 if OK or -1 if spec gives no names
+*/
+int
+addBatchInputs(const char *spec, std::vector<std::string> &names);
+/*
+  returns the name of the file of frame index made from pattern: "%s" is
+  replaced by the name of the frame's input image without its directory and
+  extension, "%d" (or "%05d", ...) by index, and "%%" by "%"; a pattern
+  without them, such as "-", names the same file for every frame
+*/
+std::string
+makeBatchName(const char *pattern, const std::string &input, int index);
+/*
+  returns the number of threads used to decode frames ahead of the one being
+  processed
+*/
+int
+getBatchThreads();
+
+/*
+  input frames of a batch: the images named by addBatchInputs, or the images
+  of a stream, a single file or stdin ("-") holding one or more images one
+  after another (a multi-image PGM stream), which are read in order
+*/
+class BatchInputs
+{
+  public:
+    BatchInputs( ) : stream(NULL) {};
+    ~BatchInputs( );
+
+    /*
+      opens the frames given by spec (see addBatchInputs); an image name or "-"
+      is opened as a stream; returns 0 if OK or -1 if spec gives no frames
+    */
+    int open( const char *spec );
+    /*
+      returns the number of frames, or -1 for a stream (its frames are counted
+      as they are read)
+    */
+    int getNFrames( ) const { return stream ? -1 : int(names.size()); }
+    /*
+      returns the name of the input image of frame index, or the name of the stream
+    */
+    const std::string &getName( int index ) const { return stream ? names[0] : names[index]; }
+    /*
+      opens the image of frame index: the file of the frame, or the stream
+      positioned at its next image (frames of a stream are opened in order);
+      returns 0 if OK, 1 if the stream has no more images or -1 if the file
+      cannot be opened
+    */
+    int openFrame( int index, FILE *&input );
+    /*
+      closes the file opened by openFrame; the stream is left open
+    */
+    void closeFrame( FILE *input );
+
+  private:
+    std::vector<std::string> names; /* names of the frames' images, or the name of the stream */
+    FILE *stream; /* stream of images or NULL */
+
+    BatchInputs( const BatchInputs & ); /* not copyable */
+    BatchInputs &operator=( const BatchInputs & );
+};
+
+/*
+  loads the frames of a batch in order on background threads, a few frames
+  ahead of the one being processed; frames are objects of type Frame (images,
+  databases, ...) filled by a loader function; their buffers are reused for
+  later frames, so the images keep their pixel blocks; frames of a stream are
+  loaded by a single thread, one after another
+*/
+template <typename Frame>
+class BatchPrefetcher
+{
+  private:
+    struct Slot {
+        Frame frame; /* frame loaded into the slot */
+        int index; /* index of the frame, or -1 */
+        int status; /* value returned by the loader */
+        bool ready; /* the loader is done with the frame */
+        Slot() : index(-1), status(0), ready(false) {};
+    };
+
+    BatchInputs &inputs; /* input frames */
+    std::function<int(Frame *, FILE *, int)> load; /* loads frame index from a file into a Frame, returns 0 if OK */
+    int Nframes; /* number of frames, INT_MAX until the end of a stream is reached */
+    int depth; /* number of slots */
+    std::unique_ptr<Slot[]> slots; /* frame k is loaded into slot k % depth */
+    int nextToLoad; /* next frame to give to a loader thread */
+    int nextToUse; /* next frame to return from next */
+    int released; /* number of frames the caller is done with */
+    bool stopping; /* the threads have to stop */
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<std::thread> threads;
+
+    BatchPrefetcher( const BatchPrefetcher & ); /* not copyable */
+    BatchPrefetcher &operator=( const BatchPrefetcher & );
+
+    /*
+      loads frames until all are loaded or the prefetcher is destroyed
+    */
+    void work( )
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            /* the slot of a frame is free once the frame depth frames before it is released */
+            while (!stopping && nextToLoad < Nframes && nextToLoad >= released + depth)
+                changed.wait(lock);
+            if (stopping || nextToLoad >= Nframes)
+                return;
+            int k = nextToLoad++;
+            Slot &slot = slots[k % depth];
+            slot.ready = false;
+            slot.index = k;
+            lock.unlock();
+            FILE *input;
+            int status = inputs.openFrame(k, input);
+            if (status==0) {
+                status = load(&slot.frame, input, k);
+                inputs.closeFrame(input);
+            }
+            lock.lock();
+            if (status==1 && k < Nframes)
+                Nframes = k; /* end of the stream */
+            slot.status = status;
+            slot.ready = true;
+            changed.notify_all();
+        }
+    }
+
+  public:
+    /*
+      starts loading the frames of inputs with loader on numThreads threads;
+      the loader is given the file opened by inputs.openFrame
+    */
+    BatchPrefetcher( BatchInputs &frames, std::function<int(Frame *, FILE *, int)> loader, int numThreads = getBatchThreads() )
+        : inputs(frames), load(loader), nextToLoad(0), nextToUse(0), released(0), stopping(false)
+    {
+        Nframes = (frames.getNFrames() < 0) ? INT_MAX : frames.getNFrames();
+        if (frames.getNFrames() < 0 || numThreads < 1)
+            numThreads = 1;
+        if (numThreads > Nframes)
+            numThreads = Nframes;
+        depth = numThreads + 2; /* every thread loads a frame while the caller processes one */
+        slots.reset(new Slot[depth]);
+        for (int t = 0; t < numThreads; t++)
+            threads.push_back(std::thread(&BatchPrefetcher::work, this));
+    }
+
+    /*
+      stops the threads (frames being loaded are finished first)
+    */
+    ~BatchPrefetcher( )
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        for (size_t t = 0; t < threads.size(); t++)
+            threads[t].join();
+    }
+
+    /*
+      releases the frame returned by the previous call, waits for the next frame
+      and returns it, with its index and the value returned by the loader;
+      returns NULL after the last frame
+    */
+    Frame *next( int &index, int &status )
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (released < nextToUse) {
+            released = nextToUse;
+            changed.notify_all();
+        }
+        if (nextToUse >= Nframes)
+            return NULL;
+        Slot &slot = slots[nextToUse % depth];
+        while (!(slot.ready && slot.index == nextToUse))
+            changed.wait(lock);
+        if (nextToUse >= Nframes)
+            return NULL; /* end of the stream */
+        index = nextToUse++;
+        status = slot.status;
+        return &slot.frame;
+    }
+};
+
+/*
+  measures the throughput of a batch
+*/
+class BatchTimer
+{
+  public:
+    BatchTimer( ) : startTime(std::chrono::steady_clock::now()), frames(0), failures(0) {};
+
+    /*
+      counts a processed frame, or a frame that could not be processed if ok is false
+    */
+    void countFrame( bool ok )
+    {
+        if (ok)
+            frames++;
+        else
+            failures++;
+    }
+    /*
+      prints the number of frames, the time and the number of frames per second on stderr
+    */
+    void report( ) const;
+
+  private:
+    std::chrono::steady_clock::time_point startTime; /* when the batch started */
+    int frames; /* number of frames processed */
+    int failures; /* number of frames that could not be processed */
+};
+
+#endif
@@ -6,6 +6,7 @@
  ******************************************************************************************/
 
 #include "Database.h"
+#include "Image.h"
 #include <iostream>
 #include <vector>
 #include <cmath>
@@ -14,6 +15,35 @@
 
 using namespace std;
 
+/**
+ * Remove all records; the memory is kept for the records of the next image.
+ */
+void Database::clear( )
+{
+    records.clear();
+}
+
+/**
+ * Return a record with all sums 0 and no properties calculated yet.
+ */
+Database::Record Database::emptyRecord( )
+{
+    Record r;
+    r.areaSum = 0;
+    r.iSum = 0;
+    r.jSum = 0;
+    r.ijSum = 0;
+    r.iSquaredSum = 0;
+    r.jSquaredSum = 0;
+    r.rowCenter = -1;
+    r.colCenter = -1;
+    r.theta = -1;
+    r.minE = -1;
+    r.maxE = -1;
+    r.recognized = false;
+    return r;
+}
+
 /**
  * Initialize database object with NumberOfRecords records.
  * (Label of the element is i+1).
@@ -21,20 +51,7 @@ using namespace std;
 void Database::initializeRecords(int numberOfRecords)
 {
     for (int i=0; i<numberOfRecords; i++) {
-        Record r;
-        r.areaSum = 0;
-        r.iSum = 0;
-        r.jSum = 0;
-        r.ijSum = 0;
-        r.iSquaredSum = 0;
-        r.jSquaredSum = 0;
-        r.rowCenter = -1;
-        r.colCenter = -1;
-        r.theta = -1;
-        r.minE = -1;
-        r.maxE = -1;
-        r.recognized = false;
-        records.push_back(r);
+        records.push_back(emptyRecord( ));
     }
 }
 
@@ -74,38 +91,78 @@ void Database::updateSums(int recordLabel, int i, int j)
     }
 }
 
+/**
+ * Update record for a given object with the pixels start..end of row i (a run), in closed
+ * form: the sums over the run of 1, j and j*j are n, n*(start+end)/2 and the difference of
+ * x*(x+1)*(2x+1)/6 at end and start-1.
+ */
+void Database::updateSums(int recordLabel, int i, int start, int end)
+{
+    if (recordLabel>0 && recordLabel<=records.size( )) {
+        updateSums(records[recordLabel-1], i, start, end);
+    }
+}
+
+/**
+ * Update record r with the pixels start..end of row i like updateSums(recordLabel, i, start,
+ * end).
+ */
+void Database::updateSums(Record &r, int i, int start, int end)
+{
+    if (start<=end) {
+        long long int n = end - start + 1;
+        long long int jSum = n * (start + end) / 2;
+        long long int s = start - 1, e = end;
+        long long int jSquaredSum = (e * (e + 1) * (2 * e + 1) - s * (s + 1) * (2 * s + 1)) / 6;
+        r.areaSum += n;
+        r.iSum += i * n;
+        r.jSum += jSum;
+        r.ijSum += i * jSum;
+        r.iSquaredSum += (long long int)i * i * n;
+        r.jSquaredSum += jSquaredSum;
+    }
+}
+
 /**
  * Calculate properties of objects in the database.
  */
 void Database::calculateProperties( )
+{
+    for (int i=0; i<records.size(); i++) {
+        calculateProperties(records[i]);
+    }
+}
+
+/**
+ * Calculate properties of the object of record r from its sums.
+ */
+void Database::calculateProperties(Record &r)
 {
     double x, y, minTheta, maxTheta, minE, maxE;
     long long int A, aPrim, bPrim, cPrim, a, b, c;
 
-    for (int i=0; i<records.size(); i++) {
-        A = records[i].areaSum;
-        x = 1.0 * records[i].iSum / A;
-        y = 1.0 * records[i].jSum / A;
-        aPrim = records[i].iSquaredSum;
-        bPrim = 2 * records[i].ijSum;
-        cPrim = records[i].jSquaredSum;
-        
-        a = aPrim - x * x * A;
-        b = bPrim - 2 * x * y * A;
-        c = cPrim - y * y * A;
-        
-        minTheta = 0.5 * atan2(double(b), double(a-c));
-        minE = a * pow(sin(minTheta),2) - b * cos(minTheta) * sin(minTheta) + c * pow(cos(minTheta),2);
-        
-        maxTheta = M_PI / 2 + minTheta;
-        maxE = a * pow(sin(maxTheta),2) - b * cos(maxTheta) * sin(maxTheta) + c * pow(cos(maxTheta),2);
-        
-        records[i].rowCenter = int (x + 0.5);
-        records[i].colCenter = int (y + 0.5);
-        records[i].theta = minTheta;
-        records[i].minE = minE;
-        records[i].maxE = maxE;
-   }
+    A = r.areaSum;
+    x = 1.0 * r.iSum / A;
+    y = 1.0 * r.jSum / A;
+    aPrim = r.iSquaredSum;
+    bPrim = 2 * r.ijSum;
+    cPrim = r.jSquaredSum;
+    
+    a = aPrim - x * x * A;
+    b = bPrim - 2 * x * y * A;
+    c = cPrim - y * y * A;
+    
+    minTheta = 0.5 * atan2(double(b), double(a-c));
+    minE = a * pow(sin(minTheta),2) - b * cos(minTheta) * sin(minTheta) + c * pow(cos(minTheta),2);
+    
+    maxTheta = M_PI / 2 + minTheta;
+    maxE = a * pow(sin(maxTheta),2) - b * cos(maxTheta) * sin(maxTheta) + c * pow(cos(maxTheta),2);
+    
+    r.rowCenter = int (x + 0.5);
+    r.colCenter = int (y + 0.5);
+    r.theta = minTheta;
+    r.minE = minE;
+    r.maxE = maxE;
 }
 
 /**
@@ -140,16 +197,16 @@ int Database::readBasicFromTxtFile(const char *fname)
     char line[1024];
     
     /* open it */
-    if (!fname || (input=fopen(fname, "r"))==0){
-        printf("readDatabase: Cannot open file\n");
+    if (!fname || (input=openFile(fname, "r"))==0){
+        fprintf(stderr, "readDatabase: Cannot open file\n");
         return -1;
     }
     
     /* check the header */
-    if (strncmp(fgets(line, sizeof line, input), "label\trowC\tcolC\ttheta\tminE\tmaxE\tarea\n", 37))
+    if (fgets(line, sizeof line, input)==0 || strncmp(line, "label\trowC\tcolC\ttheta\tminE\tmaxE\tarea\n", 37))
     {
-        fclose(input);
-        printf("readDatabase: Invalid format\n");
+        closeFile(input);
+        fprintf(stderr, "readDatabase: Invalid format\n");
         return -1;
     }
 
@@ -163,7 +220,7 @@ int Database::readBasicFromTxtFile(const char *fname)
     }
     
     /* close the file */
-    fclose(input);
+    closeFile(input);
     return 0; /* OK */
 }
 
@@ -176,13 +233,13 @@ int Database::saveInTxtFile(const char *fname) const
     FILE *output;
     
     /* open the file */
-    if (!fname || (output=fopen(fname,"w"))==0){
-        printf("writeDatabase: cannot open file\n");
+    if (!fname || (output=openFile(fname,"w"))==0){
+        fprintf(stderr, "writeDatabase: cannot open file\n");
         return(-1);
     }
     
     int numOfRecords = records.size( );
-    printf("Saving database with %d records\n", numOfRecords);
+    fprintf(stderr, "Saving database with %d records\n", numOfRecords);
     
     /* write the header */
     fprintf(output,"label\trowC\tcolC\ttheta\tminE\tmaxE\tarea\n");
@@ -194,7 +251,7 @@ int Database::saveInTxtFile(const char *fname) const
     }
     
     /* close the file */
-    fclose(output);
+    closeFile(output);
     return 0; /* OK */
 }
 
@@ -205,36 +262,14 @@ int Database::saveInTxtFile(const char *fname) const
 int Database::recognizeObjects(const Database &other)
 {
     int numOfRecognized = 0;
-    vector<Database::Record> recordsOther = other.getRecords( );
     int numOfRecords = records.size( );
-    int numOfRecordsInOther = recordsOther.size( );
-    long long int area, areaOther;
-    double minE, maxE, minEOther, maxEOther, roundness, roundnessOther;
 
     for (int i=0; i<numOfRecords; i++) {
-        area = records[i].areaSum;
-        minE = records[i].minE;
-        maxE = records[i].maxE;
-        roundness = minE / maxE;
-        for (int j=0; j<numOfRecordsInOther; j++) {
-            areaOther = recordsOther[j].areaSum;
-            minEOther = recordsOther[j].minE;
-            maxEOther = recordsOther[j].maxE;
-            roundnessOther = minEOther / maxEOther;
-            // similar area nad similar roundness
-            if (
-                ((area <= areaOther) ? (1.0*area/areaOther >= 0.85) : (1.0*areaOther/area >= 0.85))
-                &&
-                ((roundness <= roundnessOther) ? (roundness/roundnessOther >= 0.90) : (roundnessOther/roundness >=0.90))
-                ) {
-                records[i].recognized = true;
-                numOfRecognized++;
-            }
-        }
+        numOfRecognized += other.recognizeObject(records[i]);
     }
     
     if (numOfRecognized) {
-        printf("Recognized %d objects\n", numOfRecognized);
+        fprintf(stderr, "Recognized %d objects\n", numOfRecognized);
         return 0;
     }
     else {
@@ -242,6 +277,40 @@ int Database::recognizeObjects(const Database &other)
     }
 }
 
+/**
+ * Compare object with the objects in the database: it is recognized (and marked so) if its
+ * area and roundness are similar to those of one of them.
+ * Return the number of objects in the database that are similar to it.
+ */
+int Database::recognizeObject(Record &object) const
+{
+    int numOfSimilar = 0;
+    int numOfRecords = records.size( );
+    long long int area, areaOther;
+    double minE, maxE, minEOther, maxEOther, roundness, roundnessOther;
+
+    area = object.areaSum;
+    minE = object.minE;
+    maxE = object.maxE;
+    roundness = minE / maxE;
+    for (int j=0; j<numOfRecords; j++) {
+        areaOther = records[j].areaSum;
+        minEOther = records[j].minE;
+        maxEOther = records[j].maxE;
+        roundnessOther = minEOther / maxEOther;
+        // similar area nad similar roundness
+        if (
+            ((area <= areaOther) ? (1.0*area/areaOther >= 0.85) : (1.0*areaOther/area >= 0.85))
+            &&
+            ((roundness <= roundnessOther) ? (roundness/roundnessOther >= 0.90) : (roundnessOther/roundness >=0.90))
+            ) {
+            object.recognized = true;
+            numOfSimilar++;
+        }
+    }
+    return numOfSimilar;
+}
+
 /**
  * Return database records.
  */
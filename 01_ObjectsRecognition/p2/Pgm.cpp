@@ -15,331 +15,641 @@
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
+#include <cctype>
+#include <climits>
 #include "Image.h"
 #include "DisjSets.h"
 #include "Database.h"
 #include <vector>
+#include <algorithm>
 #include <iostream>
 #include <cmath>
 
 using namespace std;
 
-int readImage(Image *im, const char *fname)
+FILE *openFile(const char *fname, const char *mode)
 /*
- reads image from fname;
- 
+ opens fname like fopen, "-" is stdin or stdout;
+
+ returns the file or NULL if it cannot be opened.
+ */
+{
+    if (!fname || !mode)
+        return NULL;
+    if (strcmp(fname, "-")==0)
+        return (mode[0]=='r') ? stdin : stdout;
+    return fopen(fname, mode);
+}
+
+int closeFile(FILE *file)
+/*
+ closes file opened by openFile, stdin and stdout are left open (stdout is
+ flushed);
+
+ returns 0 if OK or EOF if something goes wrong.
+ */
+{
+    if (file==stdin)
+        return 0;
+    if (file==stdout)
+        return fflush(file);
+    return fclose(file);
+}
+
+static int readPgmHeaderValue(FILE *input, int &value)
+/*
+ reads a non-negative decimal value of the PGM header, skipping white space
+ and comments before it and the single white space character after it;
+
  returns 0 if OK or -1 if something goes wrong.
  */
 {
-  FILE *input;
-  char line[1024];
-  int nCols,nRows;
-  int levels;
-  int i, j;
+    int c = fgetc(input);
 
-  /* open it */
-  if (!fname || (input=fopen(fname,"r"))==0){
-    printf("readImage: Cannot open file\n");
-    return-1;
-  }
+    /* skip white space and comments */
+    while (c!=EOF && (isspace(c) || c=='#')) {
+        if (c=='#') {
+            while (c!=EOF && c!='\n') {
+                c = fgetc(input);
+            }
+        }
+        else {
+            c = fgetc(input);
+        }
+    }
+    if (!isdigit(c)) {
+        return -1;
+    }
 
-  /* check for the right "magic number" */
-  if (
-        fread(line,1,3,input)!=3
-      ||strncmp(line,"P5\n",3)
-     )
-  {
-    fclose(input);
-    printf("readImage: Expected .pgm file\n");
-    return -1;
-  }
+    value = 0;
+    while (isdigit(c)) {
+        if (value > (INT_MAX - 9) / 10) { /* too large */
+            return -1;
+        }
+        value = value * 10 + (c - '0');
+        c = fgetc(input);
+    }
+    return isspace(c) ? 0 : -1;
+}
 
-  /* skip the comments */
-  do
-    fgets(line,sizeof line,input);
-  while(*line=='#');
+int readPnmHeader(FILE *input, int &format, int &nRows, int &nCols, int &levels)
+/*
+ reads the header of a binary PGM (P5) or PBM (P4) image from input, leaves
+ input at the first pixel;
 
-  /* read the width and height */
-  sscanf(line,"%d %d\n",&nCols,&nRows);
-  im->setSize(nRows, nCols);
+ returns 0 if OK or -1 if something goes wrong.
+ */
+{
+    char magic[2];
 
-  /* read # of gray levels */
-  fgets(line,sizeof line,input);
-  sscanf(line,"%d\n",&levels);
-  im->setColors(levels);
+    /* check for the right "magic number" */
+    if (fread(magic,1,2,input)!=2 || magic[0]!='P' || (magic[1]!='5' && magic[1]!='4')) {
+        fprintf(stderr, "readImage: Expected .pgm file\n");
+        return -1;
+    }
+    format = magic[1] - '0';
 
-  /* read pixel row by row */
-  for(i=0;i<nRows;i++)
-  {
-    for(j=0;j<nCols;j++)
-    {
-      int byte=fgetc(input);
+    /* read the width, height and # of gray levels (PBM images have 1 color) */
+    levels = 1;
+    if (readPgmHeaderValue(input, nCols)!=0
+        || readPgmHeaderValue(input, nRows)!=0
+        || (format==5 && readPgmHeaderValue(input, levels)!=0)) {
+        fprintf(stderr, "readImage: Corrupted .pgm header\n");
+        return -1;
+    }
+    return 0; /* OK */
+}
+
+int readPgmHeader(FILE *input, int &nRows, int &nCols, int &levels)
+/*
+ reads the header of a binary PGM image from input, leaves input at the first pixel;
+
+ returns 0 if OK or -1 if something goes wrong.
+ */
+{
+    int format;
+
+    if (readPnmHeader(input, format, nRows, nCols, levels)!=0)
+        return -1;
+    if (format!=5) {
+        fprintf(stderr, "readImage: Expected .pgm file\n");
+        return -1;
+    }
+    return 0; /* OK */
+}
+
+int hasNextImage(FILE *input)
+/*
+ skips the white space after an image of input;
+
+ returns 1 if another image follows or 0 at the end of input.
+ */
+{
+    int c;
+
+    /* images of a stream may be separated by white space */
+    while ((c=getc(input))!=EOF && isspace(c))
+        ;
+    if (c==EOF)
+        return 0;
+    ungetc(c, input);
+    return 1;
+}
+
+static FILE *openImageFile(const char *fname)
+/*
+ opens image fname for reading;
+
+ returns the file or NULL if it cannot be opened.
+ */
+{
+    FILE *input;
+
+    if (!fname || (input=openFile(fname,"rb"))==0) {
+        fprintf(stderr, "readImage: Cannot open file\n");
+        return NULL;
+    }
+    return input;
+}
+
+template <typename T>
+static int readPgmImageHeader(FILE *input, Image<T> *im, int &levels)
+/*
+ reads the header of PGM image from input and sets the size of im;
+
+ returns 0 if OK or -1 if something goes wrong.
+ */
+{
+    int nCols, nRows;
+
+    if (readPgmHeader(input, nRows, nCols, levels)!=0)
+        return -1;
+    im->setSize(nRows, nCols);
+    return 0; /* OK */
+}
+
+template <typename T>
+static FILE *openPgmImage(Image<T> *im, const char *fname, int &levels)
+/*
+ opens PGM image fname, reads its header and sets the size of im;
+
+ returns the file positioned at the first pixel or NULL if something goes wrong.
+ */
+{
+    FILE *input;
+
+    if ((input=openImageFile(fname))==NULL)
+        return NULL;
+    if (readPgmImageHeader(input, im, levels)!=0) {
+        closeFile(input);
+        return NULL;
+    }
+    return input;
+}
+
+static inline uint8_t reverseBits(uint8_t b)
+/*
+ reverses the order of the bits of a byte; bytes of PBM files hold the
+ leftmost pixel in the most significant bit, words of BinaryImage in the
+ least significant one
+ */
+{
+    b = uint8_t(((b & 0xF0) >> 4) | ((b & 0x0F) << 4));
+    b = uint8_t(((b & 0xCC) >> 2) | ((b & 0x33) << 2));
+    b = uint8_t(((b & 0xAA) >> 1) | ((b & 0x55) << 1));
+    return b;
+}
 
-      if (byte==EOF) /* short file */
-      {
-        fclose(input);
-        printf("readImage: short file\n");
+static void pbmRowToWords(const uint8_t *bytes, int nBytes, uint64_t *words)
+/*
+ converts a row of nBytes bytes of a PBM file into the words of a row of
+ BinaryImage
+ */
+{
+    for (int b=0; b<nBytes; b++) {
+        if ((b & 7)==0)
+            words[b >> 3] = 0;
+        words[b >> 3] |= uint64_t(reverseBits(bytes[b])) << (8 * (b & 7));
+    }
+}
+
+static void wordsToPbmRow(const uint64_t *words, int nBytes, uint8_t *bytes)
+/*
+ converts the words of a row of BinaryImage into a row of nBytes bytes of
+ a PBM file
+ */
+{
+    for (int b=0; b<nBytes; b++)
+        bytes[b] = reverseBits(uint8_t(words[b >> 3] >> (8 * (b & 7))));
+}
+
+template <typename T>
+static int readAndPackPgmPixels(FILE *input, int levels, const Threshold &threshold, BinaryImage *im)
+/*
+ reads the pixels of a PGM image from input, counting their histogram,
+ then packs them into packed binary image im (which has the size of the
+ image) with the threshold chosen from the histogram;
+
+ returns 0 if OK or -1 if the file is short.
+ */
+{
+    int nRows = im->getNRows(), nCols = im->getNCols();
+    Image<T> pixels;
+    Histogram histogram;
+
+    if (pixels.setSize(nRows, nCols) < 0 || readPgmPixels(input, &pixels, levels, &histogram)!=0)
         return -1;
-      }
-      else
-        im->setPixel(i,j,byte);
+    int level = threshold.choose(histogram);
+    for (int i=0; i<nRows; i++)
+        packBinaryRow(pixels.row(i), nCols, level, im->row(i));
+    return 0; /* OK */
+}
+
+static int readBinaryPixels(FILE *input, int format, int levels, const Threshold &threshold, BinaryImage *im)
+/*
+ reads pixels of a PBM (format 4) or PGM (format 5) image from input into
+ packed binary image im, which has the size of the image; PGM pixels greater
+ than threshold are 1;
+
+ returns 0 if OK or -1 if the file is short.
+ */
+{
+    int nRows = im->getNRows(), nCols = im->getNCols();
+    int i, j;
+
+    if (format==4) {
+        /* PBM: read each row of bytes and convert it to words */
+        int bytesPerRow = (nCols + 7) / 8;
+        vector<uint8_t> bytes(bytesPerRow);
+        for (i=0; i<nRows; i++) {
+            if (fread(&bytes[0], 1, bytesPerRow, input)!=size_t(bytesPerRow)) {
+                fprintf(stderr, "readImage: short file\n");
+                return -1;
+            }
+            pbmRowToWords(&bytes[0], bytesPerRow, im->row(i));
+        }
+        im->clearPadding();
+        return 0; /* OK */
+    }
+
+    /* PGM with an automatic threshold: read the whole image and its histogram, then pack it */
+    if (threshold.isAuto()) {
+        if (levels > 255)
+            return readAndPackPgmPixels<uint16_t>(input, levels, threshold, im);
+        return readAndPackPgmPixels<uint8_t>(input, levels, threshold, im);
     }
+
+    /* PGM: read each row and pack it, pixel j in bit j % 64 of word j / 64 */
+    Histogram unused; /* a fixed threshold needs no histogram */
+    int level = threshold.choose(unused);
+    int bytesPerPixel = (levels > 255) ? 2 : 1;
+    vector<unsigned char> bytes(nCols * bytesPerPixel);
+    vector<uint16_t> samples(bytesPerPixel==2 ? nCols : 0);
+    for (i=0; i<nRows; i++) {
+        if (fread(&bytes[0], bytesPerPixel, nCols, input)!=size_t(nCols)) {
+            fprintf(stderr, "readImage: short file\n");
+            return -1;
+        }
+        if (bytesPerPixel==1) {
+            packBinaryRow(&bytes[0], nCols, level, im->row(i));
+            continue;
+        }
+        for (j=0; j<nCols; j++)
+            samples[j] = uint16_t((bytes[2*j] << 8) | bytes[2*j+1]);
+        packBinaryRow(&samples[0], nCols, level, im->row(i));
+    }
+    return 0; /* OK */
+}
+
+template <typename T>
+int readPgmPixels(FILE *input, Image<T> *im, int levels, Histogram *histogram)
+/*
+ reads the pixels of im from input, a whole row per fread; pixels of images
+ with more than 255 gray levels are 16-bit, most significant byte first;
+ rows are counted in histogram (unless it is NULL) right after they are
+ read, while they are still in the cache;
+
+ returns 0 if OK or -1 if the file is short.
+ */
+{
+    int nRows = im->getNRows(), nCols = im->getNCols();
+    int bytesPerPixel = (levels > 255) ? 2 : 1;
+    bool convert = (sizeof(T)!=1 || bytesPerPixel!=1);
+    int i, j;
+    vector<unsigned char> bytes(convert ? nCols * bytesPerPixel : 0);
+
+    if (histogram)
+        histogram->reset(levels);
+    for(i=0; i<nRows; i++) {
+        T *pixels = im->row(i);
+        /* bytes go straight into the pixel buffer, wider pixels and 16-bit samples are converted */
+        unsigned char *buffer = convert ? &bytes[0] : (unsigned char *)pixels;
+        if (nCols>0 && fread(buffer, bytesPerPixel, nCols, input)!=size_t(nCols)) {
+            fprintf(stderr, "readImage: short file\n");
+            return -1;
+        }
+        if (convert) {
+            for(j=0; j<nCols; j++) {
+                pixels[j] = (bytesPerPixel==1) ? T(bytes[j]) : T((bytes[2*j] << 8) | bytes[2*j+1]);
+            }
+        }
+        if (histogram)
+            histogram->addRow(pixels, nCols);
+    }
+    return 0; /* OK */
+}
+
+template <typename T>
+int readImage(Image<T> *im, const char *fname)
+/*
+ reads image from fname;
+ 
+ returns 0 if OK or -1 if something goes wrong.
+ */
+{
+  FILE *input;
+  int levels;
+
+  if ((input=openPgmImage(im, fname, levels))==NULL) {
+    return -1;
+  }
+  im->setColors(levels);
+
+  /* read pixels */
+  if (readPgmPixels(input, im, levels)!=0) {
+    closeFile(input);
+    return -1;
   }
 
   /* close the file */
-  fclose(input);
+  closeFile(input);
   return 0; /* OK */
 }
 
-int readAsBinaryImage(Image *im, const char *fname, int threshold)
+template <typename T>
+int readAsBinaryImage(Image<T> *im, const char *fname, const Threshold &threshold)
 /*
- reads image from fname, saves as binary image in Image object im;
+ reads image from fname, saves as binary image in Image object im; an
+ automatic threshold is chosen from the histogram of the image;
  
  returns 0 if OK or -1 if something goes wrong.
  */
 {
     FILE *input;
-    char line[1024];
-    int nCols,nRows;
-    int i, j;
+    int levels;
+    int i;
+    Histogram histogram;
     
-    /* open it */
-    if (!fname || (input=fopen(fname,"r"))==0){
-        printf("readImage: Cannot open file\n");
-        return-1;
+    if ((input=openPgmImage(im, fname, levels))==NULL) {
+        return -1;
     }
+    im->setColors(1); /* a binary image can be saved as a PGM file with 1 as the number of colors in the header */
     
-    /* check for the right "magic number" */
-    if (
-        fread(line,1,3,input)!=3
-        ||strncmp(line,"P5\n",3)
-        )
-    {
-        fclose(input);
-        printf("readImage: Expected .pgm file\n");
+    /* read pixels */
+    if (readPgmPixels(input, im, levels, threshold.isAuto() ? &histogram : NULL)!=0) {
+        closeFile(input);
         return -1;
     }
+    closeFile(input);
     
-    /* skip the comments */
-    do
-        fgets(line,sizeof line,input);
-    while(*line=='#');
+    /* threshold row by row; 0 is black, 255 is white */
+    int level = threshold.choose(histogram);
+    int nRows = im->getNRows(), nCols = im->getNCols();
+    for(i=0; i<nRows; i++) {
+        binarizeRow(im->row(i), nCols, level);
+    }
     
-    /* read the width and height */
-    sscanf(line,"%d %d\n",&nCols,&nRows);
-    im->setSize(nRows, nCols);
+    return 0; /* OK */
+}
+
+int readAsBinaryImage(BinaryImage *im, const char *fname, const Threshold &threshold)
+/*
+ reads PGM image from fname and thresholds it, or reads PBM image from fname,
+ into packed binary image im;
+ 
+ returns 0 if OK or -1 if something goes wrong.
+ */
+{
+    FILE *input;
     
-    /* read line with # of gray levels */
-    fgets(line,sizeof line,input);
-    im->setColors(1); /* a binary image can be saved as a PGM file with 1 as the number of colors in the header */
+    if ((input=openImageFile(fname))==NULL)
+        return -1;
+    int result = readAsBinaryImage(im, input, threshold);
+    closeFile(input);
+    return result;
+}
+
+int readAsBinaryImage(BinaryImage *im, FILE *input, const Threshold &threshold)
+/*
+ reads the next image of input like readAsBinaryImage(im, fname, threshold) and
+ leaves input at the end of the image;
+ 
+ returns 0 if OK or -1 if something goes wrong.
+ */
+{
+    int format, nCols, nRows, levels;
     
-    /* read pixels row by row */
-    for(i=0; i<nRows; i++) {
-        for(j=0; j<nCols; j++) {
-            int byte=fgetc(input);
-            
-            if (byte==EOF) /* short file */ {
-                fclose(input);
-                printf("readImage: short file\n");
-                return -1;
+    if (readPnmHeader(input, format, nRows, nCols, levels)!=0)
+        return -1;
+    if (im->setSize(nRows, nCols) < 0 || readBinaryPixels(input, format, levels, threshold, im)!=0)
+        return -1;
+    return 0; /* OK */
+}
+
+int
+labelRuns(const RunLengthImage &runs, vector<int> &labels)
+/*
+ labels the runs of runs, objects are numbered from 1 in the order of their
+ first pixels;
+
+ returns the number of objects.
+ */
+{
+    int nRows = runs.getNRows();
+    int numOfRuns = runs.getNumberOfRuns();
+    
+    labels.assign(numOfRuns, 0);
+    if (numOfRuns==0)
+        return 0;
+    
+    /* FIRST RUN */
+    
+    /* a run gets the label of the first run above that it touches and joins
+       the others; a run that touches none gets a new label, so new labels
+       are in the order of the objects' first pixels */
+    DisjSets sets;
+    const RunLengthImage::Run *all = runs.row(0);
+    int above = 0, aboveEnd = 0; /* runs of the row above */
+    for (int i=0; i<nRows; i++) {
+        int first = int(runs.row(i) - all), end = first + runs.getNumberOfRuns(i);
+        for (int r=first; r<end; r++) {
+            /* runs above that end before NW of the first pixel touch neither
+               this run nor the next ones */
+            while (above < aboveEnd && all[above].end < all[r].start - 1)
+                above++;
+            int label = 0;
+            for (int a=above; a<aboveEnd && all[a].start <= all[r].end; a++) {
+                if (label==0)
+                    label = labels[a];
+                else
+                    sets.unionSets(label, labels[a]);
             }
-            else {
-                /* 0 is black, 255 is white */
-                if (byte<=threshold) {
-                    im->setPixel(i,j,0);
-                }
-                else {
-                    im->setPixel(i,j,1);
-                }
+            if (label==0) {
+                sets.addElement( );
+                label = sets.getNumberOfLabels( );
             }
+            labels[r] = label;
         }
+        above = first;
+        aboveEnd = end;
     }
     
-    /* close the file */
-    fclose(input);
-    return 0; /* OK */
+    /* SECOND RUN */
+    
+    /* flatten the equivalences into a table of final labels */
+    vector<int> finalLabels;
+    int numOfObjects = sets.flatten(finalLabels);
+    for (int r=0; r<numOfRuns; r++)
+        labels[r] = finalLabels[labels[r]];
+    return numOfObjects;
+}
+
+template <typename T>
+static int labelBinaryRuns(const BinaryImage *binary, Image<T> *im, Database *db)
+/*
+ labels the runs of binary like labelRuns, saves labeled binary image in
+ Image object im (background pixels are 0, every run is filled with its
+ label) and, unless db is NULL, adds every run to the sums of its object in
+ db in the same pass;
+
+ returns the number of objects or -1 if the image is empty.
+ */
+{
+    int nRows = binary->getNRows(), nCols = binary->getNCols();
+    RunLengthImage runs;
+    vector<int> labels;
+    
+    runs.encode(*binary);
+    int numOfObjects = labelRuns(runs, labels);
+    if (im->setSize(nRows, nCols) < 0)
+        return -1;
+    im->setColors(numOfObjects);
+    if (db)
+        db->initializeRecords(numOfObjects);
+
+    const int *label = labels.data();
+    for (int i=0; i<nRows; i++) {
+        T *pixels = im->row(i);
+        for (int j=0; j<nCols; j++)
+            pixels[j] = 0;
+        const RunLengthImage::Run *run = runs.row(i);
+        for (int r=0; r<runs.getNumberOfRuns(i); r++, label++) {
+            std::fill(pixels + run[r].start, pixels + run[r].end + 1, T(*label));
+            if (db)
+                db->updateSums(*label, i, run[r].start, run[r].end);
+        }
+    }
+    return numOfObjects;
+}
+
+template <typename T>
+int labelAndMeasureBinaryImage(const BinaryImage *binary, Image<T> *im, Database &db)
+/*
+ labels binary like readAndLabelBinaryImage, saves labeled binary image in
+ Image object im and objects' info in db, in one pass over the runs;
+ 
+ returns 0 if OK or -1 if something goes wrong.
+ */
+{
+    return (labelBinaryRuns(binary, im, &db) < 0) ? -1 : 0;
 }
 
-int readAndLabelBinaryImage(Image *im, const char *fname)
+template <typename T>
+int readAndLabelBinaryImage(Image<T> *im, const char *fname)
 /*
- reads binary image from fname, saves labeled binary image in Image object im;
+ reads binary image (PBM, or PGM with 1 color) from fname, saves labeled
+ binary image in Image object im;
  
  returns 0 if OK or -1 if something goes wrong.
  */
 {
     FILE *input;
-    char line[1024];
-    int nCols,nRows;
+    
+    if ((input=openImageFile(fname))==NULL)
+        return -1;
+    int result = readAndLabelBinaryImage(im, input);
+    closeFile(input);
+    return result;
+}
+
+template <typename T>
+int readAndLabelBinaryImage(Image<T> *im, FILE *input)
+/*
+ reads the next image of input like readAndLabelBinaryImage(im, fname) and
+ leaves input at the end of the image;
+ 
+ returns 0 if OK or -1 if something goes wrong.
+ */
+{
+    int format, nCols, nRows;
     int levels;
-    int i, j;
+    BinaryImage binary;
     
-    /* open it */
-    if (!fname || (input=fopen(fname,"r"))==0) {
-        printf("readImage: Cannot open file\n");
+    if (readPnmHeader(input, format, nRows, nCols, levels)!=0) {
         return -1;
     }
     
-    /* check for the right "magic number" */
-    if (fread(line,1,3,input)!=3 || strncmp(line,"P5\n",3)) {
-        fclose(input);
-        printf("readImage: Expected .pgm file\n");
+    /* check if binary image */
+    if (levels!=1) {
+        fprintf(stderr, "readImage: Expected binary .pgm file\n");
         return -1;
     }
     
-    /* skip the comments */
-    do {
-        fgets(line,sizeof line,input);
+    /* read pixels */
+    if (binary.setSize(nRows, nCols) < 0 || readBinaryPixels(input, format, levels, 0, &binary)!=0) {
+        return -1;
     }
-    while (*line=='#');
-    
-    /* read the width and height */
-    sscanf(line,"%d %d\n",&nCols,&nRows);
-    im->setSize(nRows, nCols);
     
-    /* read line with # of gray levels, check if binary image  */
-    fgets(line,sizeof line,input);
-    sscanf(line,"%d\n",&levels);
-    if (levels!=1) {
-        fclose(input);
-        printf("readImage: Expected binary .pgm file\n");
+    /* label the runs of pixels that are 1, save # levels (num of objects) */
+    if ((levels=labelBinaryRuns(&binary, im, NULL)) < 0) {
         return -1;
     }
+    fprintf(stderr, "Number of objects: %d\n", levels);
     
-    /* FIRST RUN */
-    
-    /* read pixel row by row, label starting from 1 */
-    int nextLabel = 0;
-    DisjSets labels;
-
-    for(i=0; i<nRows; i++) {
-        
-        for(j=0; j<nCols; j++) {
-            
-            int byte = fgetc(input);
+    return 0; /* OK */
+}
 
-            if (byte==EOF) /* short file */ {
-                fclose(input);
-                printf("readImage: short file\n");
-                return -1;
-            }
-            else {
-                /* 0 is black, 255 is white */
-                if (byte!=0) {
-                    int NW, N, W;
-
-                    /* most pixels--except for top row and left column */
-                    if (i!=0 && j!=0) { /* check pixels in the following order: NW, N, W */
-
-                        NW = im->getPixel(i-1,j-1);
-                        N = im->getPixel(i-1,j);
-                        W = im->getPixel(i,j-1);
-                        
-                        if (NW!=0) {
-                            im->setPixel(i,j,NW);
-                            if (N!=0 && W==0 && N!=NW) {
-                                labels.unionSets(NW,N);
-                            }
-                            if (W!=0 && N==0 && W!=NW) {
-                                labels.unionSets(NW,W);
-                            }
-                            if (W!=0 && N!=0 && W!=N) {
-                                labels.unionSets(N,W);
-                            }
-                        }
-                        else {
-                            if (N!=0 && W==0) {
-                                im->setPixel(i,j,N);
-                            }
-                            else if (N==0 && W!=0) {
-                                im->setPixel(i,j,W);
-                            }
-                            else if (N==0 && W==0) {
-                                im->setPixel(i,j,++nextLabel);
-                                labels.addElement( );
-                            }
-                            else if (N!=0 && W!=0) {
-                                if (N==W) {
-                                    im->setPixel(i,j,N);
-                                }
-                                else {
-                                    labels.unionSets(N,W);
-                                    im->setPixel(i,j,N);
-                                }
-                            }
-                        }
-                    }
-                    /* top left corner */
-                    if (i==0 && j==0) {
-                        im->setPixel(i,j,++nextLabel);
-                        labels.addElement( );
-                    }
-                    /* top row */
-                    if (i==0 && j!=0) {
-                        W = im->getPixel(i,j-1);
-                        if (W!=0) {
-                            im->setPixel(i,j,W);
-                        }
-                        else {
-                            im->setPixel(i,j,++nextLabel);
-                            labels.addElement( );
-                        }
-                    }
-                    /* left column */
-                    if (i!=0 && j==0)  {
-                        N = im->getPixel(i-1,j);
-                        if (N!=0) {
-                            im->setPixel(i,j,N);
-                        }
-                        else {
-                            im->setPixel(i,j,++nextLabel);
-                            labels.addElement( );
-                        }
-                    }
-                }
-            }
-        }
-    }
-    
-    /* save # levels (num of objects) */
-    levels = labels.getNumberOfLevels( );
-    im->setColors(levels);
-    printf("Number of objects: %d\n", levels);
+template <typename T>
+static int readLabelPixels(FILE *input, Image<T> *im, int levels)
+/*
+ reads the pixels of a labeled image from input: 8- or 16-bit like
+ readPgmPixels, or 32-bit, most significant byte first, if there are more
+ than 65535 labels (see writeLabeledImage);
 
-    /* SECOND RUN */
+ returns 0 if OK or -1 if the file is short.
+ */
+{
+    if (levels <= 65535)
+        return readPgmPixels(input, im, levels);
 
-    /* create a finalLabels vector with labels of all sets */
-    vector<int> finalLabels;
-    finalLabels.push_back(-1);
-    vector<int> listOfLevels = labels.getLevels( );
-    int label, numOfLabels = labels.getNumberOfLabels( );
-
-    for (i=1; i<=numOfLabels; i++) {
-        label = labels.find(i);
-        for (j=0; j < listOfLevels.size(); j++) {
-            if (label==listOfLevels[j]) {
-                label = j+1;
-            }
+    int nRows = im->getNRows(), nCols = im->getNCols();
+    vector<unsigned char> bytes(size_t(nCols) * 4);
+    for (int i=0; i<nRows; i++) {
+        T *pixels = im->row(i);
+        if (fread(&bytes[0], 4, nCols, input)!=size_t(nCols)) {
+            fprintf(stderr, "readImage: short file\n");
+            return -1;
         }
-        finalLabels.push_back(label);
-    }
-
-    /* relabel the image */
-    int l;
-    for(i=0; i<nRows; i++) {
-        for(j=0; j<nCols; j++) {
-            l = im->getPixel(i,j);
-            if (l>0 && l<=finalLabels.size( )) {
-                im->setPixel(i,j,finalLabels[l]);
-            }
+        for (int j=0; j<nCols; j++) {
+            const unsigned char *b = &bytes[4*j];
+            pixels[j] = T((uint32_t(b[0]) << 24) | (uint32_t(b[1]) << 16) | (uint32_t(b[2]) << 8) | b[3]);
         }
     }
-    
-    /* close the file */
-    fclose(input);
     return 0; /* OK */
 }
 
-int readLabeledImage(Image *im, const char *fname, Database &db)
+template <typename T>
+int readLabeledImage(Image<T> *im, const char *fname, Database &db)
 /*
  reads labeled image from fname, saves objects' info in db Database;
  
@@ -347,69 +657,76 @@ int readLabeledImage(Image *im, const char *fname, Database &db)
  */
 {
     FILE *input;
-    char line[1024];
-    int nCols,nRows;
-    int levels;
-    int i, j;
     
-    /* open it */
-    if (!fname || (input=fopen(fname,"r"))==0){
-        printf("readImage: Cannot open file\n");
+    if ((input=openImageFile(fname))==NULL)
         return -1;
-    }
+    int result = readLabeledImage(im, input, db);
+    closeFile(input);
+    return result;
+}
+
+template <typename T>
+int readLabeledImage(Image<T> *im, FILE *input, Database &db)
+/*
+ reads the next image of input like readLabeledImage(im, fname, db) and leaves
+ input at the end of the image;
+ 
+ returns 0 if OK or -1 if something goes wrong.
+ */
+{
+    int format, nCols, nRows, levels;
+    int i, j;
     
-    /* check for the right "magic number" */
-    if ( fread(line,1,3,input)!=3 ||strncmp(line,"P5\n",3)) {
-        fclose(input);
-        printf("readImage: Expected .pgm file\n");
+    if (readPnmHeader(input, format, nRows, nCols, levels)!=0) {
         return -1;
     }
     
-    /* skip the comments */
-    do {
-        fgets(line,sizeof line,input);
+    /* a binary image (PBM, or PGM with 1 color) is labeled while its objects
+       are measured; a labeled image of one object is labeled the same */
+    if (levels==1) {
+        BinaryImage binary;
+        if (binary.setSize(nRows, nCols) < 0 || readBinaryPixels(input, format, levels, 0, &binary)!=0) {
+            return -1;
+        }
+        return labelAndMeasureBinaryImage(&binary, im, db);
+    }
+    if (format!=5) {
+        fprintf(stderr, "readImage: Expected .pgm file\n");
+        return -1;
     }
-    while (*line=='#');
     
-    /* read the width and height */
-    sscanf(line,"%d %d\n",&nCols,&nRows);
+    /* # of gray levels is the number of objects in the image */
     im->setSize(nRows, nCols);
-    
-    /* read # of gray levels, i.e. the number of objects in the image */
-    fgets(line,sizeof line,input);
-    sscanf(line,"%d\n",&levels);
     im->setColors(levels);
     db.initializeRecords(levels);
     
-    /* read pixel row by row */
-    for(i=0; i<nRows; i++)
-    {
-        for(j=0; j<nCols; j++)
-        {
-            int byte=fgetc(input);
-            
-            if (byte==EOF) /* short file */
-            {
-                fclose(input);
-                printf("readImage: short file\n");
-                return -1;
+    /* read pixels */
+    if (readLabelPixels(input, im, levels)!=0) {
+        return -1;
+    }
+    
+    /* collect objects' info row by row, a run of pixels with the same label
+       at a time */
+    for(i=0; i<nRows; i++) {
+        const T *pixels = im->row(i);
+        for(j=0; j<nCols; ) {
+            if (pixels[j]==0) {
+                j++;
+                continue;
             }
-            else {
-                im->setPixel(i,j,byte);
-                if (byte!=0) {
-                    db.updateSums(byte, i, j);
-                    
-                }
+            int start = j;
+            T label = pixels[j];
+            while (++j<nCols && pixels[j]==label) {
             }
+            db.updateSums(int(label), i, start, j-1);
         }
     }
     
-    /* close the file */
-    fclose(input);
     return 0; /* OK */
 }
 
-int addPositionAndOrientation(Image *im, Database &db, bool recognizedOnly)
+template <typename T>
+int addPositionAndOrientation(Image<T> *im, Database &db, bool recognizedOnly)
 /*
  draws objects' positions and orientations in the image;
  
@@ -437,19 +754,18 @@ int addPositionAndOrientation(Image *im, Database &db, bool recognizedOnly)
         line(im, x0, y0, x1, y1, 0);
         
         // draw point (position)
-        for (int k=x0-1; k<=x0+1; k++) {
-            for (int j=y0-1; j<=y0+1; j++) {
-                im->setPixel(k, j, 0);
-            }
-        }
+        im->view(x0-1, y0-1, 3, 3).fill(0);
     }
     return 0;
 }
 
 
-int writeImage(const Image *im, const char *fname)
+template <typename T>
+int writeImage(const Image<T> *im, const char *fname)
 /*
- writes the image into fname;
+ writes the image into fname, a whole row per fwrite; images with more than
+ 255 colors are saved with 16-bit pixels (most significant byte first, at
+ most 65535); pixel values are clamped to the range of the file;
  
  returns 0 if OK or -1 if something goes wrong.
  */
@@ -461,38 +777,197 @@ int writeImage(const Image *im, const char *fname)
     int i, j;
     
     /* open the file */
-    if (!fname || (output=fopen(fname,"w"))==0){
-        printf("writeImage: cannot open file\n");
+    if (!fname || (output=openFile(fname,"wb"))==0){
+        fprintf(stderr, "writeImage: cannot open file\n");
         return(-1);
     }
     nRows=im->getNRows();
     nCols=im->getNCols();
     colors=im->getColors();
     
-    printf("Saving image of size %d %d\n", nRows, nCols);
+    /* more than 255 colors need 16-bit pixels */
+    int bytesPerPixel = (colors > 255) ? 2 : 1;
+    int maxValue = (colors > 255) ? 65535 : 255;
+    if (colors > 65535) {
+        colors = 65535;
+    }
+    
+    fprintf(stderr, "Saving image of size %d %d\n", nRows, nCols);
+    /* write the header */
+    fprintf(output,"P5\n"); /* magic number */
+    fprintf(output,"#\n");  /* empty comment */
+    fprintf(output,"%d %d\n%03d\n",nCols,nRows,colors); /* image info */
+    
+    /* write pixels row by row; 8-bit pixels are written straight from the image */
+    bool convert = (sizeof(T)!=1 || bytesPerPixel!=1);
+    vector<unsigned char> bytes(convert ? nCols * bytesPerPixel : 0);
+    for(i=0; i<nRows; i++)
+    {
+        const T *pixels = im->row(i);
+        const void *data = pixels;
+        if (convert) {
+            for(j=0; j<nCols; j++) {
+                double v = double(pixels[j]);
+                int value = (v <= 0) ? 0 : (v >= maxValue) ? maxValue : int(v);
+                if (bytesPerPixel==1) {
+                    bytes[j] = (unsigned char)value;
+                }
+                else {
+                    bytes[2*j] = (unsigned char)(value >> 8);
+                    bytes[2*j+1] = (unsigned char)(value & 0xFF);
+                }
+            }
+            data = &bytes[0];
+        }
+        if (nCols>0 && fwrite(data, bytesPerPixel, nCols, output)!=size_t(nCols)) /* couldn't write */
+        {
+            closeFile(output);
+            fprintf(stderr, "writeImage: could not write\n");
+            return -1;
+        }
+    }
+    
+    /* close the file */
+    if (closeFile(output)!=0) {
+        fprintf(stderr, "writeImage: could not write\n");
+        return -1;
+    }
+    return 0; /* OK */
+}
+
+template <typename T>
+int writeLabeledImage(const Image<T> *im, const char *fname)
+/*
+ writes labeled image into fname without losing labels: like writeImage
+ (8-bit pixels for up to 255 objects, 16-bit for up to 65535) or, for more
+ objects, with 32-bit pixels, most significant byte first; PGM stops at
+ 65535 gray levels, so these files are read back by readLabeledImage only;
+ 
+ returns 0 if OK or -1 if something goes wrong.
+ */
+{
+    FILE *output;
+    int nRows = im->getNRows(), nCols = im->getNCols();
+    int colors = im->getColors();
+    int i, j;
+    
+    if (colors <= 65535)
+        return writeImage(im, fname);
+    
+    /* open the file */
+    if (!fname || (output=openFile(fname,"wb"))==0){
+        fprintf(stderr, "writeImage: cannot open file\n");
+        return(-1);
+    }
+    
+    fprintf(stderr, "Saving image of size %d %d\n", nRows, nCols);
     /* write the header */
     fprintf(output,"P5\n"); /* magic number */
     fprintf(output,"#\n");  /* empty comment */
     fprintf(output,"%d %d\n%03d\n",nCols,nRows,colors); /* image info */
     
     /* write pixels row by row */
+    vector<unsigned char> bytes(size_t(nCols) * 4);
     for(i=0; i<nRows; i++)
     {
-        for(j=0; j<nCols; j++)
+        const T *pixels = im->row(i);
+        for(j=0; j<nCols; j++) {
+            uint32_t value = (pixels[j] <= 0) ? 0 : uint32_t(pixels[j]);
+            bytes[4*j] = (unsigned char)(value >> 24);
+            bytes[4*j+1] = (unsigned char)(value >> 16);
+            bytes[4*j+2] = (unsigned char)(value >> 8);
+            bytes[4*j+3] = (unsigned char)(value & 0xFF);
+        }
+        if (fwrite(&bytes[0], 4, nCols, output)!=size_t(nCols)) /* couldn't write */
         {
-            int byte=im->getPixel(i,j);
-            
-            if (fputc(byte,output)==EOF) /* couldn't write */
-            {
-                fclose(output);
-                printf("writeImage: could not write\n");
-                return -1;
-            }
+            closeFile(output);
+            fprintf(stderr, "writeImage: could not write\n");
+            return -1;
         }
     }
     
     /* close the file */
-    fclose(output);
+    if (closeFile(output)!=0) {
+        fprintf(stderr, "writeImage: could not write\n");
+        return -1;
+    }
     return 0; /* OK */
 }
 
+int writeImage(const BinaryImage *im, const char *fname)
+/*
+ writes packed binary image im into fname: as PBM (1 bit per pixel) if fname
+ ends with ".pbm", otherwise as PGM with 1 color;
+ 
+ returns 0 if OK or -1 if something goes wrong.
+ */
+{
+    FILE *output;
+    int nRows;
+    int nCols;
+    int i, j;
+    
+    /* .pbm files get 1 bit per pixel, anything else a PGM image with 1 color */
+    size_t length = fname ? strlen(fname) : 0;
+    bool pbm = (length >= 4 && strcmp(fname + length - 4, ".pbm")==0);
+    
+    /* open the file */
+    if (!fname || (output=openFile(fname,"wb"))==0){
+        fprintf(stderr, "writeImage: cannot open file\n");
+        return(-1);
+    }
+    nRows=im->getNRows();
+    nCols=im->getNCols();
+    
+    fprintf(stderr, "Saving image of size %d %d\n", nRows, nCols);
+    /* write the header */
+    fprintf(output, pbm ? "P4\n" : "P5\n"); /* magic number */
+    fprintf(output,"#\n");  /* empty comment */
+    if (pbm)
+        fprintf(output,"%d %d\n",nCols,nRows); /* image info */
+    else
+        fprintf(output,"%d %d\n%03d\n",nCols,nRows,1); /* image info */
+    
+    /* write pixels row by row */
+    int rowSize = pbm ? (nCols + 7) / 8 : nCols;
+    vector<unsigned char> bytes(rowSize);
+    for(i=0; i<nRows && rowSize>0; i++)
+    {
+        if (pbm)
+            wordsToPbmRow(im->row(i), rowSize, &bytes[0]);
+        else
+            for(j=0; j<nCols; j++)
+                bytes[j] = (unsigned char)im->get(i, j);
+        if (fwrite(&bytes[0], 1, rowSize, output)!=size_t(rowSize)) /* couldn't write */
+        {
+            closeFile(output);
+            fprintf(stderr, "writeImage: could not write\n");
+            return -1;
+        }
+    }
+    
+    /* close the file */
+    if (closeFile(output)!=0) {
+        fprintf(stderr, "writeImage: could not write\n");
+        return -1;
+    }
+    return 0; /* OK */
+}
+
+/*
+ explicit instantiations for supported pixel types
+*/
+#define INSTANTIATE_PGM_FUNCTIONS(T) \
+  template int readPgmPixels(FILE *input, Image<T> *im, int levels, Histogram *histogram); \
+  template int readImage(Image<T> *im, const char *fname); \
+  template int readAsBinaryImage(Image<T> *im, const char *fname, const Threshold &threshold); \
+  template int readAndLabelBinaryImage(Image<T> *im, const char *fname); \
+  template int readAndLabelBinaryImage(Image<T> *im, FILE *input); \
+  template int readLabeledImage(Image<T> *im, const char *fname, Database &db); \
+  template int labelAndMeasureBinaryImage(const BinaryImage *binary, Image<T> *im, Database &db); \
+  template int readLabeledImage(Image<T> *im, FILE *input, Database &db); \
+  template int addPositionAndOrientation(Image<T> *im, Database &db, bool recognizedOnly); \
+  template int writeImage(const Image<T> *im, const char *fname); \
+  template int writeLabeledImage(const Image<T> *im, const char *fname);
+
+FOR_EACH_PIXEL_TYPE(INSTANTIATE_PGM_FUNCTIONS)
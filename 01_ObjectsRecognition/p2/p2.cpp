@@ -7,11 +7,17 @@
                   where:
                   <arg1> is an input binary image
                   <arg2> is an output labeled image
+ Batch usage    : ./p2 -batch <inputs> <arg2>
+                  runs the program on every image of <inputs> (see showUsage)
  Comments       : The background in the input image is black (0) and the objects are white
                   (255).
+                  Labels are saved with 8 or 16 bits per pixel (PGM), or 32 bits per pixel if
+                  there are more than 65535 objects (read back by p3 and p4).
  ******************************************************************************************/
 
+#include <cstring>
 #include "Image.h"
+#include "Batch.h"
 #include "DisjSets.h"
 #include <cstdio>
 #include <iomanip>
@@ -27,30 +33,82 @@ using namespace std;
  */
 void showUsage(string fileName);
 
+/**
+ * Runs the program on every image of a batch (see showUsage).
+ */
+int runBatch(int argc, char * argv[]);
+
 /******************************************************************************************
  * MAIN
  ******************************************************************************************/
 int main(int argc, char * argv[]) {
 
+    if (argc>1 && strcmp(argv[1], "-batch")==0) {
+        return runBatch(argc, argv);
+    }
+
     if (argc!=3) {
 		showUsage(argv[0]);
         //exit(1);
 		return 0;
 	}
-	Image *im;
-	im=new Image;
-	assert(im!=0);
-    if (readAndLabelBinaryImage(im, argv[1])!=0) {
-		printf("Can't open file %s\n", argv[1]);
+	Image<int32_t> im; /* labels */
+    if (readAndLabelBinaryImage(&im, argv[1])!=0) {
+		fprintf(stderr, "Can't open file %s\n", argv[1]);
 		return 0;
 	}
 
-	if (writeImage(im, argv[2])!=0) {
-		printf("Can't write to file %s\n", argv[2]);
+	if (writeLabeledImage(&im, argv[2])!=0) {
+		fprintf(stderr, "Can't write to file %s\n", argv[2]);
 		return 0;
 	}
 }
 
+/******************************************************************************************
+ * runBatch
+ ******************************************************************************************/
+int runBatch(int argc, char * argv[]) {
+    
+    if (argc!=4) {
+        showUsage(argv[0]);
+        return 0;
+    }
+    
+    BatchTimer timer;
+    BatchInputs inputs;
+    if (inputs.open(argv[2])) {
+        return 0;
+    }
+    
+    /* decode and label the next images while the current one is saved */
+    struct Frame {
+        Image<int32_t> im; /* labels */
+    };
+    BatchPrefetcher<Frame> frames(inputs, [&](Frame *frame, FILE *input, int k) {
+        return readAndLabelBinaryImage(&frame->im, input);
+    });
+    
+    Frame *frame;
+    int k, status;
+    while ((frame = frames.next(k, status)) != NULL) {
+        if (status) {
+            fprintf(stderr, "Can't load frame %d (%s)\n", k, inputs.getName(k).c_str());
+            timer.countFrame(false);
+            continue;
+        }
+        string outputName = makeBatchName(argv[3], inputs.getName(k), k);
+        if (writeLabeledImage(&frame->im, outputName.c_str())) {
+            fprintf(stderr, "Can't write to file %s\n", outputName.c_str());
+            timer.countFrame(false);
+            continue;
+        }
+        timer.countFrame(true);
+    }
+    timer.report();
+    
+    return 0;
+}
+
 /******************************************************************************************
  * showUsage
  ******************************************************************************************/
@@ -61,5 +119,11 @@ void showUsage(string fileName) {
          << "where:\n"
          << "\t<arg1> is an input binary image\n"
          << "\t<arg2> is an output labeled image\n"
-         << "example:\n\t" << fileName <<  " input.pgm output.pgm\n";
+         << "batch:\t" << fileName << " -batch <inputs> <arg2>\n"
+         << "\t<inputs> is a directory, a quoted glob pattern, a numbered sequence such as frame_%05d.pgm,\n"
+         << "\t@list (a file listing images), or an image file or - holding one or more images;\n"
+         << "\toutput names (and other per-frame image names) are patterns: %s is the input name\n"
+         << "\twithout directory and extension, %d (or %05d) the frame number\n"
+         << "example:\n\t" << fileName <<  " input.pgm output.pgm\n"
+         << "\t" << fileName << " -batch 'binary/*.pgm' labeled/%s_L.pgm\n";
 }
@@ -0,0 +1,254 @@
+/******************************************************************************************
+ Title          : Batch.cpp
+ Description    : Implementation file for Batch.h header file.
+ ******************************************************************************************/
+
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <dirent.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include "Batch.h"
+#include "Image.h"
+
+using namespace std;
+
+static bool hasImageExtension(const char *name)
+/*
+ returns true if name ends with .pgm or .pbm.
+ */
+{
+    size_t length = strlen(name);
+    return length >= 4 && (strcmp(name + length - 4, ".pgm")==0 || strcmp(name + length - 4, ".pbm")==0);
+}
+
+int addBatchInputs(const char *spec, vector<string> &names)
+/*
+ adds the names of the input images given by spec (image, directory, glob
+ pattern or @list) to names;
+
+ returns 0 if OK or -1 if spec gives no names.
+ */
+{
+    size_t count = names.size();
+    struct stat info;
+
+    if (!spec)
+        return -1;
+
+    if (spec[0]=='@') {
+        /* list of names, one per line */
+        FILE *list;
+        char line[4096];
+        if ((list=openFile(spec + 1, "r"))==0) {
+            fprintf(stderr, "addBatchInputs: Cannot open file %s\n", spec + 1);
+            return -1;
+        }
+        while (fgets(line, sizeof line, list) != 0) {
+            size_t length = strlen(line);
+            while (length > 0 && (line[length-1]=='\n' || line[length-1]=='\r' || line[length-1]==' '))
+                line[--length] = 0;
+            if (length > 0 && line[0]!='#')
+                names.push_back(line);
+        }
+        closeFile(list);
+    }
+    else if (stat(spec, &info)==0 && S_ISDIR(info.st_mode)) {
+        /* all images in a directory */
+        DIR *dir = opendir(spec);
+        if (!dir) {
+            fprintf(stderr, "addBatchInputs: Cannot open directory %s\n", spec);
+            return -1;
+        }
+        vector<string> found;
+        struct dirent *entry;
+        while ((entry=readdir(dir)) != 0) {
+            if (entry->d_name[0]!='.' && hasImageExtension(entry->d_name))
+                found.push_back(string(spec) + "/" + entry->d_name);
+        }
+        closedir(dir);
+        sort(found.begin(), found.end());
+        names.insert(names.end(), found.begin(), found.end());
+    }
+    else if (makeBatchName(spec, "", 0)!=makeBatchName(spec, "", 1)) {
+        /* numbered sequence, from frame 0 or 1 up to the first missing file */
+        int first = (stat(makeBatchName(spec, "", 0).c_str(), &info)==0) ? 0 : 1;
+        for (int k=first; k < INT_MAX; k++) {
+            string name = makeBatchName(spec, "", k);
+            if (stat(name.c_str(), &info)!=0)
+                break;
+            names.push_back(name);
+        }
+    }
+    else if (strpbrk(spec, "*?[")) {
+        /* glob pattern; glob sorts the names */
+        glob_t matches;
+        if (glob(spec, 0, NULL, &matches)==0) {
+            for (size_t i=0; i<matches.gl_pathc; i++)
+                names.push_back(matches.gl_pathv[i]);
+        }
+        globfree(&matches);
+    }
+    else
+        names.push_back(spec);
+
+    if (names.size()==count) {
+        fprintf(stderr, "addBatchInputs: No images in %s\n", spec);
+        return -1;
+    }
+    return 0; /* OK */
+}
+
+string makeBatchName(const char *pattern, const string &input, int index)
+/*
+ returns the name of the file of frame index made from pattern (%s, %d, %0Nd
+ and %%).
+ */
+{
+    /* name of the input image without directory and extension */
+    size_t slash = input.find_last_of('/');
+    string base = (slash==string::npos) ? input : input.substr(slash + 1);
+    size_t dot = base.find_last_of('.');
+    if (dot!=string::npos && dot > 0)
+        base.erase(dot);
+    if (base=="-")
+        base = "stdin";
+
+    string name;
+    for (const char *p = pattern; *p; p++) {
+        if (*p!='%') {
+            name += *p;
+            continue;
+        }
+
+        /* %%, %s, %d or %0Nd; anything else is copied */
+        const char *q = p + 1;
+        bool zeros = (*q=='0');
+        int width = 0;
+        while (*q>='0' && *q<='9' && width < 100)
+            width = width * 10 + (*q++ - '0');
+        if (*q=='%' && q==p+1)
+            name += '%';
+        else if (*q=='s' && q==p+1)
+            name += base;
+        else if (*q=='d') {
+            char number[128];
+            snprintf(number, sizeof number, zeros ? "%0*d" : "%*d", width, index);
+            name += number;
+        }
+        else {
+            name += *p;
+            continue;
+        }
+        p = q;
+    }
+    return name;
+}
+
+BatchInputs::~BatchInputs()
+/*
+ closes the stream.
+ */
+{
+    if (stream)
+        closeFile(stream);
+}
+
+int BatchInputs::open(const char *spec)
+/*
+ opens the frames given by spec, an image name or "-" as a stream;
+
+ returns 0 if OK or -1 if spec gives no frames.
+ */
+{
+    struct stat info;
+
+    if (stream) {
+        closeFile(stream);
+        stream=NULL;
+    }
+    names.clear();
+
+    /* lists, directories, sequences and glob patterns name one image per frame */
+    if (!spec || spec[0]=='@' || (stat(spec, &info)==0 && S_ISDIR(info.st_mode))
+        || makeBatchName(spec, "", 0)!=makeBatchName(spec, "", 1) || strpbrk(spec, "*?["))
+        return addBatchInputs(spec, names);
+
+    /* anything else is a stream of images */
+    if ((stream=openFile(spec, "rb"))==0) {
+        fprintf(stderr, "addBatchInputs: Cannot open file %s\n", spec);
+        return -1;
+    }
+    if (!hasNextImage(stream)) {
+        fprintf(stderr, "addBatchInputs: No images in %s\n", spec);
+        closeFile(stream);
+        stream=NULL;
+        return -1;
+    }
+    names.push_back(spec);
+    return 0; /* OK */
+}
+
+int BatchInputs::openFrame(int index, FILE *&input)
+/*
+ opens the image of frame index, or positions the stream at its next image;
+
+ returns 0 if OK, 1 if the stream has no more images or -1 if the file
+ cannot be opened.
+ */
+{
+    input=NULL;
+    if (stream) {
+        /* frames of the stream follow one another */
+        if (!hasNextImage(stream))
+            return 1;
+        input=stream;
+        return 0; /* OK */
+    }
+    if (index < 0 || index >= int(names.size()))
+        return 1;
+    if ((input=openFile(names[index].c_str(), "rb"))==0) {
+        fprintf(stderr, "readImage: Cannot open file %s\n", names[index].c_str());
+        return -1;
+    }
+    return 0; /* OK */
+}
+
+void BatchInputs::closeFrame(FILE *input)
+/*
+ closes the file opened by openFrame; the stream is left open.
+ */
+{
+    if (input && input!=stream)
+        closeFile(input);
+}
+
+int getBatchThreads()
+/*
+ returns the number of loader threads: one per core but one, which is left for
+ the thread processing the frames, and at most 8.
+ */
+{
+    int numThreads = int(thread::hardware_concurrency()) - 1;
+    if (numThreads < 1)
+        numThreads = 1;
+    if (numThreads > 8)
+        numThreads = 8;
+    return numThreads;
+}
+
+void BatchTimer::report() const
+/*
+ prints the number of frames, the time and the number of frames per second on
+ stderr.
+ */
+{
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    fprintf(stderr, "Processed %d frames in %.3f s (%.1f frames/s)", frames, seconds,
+            (seconds > 0) ? frames / seconds : 0.0);
+    if (failures > 0)
+        fprintf(stderr, ", %d failed", failures);
+    fprintf(stderr, "\n");
+}
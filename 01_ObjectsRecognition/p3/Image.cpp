@@ -17,40 +17,111 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <algorithm>
 #include "Image.h"
 
-Image::Image(){
+/* SSE2 and AVX2 row kernels are compiled for x86 CPUs with GCC or Clang and chosen at run time */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define IMAGE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+template <typename T>
+Image<T>::Image(){
     /* initialize image class */
     /* everything is zero...  */
     Ncols=0;
     Nrows=0;
     Ncolors=0;
+    stride=0;
     image=NULL;
 }
 
-Image::Image(const Image &im){
+template <typename T>
+Image<T>::Image(const Image &im){
     /* initialize image class */
+  Ncols=0;
+  Nrows=0;
+  stride=0;
+  image=NULL;
     /* Copy from im  */
-  setSize(im.getNRows(), im.getNCols());
   setColors(im.getColors());
-  int i,j;
-  for (i=0; i<getNRows(); ++i)
-    for (j=0; j<getNCols(); ++j){
-      setPixel(i,j, im.getPixel(i,j));
-    }
+  if (im.getData() && setSize(im.getNRows(), im.getNCols()) > 0)
+    memcpy(image, im.getData(), sizeof(T) * Nrows * stride);
 }
 
+/*
+ move constructor; takes over the pixel buffer of im,
+ im is left empty.
+*/
+template <typename T>
+Image<T>::Image(Image &&im){
+  Ncols=im.Ncols;
+  Nrows=im.Nrows;
+  Ncolors=im.Ncolors;
+  stride=im.stride;
+  image=im.image;
+  im.Ncols=0;
+  im.Nrows=0;
+  im.stride=0;
+  im.image=NULL;
+}
 
-Image::~Image(){
-    int i;
-    if (image) {
-	for (i=0; i<Nrows; i++)
-	    free( image[i] );
+/*
+ copy assignment; reuses the pixel buffer when the sizes match.
+*/
+template <typename T>
+Image<T> &
+Image<T>::operator=(const Image &im){
+  if (this == &im)
+    return *this;
+  setColors(im.getColors());
+  if (!im.getData()){
+    free(image);
+    Ncols=0;
+    Nrows=0;
+    stride=0;
+    image=NULL;
+    return *this;
+  }
+  if (setSize(im.getNRows(), im.getNCols()) > 0)
+    for (int i=0; i<Nrows; i++)
+      memcpy(row(i), im.row(i), sizeof(T) * Ncols);
+  return *this;
+}
+
+/*
+ move assignment; frees the current pixel buffer and takes
+ over the one of im, im is left empty.
+*/
+template <typename T>
+Image<T> &
+Image<T>::operator=(Image &&im){
+  if (this == &im)
+    return *this;
+  free(image);
+  Ncols=im.Ncols;
+  Nrows=im.Nrows;
+  Ncolors=im.Ncolors;
+  stride=im.stride;
+  image=im.image;
+  im.Ncols=0;
+  im.Nrows=0;
+  im.stride=0;
+  im.image=NULL;
+  return *this;
+}
+
+template <typename T>
+Image<T>::~Image(){
+    if (image)
 	free(image);
-    }
 }
 /*
- allocates space for an rows x columns image.
+ allocates space for an rows x columns image;
+ all rows are kept in a single block, one after another;
+ the current block is kept if it has the right size.
 
  returns : -2 if rows or columns <=0
            -1 if cannot allocate space
@@ -58,29 +129,29 @@ Image::~Image(){
 
 */
 
+template <typename T>
 int
-Image::setSize(int rows, int columns)
+Image<T>::setSize(int rows, int columns)
 {
-    int i;
     if (rows<=0 || columns <=0){
-	printf("setSize: rows, columns must be positive\n");
+	fprintf(stderr, "setSize: rows, columns must be positive\n");
 	return -2;
     }
 
-    if ( (image=(int **)malloc(sizeof (int *) * rows))==NULL ){
-	printf("setSize: can't allocate space\n");
+    if ( !image || rows * columns != Nrows * stride ){
+      free(image);
+      if ( (image=(T *)malloc(sizeof(T) * rows * columns))==NULL ){
+	fprintf(stderr, "setSize: can't allocate space\n");
+	Nrows=0;
+	Ncols=0;
+	stride=0;
 	return -1;
-     }
-
-    for (i=0; i<rows; i++) {
-	if ( (image[i]=(int *)malloc(sizeof(int) * columns))==NULL){
-	    printf("setSize: can't allocate space\n");
-	    return -1;
-	}
+      }
     }
 
     Nrows=rows;
     Ncols=columns;
+    stride=columns;
 
     return rows*columns;
 }
@@ -89,8 +160,9 @@ Image::setSize(int rows, int columns)
 /*
  Sets the number of gray - levels
 */
+template <typename T>
 int
-Image::setColors(int colors){
+Image<T>::setColors(int colors){
   Ncolors=colors;
   return Ncolors;
 }
@@ -99,40 +171,843 @@ Image::setColors(int colors){
  Returns pixel i,j
  If image is "empty" return -1.
 */
+template <typename T>
 int
-Image::getPixel(int i, int j)const{
+Image<T>::getPixel(int i, int j)const{
    if ( !image ) {
-       printf("getPixel: read pixel from an empty image\n");
+       fprintf(stderr, "getPixel: read pixel from an empty image\n");
        return -1;
      }
-  if (i<0 || i>Nrows || j<0 || j>Ncols){
+  if (i<0 || i>=Nrows || j<0 || j>=Ncols){
 //         error_msg("getPixel: out of image");
         return -1;
        }
        else
-          return image[i][j];
+          return int(image[i*stride + j]);
 }
 
 /*
  set pixel i, j
  return -1 if error.
 */
+template <typename T>
 int
- Image::setPixel(int i, int j, int color){
+ Image<T>::setPixel(int i, int j, int color){
   if ( !image ) {
-       printf("setPixel: write pixel to an empty image");
+       fprintf(stderr, "setPixel: write pixel to an empty image");
        return 0;
      }
 
- if ( i<0 || i>Nrows || j<0 || j>Ncols ){
+ if ( i<0 || i>=Nrows || j<0 || j>=Ncols ){
  //  error_msg("Image::setPixel -> Out of boundaries\n");
    return -1;
  }
- image[i][j]=color;
+ image[i*stride + j]=T(color);
  return color;
 }
 
+/*
+ sets the size of the binary image, all pixels are 0.
+
+ returns : -2 if rows or columns <=0
+            rows * columns if success
+*/
+int
+BinaryImage::setSize(int rows, int columns)
+{
+    if (rows<=0 || columns <=0){
+	fprintf(stderr, "setSize: rows, columns must be positive\n");
+	return -2;
+    }
+    Nrows=rows;
+    Ncols=columns;
+    wordsPerRow=(columns + 63) / 64;
+    words.assign(size_t(rows) * wordsPerRow, 0);
+    return rows*columns;
+}
+
+/*
+ clears padding bits at the end of every row
+*/
+void
+BinaryImage::clearPadding()
+{
+    if ((Ncols & 63) == 0)
+	return;
+    uint64_t mask = (uint64_t(1) << (Ncols & 63)) - 1;
+    for (int i=0; i<Nrows; i++)
+	row(i)[wordsPerRow - 1] &= mask;
+}
+
+/*
+ counts the pixels that are 1, a word at a time
+*/
+long
+BinaryImage::countPixels()const
+{
+    long n = 0;
+    for (size_t k=0; k<words.size(); k++)
+	n += countBits(words[k]);
+    return n;
+}
+
+/*
+ logical operations with another image of the same size, a word at a time
+
+ returns : -1 if other has another size
+            0 if success
+*/
+int
+BinaryImage::andWith(const BinaryImage &other)
+{
+    if (other.Nrows!=Nrows || other.Ncols!=Ncols)
+	return -1;
+    for (size_t k=0; k<words.size(); k++)
+	words[k] &= other.words[k];
+    return 0;
+}
+
+int
+BinaryImage::orWith(const BinaryImage &other)
+{
+    if (other.Nrows!=Nrows || other.Ncols!=Ncols)
+	return -1;
+    for (size_t k=0; k<words.size(); k++)
+	words[k] |= other.words[k];
+    return 0;
+}
+
+int
+BinaryImage::xorWith(const BinaryImage &other)
+{
+    if (other.Nrows!=Nrows || other.Ncols!=Ncols)
+	return -1;
+    for (size_t k=0; k<words.size(); k++)
+	words[k] ^= other.words[k];
+    return 0;
+}
+
+/*
+ inverts every pixel; the padding bits stay 0
+*/
+void
+BinaryImage::invert()
+{
+    for (size_t k=0; k<words.size(); k++)
+	words[k] = ~words[k];
+    clearPadding();
+}
+
+/*
+ moves every pixel n columns to the right (n > 0: towards the high bits
+ and the next words) or to the left (n < 0)
+*/
+void
+BinaryImage::shiftColumns(int n)
+{
+    if (n==0)
+	return;
+    int shift = (n > 0) ? n : -n;
+    int wordShift = shift >> 6, bitShift = shift & 63;
+    for (int i=0; i<Nrows; i++) {
+	uint64_t *w = row(i);
+	if (n > 0) {
+	    for (int k=wordsPerRow-1; k>=0; k--) {
+		int from = k - wordShift;
+		uint64_t word = 0;
+		if (from >= 0) {
+		    word = w[from] << bitShift;
+		    if (bitShift && from > 0)
+			word |= w[from-1] >> (64 - bitShift);
+		}
+		w[k] = word;
+	    }
+	}
+	else {
+	    for (int k=0; k<wordsPerRow; k++) {
+		int from = k + wordShift;
+		uint64_t word = 0;
+		if (from < wordsPerRow) {
+		    word = w[from] >> bitShift;
+		    if (bitShift && from + 1 < wordsPerRow)
+			word |= w[from+1] << (64 - bitShift);
+		}
+		w[k] = word;
+	    }
+	}
+    }
+    clearPadding();
+}
+
+/*
+ moves every row n rows down (n > 0) or up (n < 0)
+*/
+void
+BinaryImage::shiftRows(int n)
+{
+    if (n >= Nrows || -n >= Nrows) {
+	std::fill(words.begin(), words.end(), uint64_t(0));
+	return;
+    }
+    size_t rowWords = size_t(wordsPerRow), moved = size_t(Nrows - (n > 0 ? n : -n)) * rowWords;
+    if (n > 0) {
+	memmove(&words[n * rowWords], &words[0], moved * sizeof(uint64_t));
+	std::fill(words.begin(), words.begin() + n * rowWords, uint64_t(0));
+    }
+    else if (n < 0) {
+	memmove(&words[0], &words[-n * rowWords], moved * sizeof(uint64_t));
+	std::fill(words.begin() + moved, words.end(), uint64_t(0));
+    }
+}
+
+/*
+ returns the first column at or after j whose bit in words differs from
+ flip (0 to find a 1, ~0 to find a 0), or 64 * wordsPerRow if there is none
+*/
+static inline int
+nextColumn(const uint64_t *words, int wordsPerRow, int j, uint64_t flip)
+{
+    int k = j >> 6;
+    if (k >= wordsPerRow)
+	return wordsPerRow << 6;
+    uint64_t bits = (words[k] ^ flip) & (~uint64_t(0) << (j & 63));
+    while (bits == 0) {
+	if (++k == wordsPerRow)
+	    return wordsPerRow << 6;
+	bits = words[k] ^ flip;
+    }
+    return (k << 6) + countTrailingZeros(bits);
+}
+
+/*
+ sets the runs to those of binary image im
+
+ returns : the number of runs
+*/
+int
+RunLengthImage::encode(const BinaryImage &im)
+{
+    Nrows = im.getNRows();
+    Ncols = im.getNCols();
+    runs.clear();
+    firstRun.assign(Nrows + 1, 0);
+    for (int i=0; i<Nrows; i++) {
+	encodeRow(im.row(i), Ncols, runs);
+	firstRun[i+1] = int(runs.size());
+    }
+    return int(runs.size());
+}
+
+/*
+ appends the runs of a row of columns pixels packed like a row of
+ BinaryImage to rowRuns
+
+ returns : the number of runs appended
+*/
+int
+RunLengthImage::encodeRow(const uint64_t *words, int columns, std::vector<Run> &rowRuns)
+{
+    int wordsPerRow = (columns + 63) / 64;
+    size_t numOfRuns = rowRuns.size();
+    /* padding bits are 0, so every run ends by columns */
+    for (int j = nextColumn(words, wordsPerRow, 0, 0); j < columns; ) {
+	Run run;
+	run.start = j;
+	j = nextColumn(words, wordsPerRow, j, ~uint64_t(0));
+	run.end = j - 1;
+	rowRuns.push_back(run);
+	j = nextColumn(words, wordsPerRow, j, 0);
+    }
+    return int(rowRuns.size() - numOfRuns);
+}
+
+/*
+ sets binary image im to the pixels of the runs
+
+ returns : -1 if the image is empty
+            0 if success
+*/
+int
+RunLengthImage::decode(BinaryImage *im)const
+{
+    if (im->setSize(Nrows, Ncols) < 0)
+	return -1;
+    for (int i=0; i<Nrows; i++) {
+	uint64_t *w = im->row(i);
+	for (int r=firstRun[i]; r<firstRun[i+1]; r++) {
+	    int first = runs[r].start >> 6, last = runs[r].end >> 6;
+	    uint64_t startMask = ~uint64_t(0) << (runs[r].start & 63);
+	    uint64_t endMask = ~uint64_t(0) >> (63 - (runs[r].end & 63));
+	    if (first == last) {
+		w[first] |= startMask & endMask;
+		continue;
+	    }
+	    w[first] |= startMask;
+	    for (int k=first+1; k<last; k++)
+		w[k] = ~uint64_t(0);
+	    w[last] |= endMask;
+	}
+    }
+    return 0;
+}
+
+/*
+ counts the pixels that are 1, a run at a time
+*/
+long
+RunLengthImage::countPixels()const
+{
+    long n = 0;
+    for (size_t r=0; r<runs.size(); r++)
+	n += runs[r].end - runs[r].start + 1;
+    return n;
+}
+
+/*
+ starts a new stream of rows of columns pixels
+
+ returns : -1 if columns <= 0
+            0 if success
+*/
+int
+StreamingLabeler::start(int columns, Callback finished)
+{
+    if (columns<=0){
+	fprintf(stderr, "start: columns must be positive\n");
+	return -1;
+    }
+    Ncols = columns;
+    rowIndex = 0;
+    callback = finished;
+    above.clear();
+    current.clear();
+    objects.clear();
+    firstRow.clear();
+    lastRow.clear();
+    parent.clear();
+    freeSlots.clear();
+    merged.clear();
+    numOfLiveObjects = 0;
+    numOfFinishedObjects = 0;
+    return 0;
+}
+
+/*
+ returns the slot of a new object whose first row is the current one
+*/
+int
+StreamingLabeler::newObject()
+{
+    int slot;
+    if (!freeSlots.empty()) {
+	slot = freeSlots.back();
+	freeSlots.pop_back();
+    }
+    else {
+	slot = int(objects.size());
+	objects.push_back(Database::emptyRecord());
+	firstRow.push_back(0);
+	lastRow.push_back(0);
+	parent.push_back(0);
+    }
+    objects[slot] = Database::emptyRecord();
+    firstRow[slot] = rowIndex;
+    lastRow[slot] = rowIndex;
+    parent[slot] = slot;
+    numOfLiveObjects++;
+    return slot;
+}
+
+/*
+ returns the slot of the live object that the object of slot has been
+ merged into; objects are merged only during a row, so the paths are
+ short, they are halved anyway
+*/
+int
+StreamingLabeler::findObject(int slot)
+{
+    while (parent[slot]!=slot) {
+	parent[slot] = parent[parent[slot]];
+	slot = parent[slot];
+    }
+    return slot;
+}
+
+/*
+ merges two live objects into the one that started first
+
+ returns : the slot of the merged object
+*/
+int
+StreamingLabeler::mergeObjects(int slot1, int slot2)
+{
+    if (firstRow[slot2] < firstRow[slot1])
+	std::swap(slot1, slot2);
+    /* the sums of i of both objects are taken from their first rows; those
+       of slot2 are moved to the first row of slot1: i - first1 = (i - first2) + d */
+    Database::Record &r = objects[slot1];
+    const Database::Record &other = objects[slot2];
+    long long int d = firstRow[slot2] - firstRow[slot1];
+    r.areaSum += other.areaSum;
+    r.iSum += other.iSum + d * other.areaSum;
+    r.jSum += other.jSum;
+    r.ijSum += other.ijSum + d * other.jSum;
+    r.iSquaredSum += other.iSquaredSum + 2 * d * other.iSum + d * d * other.areaSum;
+    r.jSquaredSum += other.jSquaredSum;
+    lastRow[slot1] = std::max(lastRow[slot1], lastRow[slot2]);
+    /* runs of both rows may still point at slot2; it is freed at the end of the row */
+    parent[slot2] = slot1;
+    merged.push_back(slot2);
+    numOfLiveObjects--;
+    return slot1;
+}
+
+/*
+ calculates the properties of a live object, passes it to the callback and
+ frees its slot
+*/
+void
+StreamingLabeler::finishObject(int slot)
+{
+    Database::Record r = objects[slot];
+    Database::calculateProperties(r);
+    r.rowCenter += firstRow[slot];
+    lastRow[slot] = -1; /* finished: not finished again by another run of the row above */
+    freeSlots.push_back(slot);
+    numOfLiveObjects--;
+    numOfFinishedObjects++;
+    if (callback)
+	callback(r);
+}
+
+/*
+ labels the next row, given as its runs; a run joins the objects of the
+ runs above that hold the N or NW neighbour of one of its pixels, like in
+ labelRuns, and adds its pixels to their sums
+
+ returns : the number of objects finished by this row
+*/
+int
+StreamingLabeler::addRow(const RunLengthImage::Run *runs, int numOfRuns)
+{
+    int numOfFinished = 0;
+    size_t a = 0;
+    size_t k;
+
+    current.clear();
+    for (int r=0; r<numOfRuns; r++) {
+	while (a < above.size() && above[a].end < runs[r].start - 1)
+	    a++;
+	int object = -1;
+	for (k=a; k<above.size() && above[k].start <= runs[r].end; k++) {
+	    int other = findObject(above[k].object);
+	    if (object<0)
+		object = other;
+	    else if (other!=object)
+		object = mergeObjects(object, other);
+	}
+	if (object<0)
+	    object = newObject();
+	Database::updateSums(objects[object], rowIndex - firstRow[object], runs[r].start, runs[r].end);
+	lastRow[object] = rowIndex;
+	LabeledRun run = {runs[r].start, runs[r].end, object};
+	current.push_back(run);
+    }
+
+    /* objects of the row above without a pixel in this row can't grow any more */
+    for (k=0; k<above.size(); k++) {
+	int object = findObject(above[k].object);
+	if (lastRow[object]>=0 && lastRow[object]<rowIndex) {
+	    finishObject(object);
+	    numOfFinished++;
+	}
+    }
+
+    /* point the runs of this row at live objects; then nothing points at the
+       merged slots */
+    for (k=0; k<current.size(); k++)
+	current[k].object = findObject(current[k].object);
+    for (k=0; k<merged.size(); k++) {
+	parent[merged[k]] = merged[k];
+	freeSlots.push_back(merged[k]);
+    }
+    merged.clear();
+
+    above.swap(current);
+    rowIndex++;
+    return numOfFinished;
+}
+
+/*
+ labels the next row, packed like a row of BinaryImage
+
+ returns : the number of objects finished by this row
+*/
+int
+StreamingLabeler::addRow(const uint64_t *words)
+{
+    rowRuns.clear();
+    RunLengthImage::encodeRow(words, Ncols, rowRuns);
+    return addRow(rowRuns.data(), int(rowRuns.size()));
+}
+
+/*
+ ends the stream: the objects of the last row are finished too
+
+ returns : the number of objects finished
+*/
+int
+StreamingLabeler::finish()
+{
+    int numOfFinished = 0;
+    for (size_t k=0; k<above.size(); k++) {
+	int object = findObject(above[k].object);
+	if (lastRow[object]>=0) {
+	    finishObject(object);
+	    numOfFinished++;
+	}
+    }
+    above.clear();
+    return numOfFinished;
+}
+
+/*
+ sets the bins of the histogram for an image with levels gray levels,
+ all counts are 0.
+*/
+void
+Histogram::reset(int levels)
+{
+    Nbins = (levels > 255) ? 65536 : 256;
+    partial.assign(size_t(4) * Nbins, 0);
+    counts.assign(Nbins, 0);
+    summed = true;
+}
+
+/*
+ counts a row of bytes; bytes are always inside the bins, so they are
+ counted without clamping, 4 at a time.
+*/
+void
+Histogram::addRow(const uint8_t *pixels, int nCols)
+{
+    uint32_t *bins0 = &partial[0], *bins1 = bins0 + Nbins, *bins2 = bins1 + Nbins, *bins3 = bins2 + Nbins;
+    int j = 0;
+    for (; j+4<=nCols; j+=4) {
+	bins0[pixels[j]]++;
+	bins1[pixels[j+1]]++;
+	bins2[pixels[j+2]]++;
+	bins3[pixels[j+3]]++;
+    }
+    for (; j<nCols; j++)
+	bins0[pixels[j]]++;
+    summed = false;
+}
+
+/*
+ returns the counts, adding up the partial histograms if needed.
+*/
+const std::vector<uint64_t> &
+Histogram::getCounts()
+{
+    if (!summed) {
+	for (int v=0; v<Nbins; v++)
+	    counts[v] = uint64_t(partial[v]) + partial[Nbins + v] + partial[2*Nbins + v] + partial[3*Nbins + v];
+	summed = true;
+    }
+    return counts;
+}
+
+/*
+ Otsu's threshold: maximizes the between-class variance of pixels <= v
+ and pixels > v (up to the factor 1/total^2).
+*/
+int
+Histogram::getOtsuThreshold()
+{
+    const std::vector<uint64_t> &h = getCounts();
+    double total = 0, sum = 0;
+    int v;
+    for (v=0; v<Nbins; v++) {
+	total += double(h[v]);
+	sum += double(v) * double(h[v]);
+    }
 
+    double below = 0, sumBelow = 0, best = -1;
+    int threshold = 0;
+    for (v=0; v+1<Nbins; v++) {
+	below += double(h[v]);
+	sumBelow += double(v) * double(h[v]);
+	double above = total - below;
+	if (below==0)
+	    continue;
+	if (above==0)
+	    break;
+	double difference = sumBelow / below - (sum - sumBelow) / above;
+	double variance = below * above * difference * difference;
+	if (variance > best) {
+	    best = variance;
+	    threshold = v;
+	}
+    }
+    return threshold;
+}
 
+/*
+ returns the lowest v such that percent % of the pixels are <= v.
+*/
+int
+Histogram::getPercentileThreshold(double percent)
+{
+    const std::vector<uint64_t> &h = getCounts();
+    uint64_t total = 0;
+    for (int v=0; v<Nbins; v++)
+	total += h[v];
+    double wanted = double(total) * percent / 100;
+    uint64_t below = 0;
+    for (int v=0; v<Nbins; v++) {
+	below += h[v];
+	if (double(below) >= wanted)
+	    return v;
+    }
+    return Nbins - 1;
+}
 
+/*
+ parses a threshold: a gray level, "auto" or "auto:P".
+
+ returns : 0 if OK
+           -1 if arg is none of these
+*/
+int
+Threshold::parse(const char *arg)
+{
+    char *end;
+    if (strcmp(arg, "auto")==0) {
+	mode = OTSU;
+	return 0;
+    }
+    if (strncmp(arg, "auto:", 5)==0) {
+	double p = strtod(arg + 5, &end);
+	if (end==arg + 5 || *end!='\0' || !(p >= 0 && p <= 100))
+	    return -1;
+	mode = PERCENTILE;
+	percent = p;
+	return 0;
+    }
+    long value = strtol(arg, &end, 10);
+    if (end==arg || *end!='\0')
+	return -1;
+    mode = FIXED;
+    level = int(value);
+    return 0;
+}
+
+/*
+ returns the fixed threshold, or chooses it from the histogram.
+*/
+int
+Threshold::choose(Histogram &histogram)const
+{
+    if (mode==FIXED)
+	return level;
+    int threshold;
+    if (mode==OTSU) {
+	threshold = histogram.getOtsuThreshold();
+	fprintf(stderr, "Threshold: %d (Otsu)\n", threshold);
+    }
+    else {
+	threshold = histogram.getPercentileThreshold(percent);
+	fprintf(stderr, "Threshold: %d (%g%% of the pixels at or below)\n", threshold, percent);
+    }
+    return threshold;
+}
+
+/*
+ instruction sets of the row kernels
+*/
+enum RowKernelLevel {ROW_KERNELS_SCALAR, ROW_KERNELS_SSE2, ROW_KERNELS_AVX2};
+
+/*
+ returns the best instruction set of the CPU; checked on the first call.
+*/
+static RowKernelLevel
+getRowKernelLevel()
+{
+#ifdef IMAGE_X86_KERNELS
+    static const RowKernelLevel level = (__builtin_cpu_init(), __builtin_cpu_supports("avx2")) ? ROW_KERNELS_AVX2
+                                      : __builtin_cpu_supports("sse2") ? ROW_KERNELS_SSE2 : ROW_KERNELS_SCALAR;
+    return level;
+#else
+    return ROW_KERNELS_SCALAR;
+#endif
+}
+
+const char *
+getRowKernelInstructionSet()
+{
+    switch (getRowKernelLevel()) {
+	case ROW_KERNELS_AVX2: return "avx2";
+	case ROW_KERNELS_SSE2: return "sse2";
+	default: return "scalar";
+    }
+}
+
+#ifdef IMAGE_X86_KERNELS
+
+/*
+ the kernels below process 16 (SSE2) or 32 (AVX2) bytes of a row at a
+ time and return the number of pixels done; the scalar loops of the
+ templates in Image.h finish the row. 8-bit pixels are compared with an
+ unsigned minimum: x <= t exactly when min(x, t) == x.
+*/
+
+__attribute__((target("sse2")))
+static int
+binarizeRowSse2(uint8_t *pixels, int nCols, int threshold)
+{
+    const __m128i t = _mm_set1_epi8(char(threshold)), one = _mm_set1_epi8(1);
+    int j = 0;
+    for (; j+16<=nCols; j+=16) {
+	__m128i x = _mm_loadu_si128((const __m128i *)(pixels + j));
+	__m128i low = _mm_cmpeq_epi8(_mm_min_epu8(x, t), x);
+	_mm_storeu_si128((__m128i *)(pixels + j), _mm_andnot_si128(low, one));
+    }
+    return j;
+}
+
+__attribute__((target("avx2")))
+static int
+binarizeRowAvx2(uint8_t *pixels, int nCols, int threshold)
+{
+    const __m256i t = _mm256_set1_epi8(char(threshold)), one = _mm256_set1_epi8(1);
+    int j = 0;
+    for (; j+32<=nCols; j+=32) {
+	__m256i x = _mm256_loadu_si256((const __m256i *)(pixels + j));
+	__m256i low = _mm256_cmpeq_epi8(_mm256_min_epu8(x, t), x);
+	_mm256_storeu_si256((__m256i *)(pixels + j), _mm256_andnot_si256(low, one));
+    }
+    return j;
+}
+
+__attribute__((target("sse2")))
+static int
+binarizeRowSse2(int32_t *pixels, int nCols, int threshold)
+{
+    const __m128i t = _mm_set1_epi32(threshold), one = _mm_set1_epi32(1);
+    int j = 0;
+    for (; j+4<=nCols; j+=4) {
+	__m128i x = _mm_loadu_si128((const __m128i *)(pixels + j));
+	_mm_storeu_si128((__m128i *)(pixels + j), _mm_and_si128(_mm_cmpgt_epi32(x, t), one));
+    }
+    return j;
+}
+
+__attribute__((target("avx2")))
+static int
+binarizeRowAvx2(int32_t *pixels, int nCols, int threshold)
+{
+    const __m256i t = _mm256_set1_epi32(threshold), one = _mm256_set1_epi32(1);
+    int j = 0;
+    for (; j+8<=nCols; j+=8) {
+	__m256i x = _mm256_loadu_si256((const __m256i *)(pixels + j));
+	_mm256_storeu_si256((__m256i *)(pixels + j), _mm256_and_si256(_mm256_cmpgt_epi32(x, t), one));
+    }
+    return j;
+}
+
+__attribute__((target("sse2")))
+static int
+packBinaryRowSse2(const uint8_t *pixels, int nCols, int threshold, uint64_t *words)
+{
+    const __m128i t = _mm_set1_epi8(char(threshold));
+    int j = 0;
+    for (; j+64<=nCols; j+=64) {
+	/* movemask puts pixel k of 16 in bit k, the order of the bits of the words */
+	uint64_t word = 0;
+	for (int k=0; k<64; k+=16) {
+	    __m128i x = _mm_loadu_si128((const __m128i *)(pixels + j + k));
+	    uint64_t low = uint64_t(unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(x, t), x))));
+	    word |= (~low & 0xFFFF) << k;
+	}
+	words[j >> 6] = word;
+    }
+    return j;
+}
+
+__attribute__((target("avx2")))
+static int
+packBinaryRowAvx2(const uint8_t *pixels, int nCols, int threshold, uint64_t *words)
+{
+    const __m256i t = _mm256_set1_epi8(char(threshold));
+    int j = 0;
+    for (; j+64<=nCols; j+=64) {
+	__m256i x0 = _mm256_loadu_si256((const __m256i *)(pixels + j));
+	__m256i x1 = _mm256_loadu_si256((const __m256i *)(pixels + j + 32));
+	uint64_t low0 = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(x0, t), x0)));
+	uint64_t low1 = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(x1, t), x1)));
+	words[j >> 6] = ~(low0 | (low1 << 32));
+    }
+    return j;
+}
+
+#endif
+
+/*
+ binarizes a row of 8-bit pixels; thresholds outside 0..254 leave no
+ pixel or every pixel, which the scalar loop handles.
+*/
+void
+binarizeRow(uint8_t *pixels, int nCols, int threshold)
+{
+    int j = 0;
+#ifdef IMAGE_X86_KERNELS
+    if (threshold >= 0 && threshold < 255) {
+	RowKernelLevel level = getRowKernelLevel();
+	j = (level==ROW_KERNELS_AVX2) ? binarizeRowAvx2(pixels, nCols, threshold)
+	  : (level==ROW_KERNELS_SSE2) ? binarizeRowSse2(pixels, nCols, threshold) : 0;
+    }
+#endif
+    binarizeRow<uint8_t>(pixels + j, nCols - j, threshold);
+}
+
+/*
+ binarizes a row of 32-bit pixels.
+*/
+void
+binarizeRow(int32_t *pixels, int nCols, int threshold)
+{
+    int j = 0;
+#ifdef IMAGE_X86_KERNELS
+    RowKernelLevel level = getRowKernelLevel();
+    j = (level==ROW_KERNELS_AVX2) ? binarizeRowAvx2(pixels, nCols, threshold)
+      : (level==ROW_KERNELS_SSE2) ? binarizeRowSse2(pixels, nCols, threshold) : 0;
+#endif
+    binarizeRow<int32_t>(pixels + j, nCols - j, threshold);
+}
+
+/*
+ packs a row of 8-bit pixels; the kernels do a multiple of 64 pixels, so
+ the rest of the row starts at a word.
+*/
+void
+packBinaryRow(const uint8_t *pixels, int nCols, int threshold, uint64_t *words)
+{
+    int j = 0;
+#ifdef IMAGE_X86_KERNELS
+    if (threshold >= 0 && threshold < 255) {
+	RowKernelLevel level = getRowKernelLevel();
+	j = (level==ROW_KERNELS_AVX2) ? packBinaryRowAvx2(pixels, nCols, threshold, words)
+	  : (level==ROW_KERNELS_SSE2) ? packBinaryRowSse2(pixels, nCols, threshold, words) : 0;
+    }
+#endif
+    packBinaryRow<uint8_t>(pixels + j, nCols - j, threshold, words + (j >> 6));
+}
+
+/*
+ explicit instantiations for supported pixel types
+*/
+#define INSTANTIATE_IMAGE(T) \
+  template class Image<T>;
 
+FOR_EACH_PIXEL_TYPE(INSTANTIATE_IMAGE)
@@ -7,11 +7,15 @@
                   orientations of objects in the output image.
  Usage          : ./p3 <arg1> <arg2> <arg3>
                   where:
-                  <arg1> is an input labeled image
+                  <arg1> is an input labeled image, or a binary image to label
                   <arg2> is an output database
                   <arg3> is an output image
+ Batch usage    : ./p3 -batch <inputs> <arg2> <arg3>
+                  runs the program on every image of <inputs> (see showUsage)
  Comments       : The background in the input image is black (0) and the objects are labeled
                   with consecutive natural numbers as labels (1, 2, ...). 
+                  A binary image (PBM, or PGM with 1 color) is labeled like p2 does it, while
+                  its objects are measured, so p2 and its labeled image can be skipped.
                   The generated object database includes a line for each of the objects with 
                   the following values: object label, row position of the center, column 
                   position of the center, the minimum moment of inertia, and the orientation 
@@ -22,7 +26,9 @@
                   from the dot for the orientation.
  ******************************************************************************************/
 
+#include <cstring>
 #include "Image.h"
+#include "Batch.h"
 #include "Database.h"
 #include <cstdio>
 #include <iomanip>
@@ -39,22 +45,29 @@ using namespace std;
  */
 void showUsage(string fileName);
 
+/**
+ * Runs the program on every image of a batch (see showUsage).
+ */
+int runBatch(int argc, char * argv[]);
+
 /******************************************************************************************
  * MAIN
  ******************************************************************************************/
 int main(int argc, char * argv[]) {
 
+    if (argc>1 && strcmp(argv[1], "-batch")==0) {
+        return runBatch(argc, argv);
+    }
+
     if (argc!=4) {
 		showUsage(argv[0]);
 		return 0;
 	}
-	Image *im;
-	im=new Image;
-	assert(im!=0);
+	Image<int32_t> im; /* labels */
     Database db;
     
-    if (readLabeledImage(im, argv[1], db)) {
-		printf("Can't open file %s\n", argv[1]);
+    if (readLabeledImage(&im, argv[1], db)) {
+		fprintf(stderr, "Can't open file %s\n", argv[1]);
 		return 0;
 	}
     
@@ -62,18 +75,75 @@ int main(int argc, char * argv[]) {
     //db.printRecords( );
     
     if (db.saveInTxtFile(argv[2])) {
-        printf("Can't write to file %s\n", argv[2]);
+        fprintf(stderr, "Can't write to file %s\n", argv[2]);
         return 0;
     }
     
-    addPositionAndOrientation(im, db, false);
+    addPositionAndOrientation(&im, db, false);
 
-	if (writeImage(im, argv[3])) {
-		printf("Can't write to file %s\n", argv[3]);
+	if (writeImage(&im, argv[3])) {
+		fprintf(stderr, "Can't write to file %s\n", argv[3]);
 		return 0;
 	}
 }
 
+/******************************************************************************************
+ * runBatch
+ ******************************************************************************************/
+int runBatch(int argc, char * argv[]) {
+    
+    if (argc!=5) {
+        showUsage(argv[0]);
+        return 0;
+    }
+    
+    BatchTimer timer;
+    BatchInputs inputs;
+    if (inputs.open(argv[2])) {
+        return 0;
+    }
+    
+    /* decode the next labeled images while the objects of the current one are measured */
+    struct Frame {
+        Image<int32_t> im; /* labels */
+        Database db;
+    };
+    BatchPrefetcher<Frame> frames(inputs, [&](Frame *frame, FILE *input, int k) {
+        frame->db.clear();
+        return readLabeledImage(&frame->im, input, frame->db);
+    });
+    
+    Frame *frame;
+    int k, status;
+    while ((frame = frames.next(k, status)) != NULL) {
+        if (status) {
+            fprintf(stderr, "Can't load frame %d (%s)\n", k, inputs.getName(k).c_str());
+            timer.countFrame(false);
+            continue;
+        }
+        string dbName = makeBatchName(argv[3], inputs.getName(k), k);
+        string outputName = makeBatchName(argv[4], inputs.getName(k), k);
+        
+        frame->db.calculateProperties( );
+        if (frame->db.saveInTxtFile(dbName.c_str())) {
+            fprintf(stderr, "Can't write to file %s\n", dbName.c_str());
+            timer.countFrame(false);
+            continue;
+        }
+        
+        addPositionAndOrientation(&frame->im, frame->db, false);
+        if (writeImage(&frame->im, outputName.c_str())) {
+            fprintf(stderr, "Can't write to file %s\n", outputName.c_str());
+            timer.countFrame(false);
+            continue;
+        }
+        timer.countFrame(true);
+    }
+    timer.report();
+    
+    return 0;
+}
+
 /******************************************************************************************
  * showUsage
  ******************************************************************************************/
@@ -82,9 +152,15 @@ void showUsage(string fileName) {
          << "Usage:\t" << fileName << " <arg1> <arg2> <arg3>\n"
          << "********************************************************************************\n"
          << "where:\n"
-         << "\t<arg1> is an input labeled image\n"
+         << "\t<arg1> is an input labeled image, or a binary image to label\n"
          << "\t<arg2> is an output database\n"
          << "\t<arg3> is an output image\n"
-         << "example:\n\t" << fileName <<  " input.pgm database.txt output.pgm\n";
+         << "batch:\t" << fileName << " -batch <inputs> <arg2> <arg3>\n"
+         << "\t<inputs> is a directory, a quoted glob pattern, a numbered sequence such as frame_%05d.pgm,\n"
+         << "\t@list (a file listing images), or an image file or - holding one or more images;\n"
+         << "\toutput names (and other per-frame image names) are patterns: %s is the input name\n"
+         << "\twithout directory and extension, %d (or %05d) the frame number\n"
+         << "example:\n\t" << fileName <<  " input.pgm database.txt output.pgm\n"
+         << "\t" << fileName << " -batch 'labeled/*.pgm' databases/%s.txt objects/%s.pgm\n";
 }
 
@@ -17,16 +17,19 @@ class DisjSets
   public:
     DisjSets( );
 
-    int find( int x ) const;
+    int find( int x );
     void unionSets( int root1, int root2 );
     void addElement( );
+    void append( const DisjSets &other );
     void printSet( ) const;
     int getNumberOfLabels( ) const;
     int getNumberOfLevels( ) const;
-    vector<int> getLevels( ) const;
+    vector<int> getLevels( );
+    int flatten( vector<int> &finalLabels );
+    int flatten( vector<int> &finalLabels, const vector<int> &order );
 
   private:
-    vector<int> s;
+    vector<int> s; /* parent of every element, or -(rank+1) for roots */
 };
 
 #endif
@@ -16,7 +16,8 @@ enum /* scan direction */
 };
 
 
-int line(Image *&im, int x0, int y0, int x1, int y1, int color)
+template <typename T>
+int line(Image<T> *&im, int x0, int y0, int x1, int y1, int color)
 /*  
   draws a line of given gray-level color from (x0,y0) to (x1,y1);
   im is the pointer to the user defined image structure - 
@@ -199,6 +200,10 @@ int line(Image *&im, int x0, int y0, int x1, int y1, int color)
   return 0; /* no error */
 }
 
+/*
+ explicit instantiations for supported pixel types
+*/
+#define INSTANTIATE_LINE(T) \
+  template int line(Image<T> *&im, int x0, int y0, int x1, int y1, int color);
 
-
-
+FOR_EACH_PIXEL_TYPE(INSTANTIATE_LINE)
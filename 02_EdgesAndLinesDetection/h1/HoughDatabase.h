@@ -29,11 +29,12 @@ class HoughDatabase {
     };
     
     void initializeRecords(int numberOfRecords);
+    void clear();
     void updateSums(int recordLabel, int i, int j, int v);
     void calculateRhoTheta(int rhoShift);
     void printRecords() const;
     void optimize();
-    vector<Record> getRecords() const;
+    const vector<Record> &getRecords() const;
 
   private:
     
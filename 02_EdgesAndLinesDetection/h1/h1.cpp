@@ -7,6 +7,8 @@
                   where:
                   <arg1> is an input gray-level image
                   <arg2> is an output gray-level edge image
+ Batch usage    : ./h1 -batch <inputs> <arg2>
+                  runs the program on every image of <inputs> (see showUsage)
  Comments       : Input image is filtered with 5x5 Gaussian filter and then Sobel operator
                   is used to produce an "edge" image where the intensity at each point is 
                   proportional to edge magnitude.
@@ -17,7 +19,9 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <cstring>
 #include "Image.h"
+#include "Batch.h"
 
 using namespace std;
 
@@ -26,38 +30,92 @@ using namespace std;
  */
 void showUsage(string fileName);
 
+/**
+ * Runs the program on every image of a batch (see showUsage).
+ */
+int runBatch(int argc, char * argv[]);
+
 /******************************************************************************************
  * MAIN
  ******************************************************************************************/
 int main(int argc, char * argv[]) {
+
+    if (argc>1 && strcmp(argv[1], "-batch")==0) {
+        return runBatch(argc, argv);
+    }
     
     if (argc!=3) {
         showUsage(argv[0]);
         return 0;
     }
     
-    Image *input, *output;
-    input = new Image;
-    assert(input != 0);
-    output = new Image;
-    assert(output != 0);
+    Image<uint8_t> input;
+    Image<uint16_t> output; /* Sobel magnitudes exceed 255 before scaling */
     
-    if (readImage(input, argv[1])) {
-        printf("Can't open file %s\n", argv[1]);
+    if (readImage(&input, argv[1])) {
+        fprintf(stderr, "Can't open file %s\n", argv[1]);
         return 0;
     }
     
-    apply5x5GaussianFilter(input);
-    applySobelOperator(input, output);
+    apply5x5GaussianFilter(&input);
+    applySobelOperator(&input, &output);
     
-    if (writeImage(output, argv[2])) {
-        printf("Can't write to file %s\n", argv[3]);
+    if (writeImage(&output, argv[2])) {
+        fprintf(stderr, "Can't write to file %s\n", argv[2]);
         return 0;
     }
     
     return 0;
 }
 
+/******************************************************************************************
+ * runBatch
+ ******************************************************************************************/
+int runBatch(int argc, char * argv[]) {
+    
+    if (argc!=4) {
+        showUsage(argv[0]);
+        return 0;
+    }
+    
+    BatchTimer timer;
+    BatchInputs inputs;
+    if (inputs.open(argv[2])) {
+        return 0;
+    }
+    
+    /* decode the next images while the current one is filtered */
+    struct Frame {
+        Image<uint8_t> input;
+    };
+    BatchPrefetcher<Frame> frames(inputs, [&](Frame *frame, FILE *input, int k) {
+        return readImage(&frame->input, input);
+    });
+    Image<uint16_t> output; /* Sobel magnitudes exceed 255 before scaling */
+    
+    Frame *frame;
+    int k, status;
+    while ((frame = frames.next(k, status)) != NULL) {
+        if (status) {
+            fprintf(stderr, "Can't load frame %d (%s)\n", k, inputs.getName(k).c_str());
+            timer.countFrame(false);
+            continue;
+        }
+        string outputName = makeBatchName(argv[3], inputs.getName(k), k);
+        apply5x5GaussianFilter(&frame->input);
+        applySobelOperator(&frame->input, &output);
+        if (writeImage(&output, outputName.c_str())) {
+            fprintf(stderr, "Can't write to file %s\n", outputName.c_str());
+            timer.countFrame(false);
+            continue;
+        }
+        timer.countFrame(true);
+    }
+    timer.report();
+    
+    return 0;
+}
+
 /******************************************************************************************
  * showUsage
  ******************************************************************************************/
@@ -68,5 +126,11 @@ void showUsage(string fileName) {
     << "where:\n"
     << "\t<arg1> is an input gray-level image\n"
     << "\t<arg2> is an output gray-level edge image\n"
-    << "example:\n\t" << fileName <<  " input.pgm output.pgm\n";
+    << "batch:\t" << fileName << " -batch <inputs> <arg2>\n"
+    << "\t<inputs> is a directory, a quoted glob pattern, a numbered sequence such as frame_%05d.pgm,\n"
+    << "\t@list (a file listing images), or an image file or - holding one or more images;\n"
+    << "\toutput names (and other per-frame image names) are patterns: %s is the input name\n"
+    << "\twithout directory and extension, %d (or %05d) the frame number\n"
+    << "example:\n\t" << fileName <<  " input.pgm output.pgm\n"
+    << "\t" << fileName << " -batch 'frames/*.pgm' edges/%s_G_S.pgm\n";
 }
\ No newline at end of file
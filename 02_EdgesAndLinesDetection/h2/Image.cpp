@@ -35,52 +35,527 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <atomic>
+#include <algorithm>
 #include "Image.h"
 #include "HoughDatabase.h"
 #include "Database.h"
 #include "DisjSets.h"
 
+/* SSE2 and AVX2 row kernels are compiled for x86 CPUs with GCC or Clang and chosen at run time */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define IMAGE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
 using namespace std;
 
+/* number of pixel blocks allocated by setSize */
+static atomic<unsigned long> imageAllocationCount(0);
+
+/******************************************************************************************
+ * getImageAllocationCount
+ ******************************************************************************************/
+unsigned long getImageAllocationCount() {
+    return imageAllocationCount.load();
+}
+
+/******************************************************************************************
+ * row kernels
+ ******************************************************************************************/
+/* instruction sets of the row kernels */
+enum RowKernelLevel {ROW_KERNELS_SCALAR, ROW_KERNELS_SSE2, ROW_KERNELS_AVX2};
+
+/* returns the best instruction set of the CPU; checked on the first call */
+static RowKernelLevel getRowKernelLevel() {
+#ifdef IMAGE_X86_KERNELS
+    static const RowKernelLevel level = (__builtin_cpu_init(), __builtin_cpu_supports("avx2")) ? ROW_KERNELS_AVX2
+                                      : __builtin_cpu_supports("sse2") ? ROW_KERNELS_SSE2 : ROW_KERNELS_SCALAR;
+    return level;
+#else
+    return ROW_KERNELS_SCALAR;
+#endif
+}
+
+const char *getRowKernelInstructionSet() {
+    switch (getRowKernelLevel()) {
+        case ROW_KERNELS_AVX2: return "avx2";
+        case ROW_KERNELS_SSE2: return "sse2";
+        default: return "scalar";
+    }
+}
+
+#ifdef IMAGE_X86_KERNELS
+
+/* The kernels below process 16 (SSE2) or 32 (AVX2) bytes of a row at a time and return the
+   number of pixels done; the scalar loops of the templates in Image.h finish the row. 8-bit
+   pixels are compared with an unsigned minimum: x <= t exactly when min(x, t) == x. */
+
+__attribute__((target("sse2")))
+static int thresholdRowSse2(uint8_t *pixels, int nCols, int threshold) {
+    const __m128i t = _mm_set1_epi8(char(threshold));
+    int j = 0;
+    for (; j+16<=nCols; j+=16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(pixels + j));
+        __m128i low = _mm_cmpeq_epi8(_mm_min_epu8(x, t), x);
+        _mm_storeu_si128((__m128i *)(pixels + j), _mm_andnot_si128(low, x));
+    }
+    return j;
+}
+
+__attribute__((target("avx2")))
+static int thresholdRowAvx2(uint8_t *pixels, int nCols, int threshold) {
+    const __m256i t = _mm256_set1_epi8(char(threshold));
+    int j = 0;
+    for (; j+32<=nCols; j+=32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(pixels + j));
+        __m256i low = _mm256_cmpeq_epi8(_mm256_min_epu8(x, t), x);
+        _mm256_storeu_si256((__m256i *)(pixels + j), _mm256_andnot_si256(low, x));
+    }
+    return j;
+}
+
+__attribute__((target("sse2")))
+static int thresholdRowSse2(int32_t *pixels, int nCols, int threshold) {
+    const __m128i t = _mm_set1_epi32(threshold);
+    int j = 0;
+    for (; j+4<=nCols; j+=4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(pixels + j));
+        _mm_storeu_si128((__m128i *)(pixels + j), _mm_and_si128(_mm_cmpgt_epi32(x, t), x));
+    }
+    return j;
+}
+
+__attribute__((target("avx2")))
+static int thresholdRowAvx2(int32_t *pixels, int nCols, int threshold) {
+    const __m256i t = _mm256_set1_epi32(threshold);
+    int j = 0;
+    for (; j+8<=nCols; j+=8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(pixels + j));
+        _mm256_storeu_si256((__m256i *)(pixels + j), _mm256_and_si256(_mm256_cmpgt_epi32(x, t), x));
+    }
+    return j;
+}
+
+__attribute__((target("sse2")))
+static int binarizeRowSse2(uint8_t *pixels, int nCols, int threshold) {
+    const __m128i t = _mm_set1_epi8(char(threshold)), one = _mm_set1_epi8(1);
+    int j = 0;
+    for (; j+16<=nCols; j+=16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(pixels + j));
+        __m128i low = _mm_cmpeq_epi8(_mm_min_epu8(x, t), x);
+        _mm_storeu_si128((__m128i *)(pixels + j), _mm_andnot_si128(low, one));
+    }
+    return j;
+}
+
+__attribute__((target("avx2")))
+static int binarizeRowAvx2(uint8_t *pixels, int nCols, int threshold) {
+    const __m256i t = _mm256_set1_epi8(char(threshold)), one = _mm256_set1_epi8(1);
+    int j = 0;
+    for (; j+32<=nCols; j+=32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(pixels + j));
+        __m256i low = _mm256_cmpeq_epi8(_mm256_min_epu8(x, t), x);
+        _mm256_storeu_si256((__m256i *)(pixels + j), _mm256_andnot_si256(low, one));
+    }
+    return j;
+}
+
+__attribute__((target("sse2")))
+static int binarizeRowSse2(int32_t *pixels, int nCols, int threshold) {
+    const __m128i t = _mm_set1_epi32(threshold), one = _mm_set1_epi32(1);
+    int j = 0;
+    for (; j+4<=nCols; j+=4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(pixels + j));
+        _mm_storeu_si128((__m128i *)(pixels + j), _mm_and_si128(_mm_cmpgt_epi32(x, t), one));
+    }
+    return j;
+}
+
+__attribute__((target("avx2")))
+static int binarizeRowAvx2(int32_t *pixels, int nCols, int threshold) {
+    const __m256i t = _mm256_set1_epi32(threshold), one = _mm256_set1_epi32(1);
+    int j = 0;
+    for (; j+8<=nCols; j+=8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(pixels + j));
+        _mm256_storeu_si256((__m256i *)(pixels + j), _mm256_and_si256(_mm256_cmpgt_epi32(x, t), one));
+    }
+    return j;
+}
+
+__attribute__((target("sse2")))
+static int copyBinaryRowSse2(const uint8_t *src, int nCols, uint8_t *dst) {
+    const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi8(1);
+    int j = 0;
+    for (; j+16<=nCols; j+=16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(src + j));
+        _mm_storeu_si128((__m128i *)(dst + j), _mm_andnot_si128(_mm_cmpeq_epi8(x, zero), one));
+    }
+    return j;
+}
+
+__attribute__((target("avx2")))
+static int copyBinaryRowAvx2(const uint8_t *src, int nCols, uint8_t *dst) {
+    const __m256i zero = _mm256_setzero_si256(), one = _mm256_set1_epi8(1);
+    int j = 0;
+    for (; j+32<=nCols; j+=32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(src + j));
+        _mm256_storeu_si256((__m256i *)(dst + j), _mm256_andnot_si256(_mm256_cmpeq_epi8(x, zero), one));
+    }
+    return j;
+}
+
+__attribute__((target("sse2")))
+static int copyBinaryRowSse2(const int32_t *src, int nCols, int32_t *dst) {
+    const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi32(1);
+    int j = 0;
+    for (; j+4<=nCols; j+=4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(src + j));
+        _mm_storeu_si128((__m128i *)(dst + j), _mm_andnot_si128(_mm_cmpeq_epi32(x, zero), one));
+    }
+    return j;
+}
+
+__attribute__((target("avx2")))
+static int copyBinaryRowAvx2(const int32_t *src, int nCols, int32_t *dst) {
+    const __m256i zero = _mm256_setzero_si256(), one = _mm256_set1_epi32(1);
+    int j = 0;
+    for (; j+8<=nCols; j+=8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(src + j));
+        _mm256_storeu_si256((__m256i *)(dst + j), _mm256_andnot_si256(_mm256_cmpeq_epi32(x, zero), one));
+    }
+    return j;
+}
+
+__attribute__((target("sse2")))
+static int packBinaryRowSse2(const uint8_t *pixels, int nCols, int threshold, uint64_t *words) {
+    const __m128i t = _mm_set1_epi8(char(threshold));
+    int j = 0;
+    for (; j+64<=nCols; j+=64) {
+        /* movemask puts pixel k of 16 in bit k, the order of the bits of the words */
+        uint64_t word = 0;
+        for (int k=0; k<64; k+=16) {
+            __m128i x = _mm_loadu_si128((const __m128i *)(pixels + j + k));
+            uint64_t low = uint64_t(unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(x, t), x))));
+            word |= (~low & 0xFFFF) << k;
+        }
+        words[j >> 6] = word;
+    }
+    return j;
+}
+
+__attribute__((target("avx2")))
+static int packBinaryRowAvx2(const uint8_t *pixels, int nCols, int threshold, uint64_t *words) {
+    const __m256i t = _mm256_set1_epi8(char(threshold));
+    int j = 0;
+    for (; j+64<=nCols; j+=64) {
+        __m256i x0 = _mm256_loadu_si256((const __m256i *)(pixels + j));
+        __m256i x1 = _mm256_loadu_si256((const __m256i *)(pixels + j + 32));
+        uint64_t low0 = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(x0, t), x0)));
+        uint64_t low1 = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(x1, t), x1)));
+        words[j >> 6] = ~(low0 | (low1 << 32));
+    }
+    return j;
+}
+
+#endif
+
+void thresholdRow(uint8_t *pixels, int nCols, int threshold) {
+    int j = 0;
+#ifdef IMAGE_X86_KERNELS
+    /* thresholds outside 0..254 leave no pixel or every pixel, which the scalar loop handles */
+    if (threshold >= 0 && threshold < 255) {
+        RowKernelLevel level = getRowKernelLevel();
+        j = (level==ROW_KERNELS_AVX2) ? thresholdRowAvx2(pixels, nCols, threshold)
+          : (level==ROW_KERNELS_SSE2) ? thresholdRowSse2(pixels, nCols, threshold) : 0;
+    }
+#endif
+    thresholdRow<uint8_t>(pixels + j, nCols - j, threshold);
+}
+
+void thresholdRow(int32_t *pixels, int nCols, int threshold) {
+    int j = 0;
+#ifdef IMAGE_X86_KERNELS
+    RowKernelLevel level = getRowKernelLevel();
+    j = (level==ROW_KERNELS_AVX2) ? thresholdRowAvx2(pixels, nCols, threshold)
+      : (level==ROW_KERNELS_SSE2) ? thresholdRowSse2(pixels, nCols, threshold) : 0;
+#endif
+    thresholdRow<int32_t>(pixels + j, nCols - j, threshold);
+}
+
+void binarizeRow(uint8_t *pixels, int nCols, int threshold) {
+    int j = 0;
+#ifdef IMAGE_X86_KERNELS
+    if (threshold >= 0 && threshold < 255) {
+        RowKernelLevel level = getRowKernelLevel();
+        j = (level==ROW_KERNELS_AVX2) ? binarizeRowAvx2(pixels, nCols, threshold)
+          : (level==ROW_KERNELS_SSE2) ? binarizeRowSse2(pixels, nCols, threshold) : 0;
+    }
+#endif
+    binarizeRow<uint8_t>(pixels + j, nCols - j, threshold);
+}
+
+void binarizeRow(int32_t *pixels, int nCols, int threshold) {
+    int j = 0;
+#ifdef IMAGE_X86_KERNELS
+    RowKernelLevel level = getRowKernelLevel();
+    j = (level==ROW_KERNELS_AVX2) ? binarizeRowAvx2(pixels, nCols, threshold)
+      : (level==ROW_KERNELS_SSE2) ? binarizeRowSse2(pixels, nCols, threshold) : 0;
+#endif
+    binarizeRow<int32_t>(pixels + j, nCols - j, threshold);
+}
+
+void copyBinaryRow(const uint8_t *src, int nCols, uint8_t *dst) {
+    int j = 0;
+#ifdef IMAGE_X86_KERNELS
+    RowKernelLevel level = getRowKernelLevel();
+    j = (level==ROW_KERNELS_AVX2) ? copyBinaryRowAvx2(src, nCols, dst)
+      : (level==ROW_KERNELS_SSE2) ? copyBinaryRowSse2(src, nCols, dst) : 0;
+#endif
+    copyBinaryRow<uint8_t, uint8_t>(src + j, nCols - j, dst + j);
+}
+
+void copyBinaryRow(const int32_t *src, int nCols, int32_t *dst) {
+    int j = 0;
+#ifdef IMAGE_X86_KERNELS
+    RowKernelLevel level = getRowKernelLevel();
+    j = (level==ROW_KERNELS_AVX2) ? copyBinaryRowAvx2(src, nCols, dst)
+      : (level==ROW_KERNELS_SSE2) ? copyBinaryRowSse2(src, nCols, dst) : 0;
+#endif
+    copyBinaryRow<int32_t, int32_t>(src + j, nCols - j, dst + j);
+}
+
+void packBinaryRow(const uint8_t *pixels, int nCols, int threshold, uint64_t *words) {
+    int j = 0;
+#ifdef IMAGE_X86_KERNELS
+    if (threshold >= 0 && threshold < 255) {
+        RowKernelLevel level = getRowKernelLevel();
+        j = (level==ROW_KERNELS_AVX2) ? packBinaryRowAvx2(pixels, nCols, threshold, words)
+          : (level==ROW_KERNELS_SSE2) ? packBinaryRowSse2(pixels, nCols, threshold, words) : 0;
+    }
+#endif
+    /* j is a multiple of 64, so the rest of the row starts at a word */
+    packBinaryRow<uint8_t>(pixels + j, nCols - j, threshold, words + (j >> 6));
+}
+
+/******************************************************************************************
+ * Histogram
+ ******************************************************************************************/
+void Histogram::reset(int levels) {
+    Nbins = (levels > 255) ? 65536 : 256;
+    partial.assign(size_t(4) * Nbins, 0);
+    counts.assign(Nbins, 0);
+    summed = true;
+}
+
+/* bytes are always inside the bins, so they are counted without clamping, 4 at a time */
+void Histogram::addRow(const uint8_t *pixels, int nCols) {
+    uint32_t *bins0 = &partial[0], *bins1 = bins0 + Nbins, *bins2 = bins1 + Nbins, *bins3 = bins2 + Nbins;
+    int j = 0;
+    for (; j+4<=nCols; j+=4) {
+        bins0[pixels[j]]++;
+        bins1[pixels[j+1]]++;
+        bins2[pixels[j+2]]++;
+        bins3[pixels[j+3]]++;
+    }
+    for (; j<nCols; j++) {
+        bins0[pixels[j]]++;
+    }
+    summed = false;
+}
+
+const vector<uint64_t> &Histogram::getCounts() {
+    if (!summed) {
+        for (int v=0; v<Nbins; v++) {
+            counts[v] = uint64_t(partial[v]) + partial[Nbins + v] + partial[2*Nbins + v] + partial[3*Nbins + v];
+        }
+        summed = true;
+    }
+    return counts;
+}
+
+int Histogram::getOtsuThreshold() {
+    const vector<uint64_t> &h = getCounts();
+    double total = 0, sum = 0;
+    int v;
+    for (v=0; v<Nbins; v++) {
+        total += double(h[v]);
+        sum += double(v) * double(h[v]);
+    }
+    
+    /* between-class variance of pixels <= v and pixels > v, up to the factor 1/total^2 */
+    double below = 0, sumBelow = 0, best = -1;
+    int threshold = 0;
+    for (v=0; v+1<Nbins; v++) {
+        below += double(h[v]);
+        sumBelow += double(v) * double(h[v]);
+        double above = total - below;
+        if (below==0) {
+            continue;
+        }
+        if (above==0) {
+            break;
+        }
+        double difference = sumBelow / below - (sum - sumBelow) / above;
+        double variance = below * above * difference * difference;
+        if (variance > best) {
+            best = variance;
+            threshold = v;
+        }
+    }
+    return threshold;
+}
+
+int Histogram::getPercentileThreshold(double percent) {
+    const vector<uint64_t> &h = getCounts();
+    uint64_t total = 0;
+    for (int v=0; v<Nbins; v++) {
+        total += h[v];
+    }
+    double wanted = double(total) * percent / 100;
+    uint64_t below = 0;
+    for (int v=0; v<Nbins; v++) {
+        below += h[v];
+        if (double(below) >= wanted) {
+            return v;
+        }
+    }
+    return Nbins - 1;
+}
+
+/******************************************************************************************
+ * Threshold
+ ******************************************************************************************/
+int Threshold::parse(const char *arg) {
+    char *end;
+    if (strcmp(arg, "auto")==0) {
+        mode = OTSU;
+        return 0;
+    }
+    if (strncmp(arg, "auto:", 5)==0) {
+        double p = strtod(arg + 5, &end);
+        if (end==arg + 5 || *end!='\0' || !(p >= 0 && p <= 100)) {
+            return -1;
+        }
+        mode = PERCENTILE;
+        percent = p;
+        return 0;
+    }
+    long value = strtol(arg, &end, 10);
+    if (end==arg || *end!='\0') {
+        return -1;
+    }
+    mode = FIXED;
+    level = int(value);
+    return 0;
+}
+
+int Threshold::choose(Histogram &histogram) const {
+    if (mode==FIXED) {
+        return level;
+    }
+    int threshold;
+    if (mode==OTSU) {
+        threshold = histogram.getOtsuThreshold();
+        fprintf(stderr, "Threshold: %d (Otsu)\n", threshold);
+    }
+    else {
+        threshold = histogram.getPercentileThreshold(percent);
+        fprintf(stderr, "Threshold: %d (%g%% of the pixels at or below)\n", threshold, percent);
+    }
+    return threshold;
+}
+
 /******************************************************************************************
  * default constructor
  ******************************************************************************************/
-Image::Image() {
+template <typename T>
+Image<T>::Image() {
     /* initialize image class */
     /* everything is zero...  */
     Ncols=0;
     Nrows=0;
     Ncolors=0;
     rhoShift=0;
+    stride=0;
+    halo=0;
+    alignedRows=false;
+    block=NULL;
+    blockSize=0;
     image=NULL;
 }
 
 /******************************************************************************************
  * copy constructor
  ******************************************************************************************/
-Image::Image(const Image &im) {
+template <typename T>
+Image<T>::Image(const Image &im) {
     /* initialize image class */
+    Ncols=0;
+    Nrows=0;
+    stride=0;
+    halo=0;
+    alignedRows=false;
+    block=NULL;
+    blockSize=0;
+    image=NULL;
+    
     /* Copy from im  */
-  setSize(im.getNRows(), im.getNCols());
-  setColors(im.getColors());
-  setRhoShift(im.getRhoShift());
-  int i,j;
-  for (i=0; i<getNRows(); ++i)
-    for (j=0; j<getNCols(); ++j){
-      setPixel(i,j, im.getPixel(i,j));
+    setColors(im.getColors());
+    setRhoShift(im.getRhoShift());
+    if (im.getData() && setSize(im.getNRows(), im.getNCols(), im.getHalo(), im.hasAlignedRows()) > 0) {
+        copyRowsWithHalo(im);
     }
 }
 
+/******************************************************************************************
+ * move constructor
+ ******************************************************************************************/
+template <typename T>
+Image<T>::Image(Image &&im) noexcept {
+    /* take over the pixel buffer */
+    Nrows=im.Nrows;
+    Ncols=im.Ncols;
+    Ncolors=im.Ncolors;
+    rhoShift=im.rhoShift;
+    stride=im.stride;
+    halo=im.halo;
+    alignedRows=im.alignedRows;
+    block=im.block;
+    blockSize=im.blockSize;
+    image=im.image;
+    
+    /* leave im empty */
+    im.Nrows=0;
+    im.Ncols=0;
+    im.stride=0;
+    im.halo=0;
+    im.block=NULL;
+    im.blockSize=0;
+    im.image=NULL;
+}
+
 /******************************************************************************************
  * overloaded copy constructor
  ******************************************************************************************/
-Image::Image(const Image &im, bool binaryCopy) {
+template <typename T>
+template <typename U>
+Image<T>::Image(const Image<U> &im, bool binaryCopy) {
     int i,j, numRows, numCols;
     numRows = im.getNRows( );
     numCols = im.getNCols( );
     
     /* initialize image class */
+    Ncols=0;
+    Nrows=0;
+    stride=0;
+    halo=0;
+    alignedRows=false;
+    block=NULL;
+    blockSize=0;
+    image=NULL;
     setSize(numRows, numCols);
     setRhoShift(im.getRhoShift());
     
@@ -88,62 +563,185 @@ Image::Image(const Image &im, bool binaryCopy) {
     if (binaryCopy) {
         setColors(1);
         for (i=0; i<numRows; ++i) {
-            for (j=0; j<numCols; ++j){
-                if (im.getPixel(i,j)==0) {
-                    setPixel(i, j, 0);
-                }
-                else {
-                    setPixel(i, j, 1);
-                }
-            }
+            copyBinaryRow(im.row(i), numCols, row(i));
         }
     }
     else {
         setColors(im.getColors());
         for (i=0; i<numRows; ++i) {
+            const U *src = im.row(i);
+            T *dst = row(i);
             for (j=0; j<numCols; ++j){
-                setPixel(i,j, im.getPixel(i,j));
+                dst[j] = T(src[j]);
             }
         }
     }
 }
 
+/******************************************************************************************
+ * overloaded copy constructor for views
+ ******************************************************************************************/
+template <typename T>
+Image<T>::Image(ImageView<const T> v) {
+    /* initialize image class */
+    Ncols=0;
+    Nrows=0;
+    Ncolors=0;
+    rhoShift=0;
+    stride=0;
+    halo=0;
+    alignedRows=false;
+    block=NULL;
+    blockSize=0;
+    image=NULL;
+    
+    /* Copy from v */
+    copyPixels(v);
+}
+
 /******************************************************************************************
  * destructor
  ******************************************************************************************/
-Image::~Image() {
-    int i;
-    if (image) {
-	for (i=0; i<Nrows; i++)
-	    free( image[i] );
-	free(image);
+template <typename T>
+Image<T>::~Image() {
+    if (block) {
+	free(block);
+    }
+}
+
+/******************************************************************************************
+ * copy assignment
+ ******************************************************************************************/
+template <typename T>
+Image<T> &Image<T>::operator=(const Image &im) {
+    if (this == &im) {
+        return *this;
+    }
+    
+    setColors(im.getColors());
+    setRhoShift(im.getRhoShift());
+    
+    if (!im.getData()) {
+        free(block);
+        Nrows=0;
+        Ncols=0;
+        stride=0;
+        halo=0;
+        block=NULL;
+        blockSize=0;
+        image=NULL;
+        return *this;
+    }
+    
+    /* setSize keeps the current buffer if it has the same number of pixels */
+    if (setSize(im.getNRows(), im.getNCols(), im.getHalo(), im.hasAlignedRows()) > 0) {
+        copyRowsWithHalo(im);
+    }
+    return *this;
+}
+
+/******************************************************************************************
+ * move assignment
+ ******************************************************************************************/
+template <typename T>
+Image<T> &Image<T>::operator=(Image &&im) noexcept {
+    if (this == &im) {
+        return *this;
+    }
+    
+    free(block);
+    
+    /* take over the pixel buffer */
+    Nrows=im.Nrows;
+    Ncols=im.Ncols;
+    Ncolors=im.Ncolors;
+    rhoShift=im.rhoShift;
+    stride=im.stride;
+    halo=im.halo;
+    alignedRows=im.alignedRows;
+    block=im.block;
+    blockSize=im.blockSize;
+    image=im.image;
+    
+    /* leave im empty */
+    im.Nrows=0;
+    im.Ncols=0;
+    im.stride=0;
+    im.halo=0;
+    im.block=NULL;
+    im.blockSize=0;
+    im.image=NULL;
+    
+    return *this;
+}
+
+/******************************************************************************************
+ * copyRowsWithHalo
+ ******************************************************************************************/
+template <typename T>
+void Image<T>::copyRowsWithHalo(const Image &im) {
+    /* same layout as im: copy every row together with its halo */
+    for (int i=-halo; i<Nrows+halo; ++i) {
+        memcpy(row(i) - halo, im.row(i) - halo, sizeof(T) * (Ncols + 2*halo));
     }
 }
 
 /******************************************************************************************
  * setSize
  ******************************************************************************************/
-int Image::setSize(int rows, int columns) {
-    int i;
+template <typename T>
+int Image<T>::setSize(int rows, int columns) {
+    return setSize(rows, columns, 0, false);
+}
+
+/******************************************************************************************
+ * setSize - overloaded to keep a halo and align rows
+ ******************************************************************************************/
+template <typename T>
+int Image<T>::setSize(int rows, int columns, int haloSize, bool alignRows) {
     if (rows<=0 || columns <=0){
-	printf("setSize: rows, columns must be positive\n");
+	fprintf(stderr, "setSize: rows, columns must be positive\n");
 	return -2;
     }
-
-    if ( (image=(int **)malloc(sizeof (int *) * rows))==NULL ){
-	printf("setSize: can't allocate space\n");
-	return -1;
-     }
-
-    for (i=0; i<rows; i++) {
-	if ( (image[i]=(int *)malloc(sizeof(int) * columns))==NULL){
-	    printf("setSize: can't allocate space\n");
-	    return -1;
-	}
+    if (haloSize < 0) {
+        haloSize = 0;
+    }
+    
+    /* rows (with haloSize pixels on both sides) stored one after another, */
+    /* and haloSize such rows above and below the image;                     */
+    /* for aligned rows, pixel 0 of every row and the stride are multiples   */
+    /* of IMAGE_ROW_ALIGNMENT bytes                                          */
+    int alignment = alignRows ? int(IMAGE_ROW_ALIGNMENT / sizeof(T)) : 1;
+    int lead = (haloSize + alignment - 1) / alignment * alignment;
+    int newStride = (lead + columns + haloSize + alignment - 1) / alignment * alignment;
+    size_t newSize = size_t(rows + 2*haloSize) * newStride;
+    
+    /* keep the current block if it has the right size */
+    if ( !block || newSize != blockSize ) {
+        void *newBlock = NULL;
+        free(block);
+        if ( posix_memalign(&newBlock, IMAGE_ROW_ALIGNMENT, sizeof(T) * newSize) != 0 ){
+            fprintf(stderr, "setSize: can't allocate space\n");
+            Nrows=0;
+            Ncols=0;
+            stride=0;
+            halo=0;
+            block=NULL;
+            blockSize=0;
+            image=NULL;
+            return -1;
+        }
+        block=(T *)newBlock;
+        blockSize=newSize;
+        ++imageAllocationCount;
     }
 
     Nrows=rows;
     Ncols=columns;
+    stride=newStride;
+    halo=haloSize;
+    alignedRows=alignRows;
+    image=block + size_t(haloSize) * newStride + lead;
 
     return rows*columns;
 }
@@ -151,42 +749,98 @@ int Image::setSize(int rows, int columns) {
 /******************************************************************************************
  * setSizeAndInitialize
  ******************************************************************************************/
-int Image::setSizeAndInitialize(int rows, int columns) {
-    int i;
-    if (rows<=0 || columns <=0){
-        printf("setSize: rows, columns must be positive\n");
-        return -2;
+template <typename T>
+int Image<T>::setSizeAndInitialize(int rows, int columns) {
+    int result = setSize(rows, columns);
+    if (result < 0) {
+        return result;
     }
     
-    if ( (image=(int **)malloc(sizeof (int *) * rows))==NULL ){
-        printf("setSize: can't allocate space\n");
-        return -1;
-    }
+    // initialize all elements to 0:
+    memset(block, 0, sizeof(T) * blockSize);
     
-    for (i=0; i<rows; i++) {
-        if ( (image[i]=(int *)malloc(sizeof(int) * columns))==NULL){
-            printf("setSize: can't allocate space\n");
-            return -1;
+    return result;
+}
+
+/******************************************************************************************
+ * copyPixels
+ ******************************************************************************************/
+template <typename T>
+int Image<T>::copyPixels(ImageView<const T> v) {
+    int result = setSize(v.getNRows(), v.getNCols());
+    if (result < 0) {
+        return result;
+    }
+    for (int i=0; i<Nrows; ++i) {
+        memcpy(row(i), v.row(i), sizeof(T) * Ncols);
+    }
+    return result;
+}
+
+/******************************************************************************************
+ * fillHalo
+ ******************************************************************************************/
+/* maps coordinate p outside [0, n) to the pixel that fills it */
+static int borderIndex(int p, int n, BorderMode mode) {
+    if (mode == BORDER_REFLECT) {
+        if (p < 0) {
+            p = -p;
+        }
+        else if (p >= n) {
+            p = 2*(n-1) - p;
         }
     }
+    /* BORDER_REPLICATE, or a halo wider than the image */
+    if (p < 0) {
+        p = 0;
+    }
+    else if (p >= n) {
+        p = n-1;
+    }
+    return p;
+}
+
+template <typename T>
+void Image<T>::fillHalo(BorderMode mode) {
+    if (!image || halo == 0) {
+        return;
+    }
     
-    Nrows=rows;
-    Ncols=columns;
-    
-    // initialize all elements to 0:
-    for (int r=0; r<rows; r++) {
-        for (int c=0; c<columns; c++) {
-            image[r][c] = 0;
+    /* left and right parts of every row */
+    for (int i=0; i<Nrows; i++) {
+        T *pixels = row(i);
+        for (int k=1; k<=halo; k++) {
+            if (mode == BORDER_ZERO) {
+                pixels[-k] = 0;
+                pixels[Ncols-1+k] = 0;
+            }
+            else {
+                pixels[-k] = pixels[borderIndex(-k, Ncols, mode)];
+                pixels[Ncols-1+k] = pixels[borderIndex(Ncols-1+k, Ncols, mode)];
+            }
         }
     }
     
-    return rows*columns;
+    /* whole rows (with their halo) above and below the image */
+    for (int k=1; k<=halo; k++) {
+        T *above = row(-k) - halo;
+        T *below = row(Nrows-1+k) - halo;
+        if (mode == BORDER_ZERO) {
+            memset(above, 0, sizeof(T) * (Ncols + 2*halo));
+            memset(below, 0, sizeof(T) * (Ncols + 2*halo));
+        }
+        else {
+            memcpy(above, row(borderIndex(-k, Nrows, mode)) - halo, sizeof(T) * (Ncols + 2*halo));
+            memcpy(below, row(borderIndex(Nrows-1+k, Nrows, mode)) - halo, sizeof(T) * (Ncols + 2*halo));
+        }
+    }
 }
 
 /******************************************************************************************
  * setRhoShift
  ******************************************************************************************/
-int Image::setRhoShift(int rs) {
+template <typename T>
+int Image<T>::setRhoShift(int rs) {
     rhoShift = rs;
     return rs;
 }
@@ -194,7 +848,8 @@ int Image::setRhoShift(int rs) {
 /******************************************************************************************
  * setColors
  ******************************************************************************************/
-int Image::setColors(int colors) {
+template <typename T>
+int Image<T>::setColors(int colors) {
   Ncolors=colors;
   return Ncolors;
 }
@@ -202,62 +857,66 @@ int Image::setColors(int colors) {
 /******************************************************************************************
  * setPixel
  ******************************************************************************************/
-int Image::setPixel(int i, int j, int color) {
+template <typename T>
+int Image<T>::setPixel(int i, int j, int color) {
     if ( !image ) {
-        printf("setPixel: write pixel to an empty image");
+        fprintf(stderr, "setPixel: write pixel to an empty image");
         return 0;
     }
     
-    if ( i<0 || i>Nrows || j<0 || j>Ncols ){
+    if ( i<0 || i>=Nrows || j<0 || j>=Ncols ){
         //  error_msg("Image::setPixel -> Out of boundaries\n");
         return -1;
     }
-    image[i][j]=color;
+    image[i*stride + j]=T(color);
     return color;
 }
 
 /******************************************************************************************
  * getPixel
  ******************************************************************************************/
-int Image::getPixel(int i, int j) const {
+template <typename T>
+int Image<T>::getPixel(int i, int j) const {
    if ( !image ) {
-       printf("getPixel: read pixel from an empty image\n");
+       fprintf(stderr, "getPixel: read pixel from an empty image\n");
        return -1;
      }
-  if (i<0 || i>Nrows || j<0 || j>Ncols) {
+  if (i<0 || i>=Nrows || j<0 || j>=Ncols) {
         //  error_msg("getPixel: out of image");
         return -1;
        }
        else
-          return image[i][j];
+          return int(image[i*stride + j]);
 }
 
 /******************************************************************************************
  * incrementPixel
  ******************************************************************************************/
-int Image::incrementPixel(int i, int j) {
+template <typename T>
+int Image<T>::incrementPixel(int i, int j) {
     if ( !image ) {
-        printf("setPixel: write pixel to an empty image");
+        fprintf(stderr, "setPixel: write pixel to an empty image");
         return 0;
     }
     
-    if ( i<0 || i>Nrows || j<0 || j>Ncols ) {
+    if ( i<0 || i>=Nrows || j<0 || j>=Ncols ) {
         //  error_msg("Image::setPixel -> Out of boundaries\n");
         return -1;
     }
     
-    return ++image[i][j];
+    return int(++image[i*stride + j]);
 }
 /******************************************************************************************
  * incrementPatchAroundPixel
  ******************************************************************************************/
-int Image::incrementPatchAroundPixel(int i, int j) {
+template <typename T>
+int Image<T>::incrementPatchAroundPixel(int i, int j) {
     if ( !image ) {
-        printf("setPixel: write pixel to an empty image");
+        fprintf(stderr, "setPixel: write pixel to an empty image");
         return 0;
     }
     
-    if ( i<0 || i>Nrows || j<0 || j>Ncols ){
+    if ( i<0 || i>=Nrows || j<0 || j>=Ncols ){
         //  error_msg("Image::setPixel -> Out of boundaries\n");
         return -1;
     }
@@ -268,7 +927,7 @@ int Image::incrementPatchAroundPixel(int i, int j) {
     for (int k=i-1; k <=i+1; k++) {
         for (int l=j-1; l <=j+1; l++) {
             if (k>=0 && k<Nrows && l>=0 && l<Ncols) {
-                curPixVal = image[k][l]++;
+                curPixVal = int(image[k*stride + l]++);
                 if (curPixVal > maxPixVal) {
                     maxPixVal = curPixVal;
                 }
@@ -277,3 +936,259 @@ int Image::incrementPatchAroundPixel(int i, int j) {
     }
     return maxPixVal;
 }
+
+/******************************************************************************************
+ * BinaryImage::setSize
+ ******************************************************************************************/
+int BinaryImage::setSize(int rows, int columns) {
+    if (rows<=0 || columns <=0){
+        fprintf(stderr, "setSize: rows, columns must be positive\n");
+        return -2;
+    }
+    Nrows=rows;
+    Ncols=columns;
+    wordsPerRow=(columns + 63) / 64;
+    words.assign(size_t(rows) * wordsPerRow, 0);
+    return rows*columns;
+}
+
+/******************************************************************************************
+ * BinaryImage::getPixel
+ ******************************************************************************************/
+int BinaryImage::getPixel(int i, int j) const {
+    if (i<0 || i>=Nrows || j<0 || j>=Ncols) {
+        return -1;
+    }
+    return get(i, j) ? 1 : 0;
+}
+
+/******************************************************************************************
+ * BinaryImage::clearPadding
+ ******************************************************************************************/
+void BinaryImage::clearPadding() {
+    if ((Ncols & 63) == 0) {
+        return;
+    }
+    uint64_t mask = (uint64_t(1) << (Ncols & 63)) - 1;
+    for (int i=0; i<Nrows; i++) {
+        row(i)[wordsPerRow - 1] &= mask;
+    }
+}
+
+/******************************************************************************************
+ * BinaryImage::countPixels
+ ******************************************************************************************/
+long BinaryImage::countPixels() const {
+    long n = 0;
+    for (size_t k=0; k<words.size(); k++) {
+        n += countBits(words[k]);
+    }
+    return n;
+}
+
+/******************************************************************************************
+ * BinaryImage::andWith, orWith, xorWith
+ ******************************************************************************************/
+int BinaryImage::andWith(const BinaryImage &other) {
+    if (other.Nrows!=Nrows || other.Ncols!=Ncols) {
+        return -1;
+    }
+    for (size_t k=0; k<words.size(); k++) {
+        words[k] &= other.words[k];
+    }
+    return 0;
+}
+
+int BinaryImage::orWith(const BinaryImage &other) {
+    if (other.Nrows!=Nrows || other.Ncols!=Ncols) {
+        return -1;
+    }
+    for (size_t k=0; k<words.size(); k++) {
+        words[k] |= other.words[k];
+    }
+    return 0;
+}
+
+int BinaryImage::xorWith(const BinaryImage &other) {
+    if (other.Nrows!=Nrows || other.Ncols!=Ncols) {
+        return -1;
+    }
+    for (size_t k=0; k<words.size(); k++) {
+        words[k] ^= other.words[k];
+    }
+    return 0;
+}
+
+/******************************************************************************************
+ * BinaryImage::invert
+ ******************************************************************************************/
+void BinaryImage::invert() {
+    for (size_t k=0; k<words.size(); k++) {
+        words[k] = ~words[k];
+    }
+    clearPadding();
+}
+
+/******************************************************************************************
+ * BinaryImage::shiftColumns
+ ******************************************************************************************/
+void BinaryImage::shiftColumns(int n) {
+    if (n==0) {
+        return;
+    }
+    int shift = (n > 0) ? n : -n;
+    int wordShift = shift >> 6, bitShift = shift & 63;
+    for (int i=0; i<Nrows; i++) {
+        uint64_t *w = row(i);
+        if (n > 0) {
+            /* to the right: pixel j moves to j + n, towards the high bits and the next words */
+            for (int k=wordsPerRow-1; k>=0; k--) {
+                int from = k - wordShift;
+                uint64_t word = 0;
+                if (from >= 0) {
+                    word = w[from] << bitShift;
+                    if (bitShift && from > 0) {
+                        word |= w[from-1] >> (64 - bitShift);
+                    }
+                }
+                w[k] = word;
+            }
+        }
+        else {
+            /* to the left: pixel j moves to j - n, towards the low bits and the previous words */
+            for (int k=0; k<wordsPerRow; k++) {
+                int from = k + wordShift;
+                uint64_t word = 0;
+                if (from < wordsPerRow) {
+                    word = w[from] >> bitShift;
+                    if (bitShift && from + 1 < wordsPerRow) {
+                        word |= w[from+1] << (64 - bitShift);
+                    }
+                }
+                w[k] = word;
+            }
+        }
+    }
+    clearPadding();
+}
+
+/******************************************************************************************
+ * BinaryImage::shiftRows
+ ******************************************************************************************/
+void BinaryImage::shiftRows(int n) {
+    if (n >= Nrows || -n >= Nrows) {
+        fill(words.begin(), words.end(), uint64_t(0));
+        return;
+    }
+    size_t rowWords = size_t(wordsPerRow), moved = size_t(Nrows - (n > 0 ? n : -n)) * rowWords;
+    if (n > 0) {
+        memmove(&words[n * rowWords], &words[0], moved * sizeof(uint64_t));
+        fill(words.begin(), words.begin() + n * rowWords, uint64_t(0));
+    }
+    else if (n < 0) {
+        memmove(&words[0], &words[-n * rowWords], moved * sizeof(uint64_t));
+        fill(words.begin() + moved, words.end(), uint64_t(0));
+    }
+}
+
+/******************************************************************************************
+ * nextColumn - the first column at or after j whose bit in words differs from flip (0 to
+ * find a 1, ~0 to find a 0), or 64 * wordsPerRow if there is none
+ ******************************************************************************************/
+static inline int nextColumn(const uint64_t *words, int wordsPerRow, int j, uint64_t flip) {
+    int k = j >> 6;
+    if (k >= wordsPerRow) {
+        return wordsPerRow << 6;
+    }
+    uint64_t bits = (words[k] ^ flip) & (~uint64_t(0) << (j & 63));
+    while (bits == 0) {
+        if (++k == wordsPerRow) {
+            return wordsPerRow << 6;
+        }
+        bits = words[k] ^ flip;
+    }
+    return (k << 6) + countTrailingZeros(bits);
+}
+
+/******************************************************************************************
+ * RunLengthImage::encode
+ ******************************************************************************************/
+int RunLengthImage::encode(const BinaryImage &im) {
+    Nrows = im.getNRows();
+    Ncols = im.getNCols();
+    runs.clear();
+    firstRun.assign(Nrows + 1, 0);
+    for (int i=0; i<Nrows; i++) {
+        encodeRow(im.row(i), Ncols, runs);
+        firstRun[i+1] = int(runs.size());
+    }
+    return int(runs.size());
+}
+
+/******************************************************************************************
+ * RunLengthImage::encodeRow
+ ******************************************************************************************/
+int RunLengthImage::encodeRow(const uint64_t *words, int columns, std::vector<Run> &rowRuns) {
+    int wordsPerRow = (columns + 63) / 64;
+    size_t numOfRuns = rowRuns.size();
+    
+    /* padding bits are 0, so every run ends by columns */
+    for (int j = nextColumn(words, wordsPerRow, 0, 0); j < columns; ) {
+        Run run;
+        run.start = j;
+        j = nextColumn(words, wordsPerRow, j, ~uint64_t(0));
+        run.end = j - 1;
+        rowRuns.push_back(run);
+        j = nextColumn(words, wordsPerRow, j, 0);
+    }
+    return int(rowRuns.size() - numOfRuns);
+}
+
+/******************************************************************************************
+ * RunLengthImage::decode
+ ******************************************************************************************/
+int RunLengthImage::decode(BinaryImage *im) const {
+    if (im->setSize(Nrows, Ncols) < 0) {
+        return -1;
+    }
+    for (int i=0; i<Nrows; i++) {
+        uint64_t *w = im->row(i);
+        for (int r=firstRun[i]; r<firstRun[i+1]; r++) {
+            int first = runs[r].start >> 6, last = runs[r].end >> 6;
+            uint64_t startMask = ~uint64_t(0) << (runs[r].start & 63);
+            uint64_t endMask = ~uint64_t(0) >> (63 - (runs[r].end & 63));
+            if (first == last) {
+                w[first] |= startMask & endMask;
+                continue;
+            }
+            w[first] |= startMask;
+            for (int k=first+1; k<last; k++) {
+                w[k] = ~uint64_t(0);
+            }
+            w[last] |= endMask;
+        }
+    }
+    return 0;
+}
+
+/******************************************************************************************
+ * RunLengthImage::countPixels
+ ******************************************************************************************/
+long RunLengthImage::countPixels() const {
+    long n = 0;
+    for (size_t r=0; r<runs.size(); r++) {
+        n += runs[r].end - runs[r].start + 1;
+    }
+    return n;
+}
+
+/******************************************************************************************
+ * explicit instantiations for supported pixel types
+ ******************************************************************************************/
+#define INSTANTIATE_IMAGE_BINARY_COPY(T, U) \
+    template Image<T>::Image(const Image<U> &im, bool binaryCopy);
+#define INSTANTIATE_IMAGE(T) \
+    template class Image<T>; \
+    FOR_EACH_PIXEL_TYPE_2(INSTANTIATE_IMAGE_BINARY_COPY, T)
+
+FOR_EACH_PIXEL_TYPE(INSTANTIATE_IMAGE)
@@ -40,10 +40,128 @@
 #ifndef _IMAGE
 #define _IMAGE
 
+#include <stdint.h>
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+#include <utility>
+#include <functional>
 #include "HoughDatabase.h"
 #include "Database.h"
 #include "DisjSets.h"
 
+/**
+ * Applies macro M to every supported pixel type (used for explicit instantiations).
+ */
+#define FOR_EACH_PIXEL_TYPE(M) M(uint8_t) M(uint16_t) M(uint32_t) M(int32_t) M(float)
+#define FOR_EACH_PIXEL_TYPE_2(M, T) M(T, uint8_t) M(T, uint16_t) M(T, uint32_t) M(T, int32_t) M(T, float)
+
+/**
+ * Non-owning view of a rectangle of pixels of type T (const T for read-only views):
+ * pointer to the first pixel, size, and the number of pixels between the starts of two
+ * consecutive rows. Views are cheap to copy and are used to restrict processing to a region
+ * of interest without copying it; the pixels must outlive the view.
+ */
+template <typename T>
+class ImageView {
+
+private:
+    
+    T *data; /* first pixel of the view */
+    int Nrows; /* number of rows */
+    int Ncols; /* number of columns */
+    int stride; /* number of pixels between the starts of two consecutive rows */
+
+public:
+    
+    /**
+     * Default constructor; empty view.
+     */
+    ImageView() : data(0), Nrows(0), Ncols(0), stride(0) {};
+    
+    /**
+     * Constructs a view of rows x columns pixels starting at first.
+     */
+    ImageView(T *first, int rows, int columns, int rowStride)
+        : data(first), Nrows(rows), Ncols(columns), stride(rowStride) {};
+    
+    /**
+     * Converts a view of T to a view of const T.
+     */
+    template <typename U>
+    ImageView(const ImageView<U> &v)
+        : data(v.getData()), Nrows(v.getNRows()), Ncols(v.getNCols()), stride(v.getStride()) {};
+    
+    /**
+     * Return size of the view and the number of pixels between the starts of two rows.
+     */
+    int getNRows() const {return Nrows;};
+    int getNCols() const {return Ncols;};
+    int getStride() const {return stride;};
+    
+    /**
+     * Returns pointer to the first pixel of the view.
+     */
+    T *getData() const {return data;};
+    
+    /**
+     * Returns pointer to the first pixel of row i (no bounds checking).
+     */
+    T *row(int i) const {return data + i*stride;};
+    
+    /**
+     * Returns reference to pixel at row i and column j (no bounds checking).
+     */
+    T &operator()(int i, int j) const {return data[i*stride + j];};
+    
+    /**
+     * Returns view of rows x columns pixels starting at row i and column j, clipped to this
+     * view; the result is empty if the rectangle lies outside of this view.
+     */
+    ImageView subview(int i, int j, int rows, int columns) const {
+        int iEnd = i + rows;
+        int jEnd = j + columns;
+        if (i < 0) i = 0;
+        if (j < 0) j = 0;
+        if (iEnd > Nrows) iEnd = Nrows;
+        if (jEnd > Ncols) jEnd = Ncols;
+        if (iEnd <= i || jEnd <= j) {
+            return ImageView();
+        }
+        return ImageView(data + i*stride + j, iEnd - i, jEnd - j, stride);
+    };
+    
+    /**
+     * Sets all pixels of the view to value.
+     */
+    void fill(T value) const {
+        for (int i=0; i<Nrows; i++) {
+            T *pixels = row(i);
+            for (int j=0; j<Ncols; j++) {
+                pixels[j] = value;
+            }
+        }
+    };
+};
+
+/**
+ * Alignment (in bytes) of pixel 0 of every row of images with aligned rows.
+ */
+#define IMAGE_ROW_ALIGNMENT 64
+
+/**
+ * How the halo around an image is filled: with 0's, by replicating the outermost pixels,
+ * or by mirroring the image around its outermost pixels (pixel -k is a copy of pixel k).
+ */
+enum BorderMode {BORDER_ZERO, BORDER_REPLICATE, BORDER_REFLECT};
+
+/**
+ * Image with pixels of type T: uint8_t for 8-bit PGM images and binary masks,
+ * uint16_t/uint32_t for Hough accumulators, int32_t for label maps, float for
+ * photometric data. Checked accessors (setPixel, getPixel, ...) work on int values and
+ * test the coordinates; inner loops should use row(), operator() or the iterators instead.
+ */
+template <typename T>
 class Image {
 
 private:
@@ -52,10 +170,25 @@ private:
     int Ncols; /* number of columns */
     int Ncolors; /* number of gray level colors */
     int rhoShift; /* rho shift for Hough image */
-    int **image;
+    int stride; /* number of pixels between the starts of two consecutive rows */
+    int halo; /* number of border pixels kept around the image on every side */
+    bool alignedRows; /* pixel 0 of every row aligned to IMAGE_ROW_ALIGNMENT bytes */
+    T *block; /* all rows (with their halo) stored one after another in a single block */
+    size_t blockSize; /* number of pixels in block */
+    T *image; /* pixel 0,0 inside block */
+
+    /**
+     * Copies pixels and halo of im, which has the same layout as this image.
+     */
+    void copyRowsWithHalo(const Image &im);
 
 public:
     
+    /**
+     * Pixel type.
+     */
+    typedef T PixelType;
+    
     /**
      * Default constructor.
      */
@@ -67,26 +200,58 @@ public:
     Image(const Image &im);
 
     /**
-     * Overloaded copy constructor; makes a binary copy of im.
+     * Move constructor; takes over the pixel buffer of im, which is left empty.
+     */
+    Image(Image &&im) noexcept;
+
+    /**
+     * Overloaded copy constructor; makes a binary copy of im (of any pixel type).
      */
-    Image(const Image &im, bool binaryCopy);
+    template <typename U>
+    Image(const Image<U> &im, bool binaryCopy);
+    
+    /**
+     * Overloaded copy constructor; makes a copy of the pixels of view v (number of colors is 0).
+     */
+    explicit Image(ImageView<const T> v);
     
     /**
      * Destructor.
      */
     ~Image();
 
+    /**
+     * Copy assignment; reuses the current pixel buffer if it has the size of im.
+     */
+    Image &operator=(const Image &im);
+
+    /**
+     * Move assignment; frees the current pixel buffer and takes over the one of im,
+     * which is left empty.
+     */
+    Image &operator=(Image &&im) noexcept;
+
 /**
  * MEMBER FUNCTIONS
  */
 
     /**
      * Sets the size of the image to the given height (# of rows) and width (# of columns);
-     * allocates memory for rows x columns image;
+     * allocates memory for rows x columns image, or keeps the current buffer if it already
+     * holds rows x columns pixels (pixel values are then left as they are);
      * returns: -2 if rows or columns <= 0, -1 if cannot allocate space, rows*columns if success.
      */
     int setSize(int rows, int columns);
 
+    /**
+     * Sets the size of the image like setSize(rows, columns), and keeps haloSize border pixels
+     * around the image on every side: row(i)[j] is valid for -haloSize <= i < rows + haloSize and
+     * -haloSize <= j < columns + haloSize; if alignRows is true, pixel 0 of every row is aligned
+     * to IMAGE_ROW_ALIGNMENT bytes. The halo is not part of the image (getNRows, getNCols, views,
+     * iterators) and is filled by fillHalo.
+     */
+    int setSize(int rows, int columns, int haloSize, bool alignRows);
+
     /**
      * Sets the size of the image to the given height (# of rows) and width (# of columns);
      * allocates memory for rows x columns image;
@@ -95,6 +260,13 @@ public:
      */
     int setSizeAndInitialize(int rows, int columns);
 
+    /**
+     * Sets the size of the image to the size of view v (see setSize) and copies its pixels,
+     * so an image reused for many frames keeps its pixel buffer;
+     * returns: -2 if v is empty, -1 if cannot allocate space, rows*columns if success.
+     */
+    int copyPixels(ImageView<const T> v);
+
     /**
      * Returns the number of columns in the image.
      */
@@ -105,6 +277,96 @@ public:
      */
     int getNRows() const {return Nrows;};
 
+    /**
+     * Returns the number of pixels between the starts of two consecutive rows.
+     */
+    int getStride() const {return stride;};
+
+    /**
+     * Returns the number of border pixels kept around the image on every side.
+     */
+    int getHalo() const {return halo;};
+
+    /**
+     * Returns true if pixel 0 of every row is aligned to IMAGE_ROW_ALIGNMENT bytes.
+     */
+    bool hasAlignedRows() const {return alignedRows;};
+
+    /**
+     * Fills the halo from the pixels of the image according to mode.
+     */
+    void fillHalo(BorderMode mode);
+
+    /**
+     * Returns pointer to the first pixel of row i (no bounds checking);
+     * pixels of the row are contiguous, next row starts getStride() pixels later.
+     */
+    T *row(int i) {return image + i*stride;};
+    const T *row(int i) const {return image + i*stride;};
+
+    /**
+     * Returns reference to pixel at row i and column j (no bounds checking).
+     */
+    T &operator()(int i, int j) {return image[i*stride + j];};
+    const T &operator()(int i, int j) const {return image[i*stride + j];};
+
+    /**
+     * Iterator over all pixels in row-major order (no bounds checking);
+     * steps over the gap between the end of a row and the start of the next one.
+     */
+    template <typename P>
+    class PixelIterator {
+    public:
+        PixelIterator(P *first, int columns, int rowStride)
+            : ptr(first), rowEnd(first + columns), gap(rowStride - columns), stride(rowStride) {};
+        P &operator*() const {return *ptr;};
+        P *operator->() const {return ptr;};
+        PixelIterator &operator++() {
+            if (++ptr == rowEnd) {
+                ptr += gap;
+                rowEnd += stride;
+            }
+            return *this;
+        };
+        bool operator==(const PixelIterator &other) const {return ptr == other.ptr;};
+        bool operator!=(const PixelIterator &other) const {return ptr != other.ptr;};
+    private:
+        P *ptr;
+        P *rowEnd;
+        int gap;
+        int stride;
+    };
+    typedef PixelIterator<T> iterator;
+    typedef PixelIterator<const T> const_iterator;
+
+    /**
+     * Return iterators to the first pixel and past the last pixel of the image.
+     */
+    iterator begin() {return iterator(image, Ncols, stride);};
+    iterator end() {return iterator(image + Nrows*stride, Ncols, stride);};
+    const_iterator begin() const {return const_iterator(image, Ncols, stride);};
+    const_iterator end() const {return const_iterator(image + Nrows*stride, Ncols, stride);};
+
+    /**
+     * Return view of the whole image.
+     */
+    ImageView<T> view() {return ImageView<T>(image, Nrows, Ncols, stride);};
+    ImageView<const T> view() const {return ImageView<const T>(image, Nrows, Ncols, stride);};
+
+    /**
+     * Return view of rows x columns pixels starting at row i and column j, clipped to the image.
+     */
+    ImageView<T> view(int i, int j, int rows, int columns) {return view().subview(i, j, rows, columns);};
+    ImageView<const T> view(int i, int j, int rows, int columns) const {return view().subview(i, j, rows, columns);};
+
+    /**
+     * Returns pointer to pixel 0,0 or NULL if size has not been set; row i starts
+     * i*getStride() pixels later (rows are contiguous only if getHalo() is 0 and
+     * the rows are not aligned).
+     */
+    T *getData() {return image;};
+    const T *getData() const {return image;};
+
     /**
      * Sets and returns rho shift value.
      */
@@ -151,114 +413,1156 @@ public:
 };
 
 /**
- * FUNCTIONS FOR READ-WRITE OF PGM IMAGES
+ * Returns the number of pixel blocks allocated by setSize so far (in all threads).
  */
+unsigned long getImageAllocationCount();
 
 /**
- * Reads image from fname;
- * returns 0 if OK or -1 if something goes wrong.
+ * Row kernels of the thresholding functions and of binary copies. The overloads for uint8_t
+ * and int32_t pixels use SSE2 or AVX2 instructions, the best the CPU has (checked once at run
+ * time), and give exactly the results of the scalar loops of the templates, which are used
+ * for the other pixel types and for the ends of rows.
  */
-int readImage(Image *im, const char *fname);
 
 /**
- * Reads image from fname, thresholds and saves as binary image in Image object im;
- * returns 0 if OK or -1 if something goes wrong. 
+ * Sets the pixels of a row of nCols pixels that are not greater than threshold to 0.
  */
-int readAsBinaryImage(Image *im, const char *fname, int threshold);
+template <typename T>
+void thresholdRow(T *pixels, int nCols, int threshold) {
+    for (int j=0; j<nCols; j++) {
+        if (int(pixels[j])<=threshold) {
+            pixels[j] = 0;
+        }
+    }
+}
+void thresholdRow(uint8_t *pixels, int nCols, int threshold);
+void thresholdRow(int32_t *pixels, int nCols, int threshold);
 
 /**
- * Reads binary image from fname, saves labeled binary image in Image object im;
- * returns 0 if OK or -1 if something goes wrong.
+ * Sets the pixels of a row of nCols pixels that are greater than threshold to 1, the others to 0.
  */
-int readAndLabelBinaryImage(Image *im, const char *fname);
+template <typename T>
+void binarizeRow(T *pixels, int nCols, int threshold) {
+    for (int j=0; j<nCols; j++) {
+        pixels[j] = (int(pixels[j])<=threshold) ? 0 : 1;
+    }
+}
+void binarizeRow(uint8_t *pixels, int nCols, int threshold);
+void binarizeRow(int32_t *pixels, int nCols, int threshold);
 
 /**
- * Labels binary Image object im.
+ * Copies a row of nCols pixels from src to dst as 0's and 1's: pixels other than 0 become 1.
  */
-int labelBinaryImage(Image *im);
+template <typename T, typename U>
+void copyBinaryRow(const U *src, int nCols, T *dst) {
+    for (int j=0; j<nCols; j++) {
+        dst[j] = (src[j]==0) ? 0 : 1;
+    }
+}
+void copyBinaryRow(const uint8_t *src, int nCols, uint8_t *dst);
+void copyBinaryRow(const int32_t *src, int nCols, int32_t *dst);
 
 /**
- * Reads labeled image from fname, saves objects' info in db Database;
- * returns 0 if OK or -1 if something goes wrong. 
+ * Packs a row of nCols pixels into words, 64 per word with pixel j in bit j % 64 (rows of
+ * BinaryImage); pixels greater than threshold are 1, the padding bits of the last word are 0.
  */
-int readLabeledImage(Image *im, const char *filename, Database &db);
+template <typename T>
+void packBinaryRow(const T *pixels, int nCols, int threshold, uint64_t *words) {
+    for (int j=0; j<nCols; j+=64) {
+        const T *p = pixels + j;
+        int n = (nCols - j < 64) ? nCols - j : 64;
+        uint64_t word = 0;
+        for (int k=0; k<n; k++) {
+            word |= uint64_t(int(p[k]) > threshold) << k;
+        }
+        words[j >> 6] = word;
+    }
+}
+void packBinaryRow(const uint8_t *pixels, int nCols, int threshold, uint64_t *words);
 
 /**
- * Reads image from fname, tresholds, and saves as grey-level image in Image object im;
- * returns 0 if OK or -1 if something goes wrong.
+ * Returns the instruction set used by the row kernels: "avx2", "sse2" or "scalar".
  */
-int readAndThresholdImage(Image *im, const char *filename, int threshold);
+const char *getRowKernelInstructionSet();
 
 /**
- * Thresholds object im.
+ * Histogram of the gray levels of an image, with a bin for every sample value of its file: 256
+ * bins, or 65536 for images with more than 255 gray levels. Pixel j of a row is counted in
+ * partial histogram j % 4, so that runs of pixels of the same gray level do not wait on each
+ * other's counter updates; the partial histograms are added up when the counts are read.
  */
-int thresholdImage(Image *im, int threshold);
+class Histogram {
 
-/**
- * Thresholds Image object im and makes it binary.
- */
-int thresholdAndMakeBinaryImage(Image *im, int threshold);
+private:
+    
+    int Nbins; /* number of bins */
+    std::vector<uint32_t> partial; /* 4 partial histograms of Nbins bins, one after another */
+    std::vector<uint64_t> counts; /* sum of the partial histograms */
+    bool summed; /* counts holds the sum of the partial histograms */
 
-/**
- * Filters im using Gaussian mask 1/16 [1, 4, 6, 4, 1].
- */
-int apply5x5GaussianFilter(Image *im);
+public:
+    
+    /**
+     * Default constructor; no bins (reset has to be called before counting pixels).
+     */
+    Histogram() : Nbins(0), summed(true) {};
+    
+    /**
+     * Sets the bins for the pixels of an image with levels gray levels and sets all counts to 0.
+     */
+    void reset(int levels);
+    
+    /**
+     * Returns the number of bins.
+     */
+    int getNBins() const {return Nbins;};
+    
+    /**
+     * Counts a row of nCols pixels; pixels outside of the bins are counted in the first or the last bin.
+     */
+    template <typename T>
+    void addRow(const T *pixels, int nCols) {
+        for (int j=0; j<nCols; j++) {
+            int value = int(pixels[j]);
+            value = (value < 0) ? 0 : (value >= Nbins) ? Nbins - 1 : value;
+            partial[size_t(j & 3) * Nbins + value]++;
+        }
+        summed = false;
+    };
+    void addRow(const uint8_t *pixels, int nCols);
+    
+    /**
+     * Returns the number of pixels of every gray level.
+     */
+    const std::vector<uint64_t> &getCounts();
+    
+    /**
+     * Returns the threshold that separates the pixels into the two classes of least variance
+     * (Otsu's method): pixels not greater than the threshold are one class.
+     */
+    int getOtsuThreshold();
+    
+    /**
+     * Returns the lowest threshold such that percent % of the pixels are not greater than it.
+     */
+    int getPercentileThreshold(double percent);
+};
 
 /**
- * Scales pixel values if there are values greater than 255;
- * maxPixelValue is the max value in image im.
+ * Threshold given on the command line: a gray level such as "120", or "auto" to choose it for
+ * every image from the image's histogram with Otsu's method, or "auto:P" to choose it as the
+ * P-th percentile of the gray levels (with "auto:90" the brightest 10% of the pixels are above it).
  */
-int scalePixelValues(Image *im, int maxPixelValue);
+class Threshold {
 
-/**
- * Applies Laplacian operator to image im, saves result in output.
- */
-int applyLaplacian(Image *im, Image *output);
+private:
+    
+    enum Mode {FIXED, OTSU, PERCENTILE};
+    
+    Mode mode; /* how the threshold is chosen */
+    int level; /* the fixed threshold */
+    double percent; /* the percentile */
+
+public:
+    
+    /**
+     * Fixed threshold value; gray levels convert to Threshold, so they can be given directly
+     * to the functions that take a Threshold.
+     */
+    Threshold(int value = 0) : mode(FIXED), level(value), percent(0) {};
+    
+    /**
+     * Sets the threshold from arg: a gray level, "auto" or "auto:P" with P between 0 and 100;
+     * returns 0 if OK or -1 if arg is none of these.
+     */
+    int parse(const char *arg);
+    
+    /**
+     * Returns true if the threshold is chosen from the histogram of every image.
+     */
+    bool isAuto() const {return mode!=FIXED;};
+    
+    /**
+     * Returns the fixed threshold, or the threshold chosen from histogram (printed on stderr).
+     */
+    int choose(Histogram &histogram) const;
+};
 
 /**
- * Applies Sobel operator to image im, saves result in output.
+ * Returns the scratch pool of images of pixel type T of the calling thread.
  */
-int applySobelOperator(Image *im, Image *output);
+template <typename T>
+std::vector<Image<T> > &scratchImagePool() {
+    static thread_local std::vector<Image<T> > pool;
+    return pool;
+}
 
 /**
- * Applies Hough transform to image im, saves result in output;
- * numOfRhoUnits = int(sqrt(pow(nRows,2)+pow(nCols,2)) + 0.5) pixels;
- * rho space equals 3*numOfRhoUnits
- * rho values are shifted by numOfRhoUnits to acomodate negative values;
- * numOtThetaUnits = 180 * 5 = PI = 180 degrees.
+ * Temporary image borrowed from the scratch pool of the calling thread and given back when
+ * the object goes out of scope; kernels use it instead of allocating temporaries, so repeated
+ * calls on images of the same size reuse the same pixel blocks. Pixels and halo are not initialized.
  */
-int HoughTransform(Image *im, Image *output);
+template <typename T>
+class ScratchImage {
+
+private:
+    
+    Image<T> im;
+    
+    ScratchImage(const ScratchImage &); /* not copyable */
+    ScratchImage &operator=(const ScratchImage &);
+
+public:
+    
+    /**
+     * Borrows an image and sets its size (see Image::setSize); an image that already has
+     * this layout is preferred.
+     */
+    ScratchImage(int rows, int columns, int haloSize = 0, bool alignRows = false) {
+        std::vector<Image<T> > &pool = scratchImagePool<T>();
+        size_t k = 0;
+        for (size_t n = 0; n < pool.size(); n++) {
+            if (pool[n].getNRows() == rows && pool[n].getNCols() == columns
+                && pool[n].getHalo() == haloSize && pool[n].hasAlignedRows() == alignRows) {
+                k = n;
+                break;
+            }
+        }
+        if (!pool.empty()) {
+            im = std::move(pool[k]);
+            pool.erase(pool.begin() + k);
+        }
+        im.setSize(rows, columns, haloSize, alignRows);
+    };
+    
+    /**
+     * Gives the image back to the pool.
+     */
+    ~ScratchImage() {
+        scratchImagePool<T>().push_back(std::move(im));
+    };
+    
+    /**
+     * Returns the borrowed image.
+     */
+    Image<T> &image() {return im;};
+};
 
 /**
- * Sets rho shift value for Hough image of im.
+ * Returns the number of bits of word that are 1.
  */
-int setRhoShiftForHoughImage(Image *im, Image *Hough);
+inline int countBits(uint64_t word) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(word);
+#else
+    int n = 0;
+    for (; word; word &= word - 1) {
+        n++;
+    }
+    return n;
+#endif
+}
 
 /**
- * Finds "areas of brightness" in grey-level thresholded Hough image, saves results in db.
+ * Returns the index of the lowest bit of word that is 1; word must not be 0.
  */
-int findLocalMaxima(Image *Hough, HoughDatabase &db);
+inline int countTrailingZeros(uint64_t word) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    int n = 0;
+    for (; !(word & 1); word >>= 1) {
+        n++;
+    }
+    return n;
+#endif
+}
 
 /**
- * Draws objects' positions and orientations in the image in black (0).
+ * Binary image packed 1 bit per pixel in 64-bit words: pixel j of a row is bit j % 64 of word
+ * j / 64 of the row. Every row starts at a new word; padding bits at the end of a row are 0.
+ * Whole words are combined by the logical operations, counted with popcount and scanned with
+ * count-trailing-zeros, so 64 pixels of background are skipped at a time. PBM (P4) files,
+ * which hold 8 pixels per byte with the leftmost one in the most significant bit, are
+ * converted when they are read and written.
  */
-int addPositionAndOrientation(Image *im, Database &db, bool recognizedOnly);
+class BinaryImage {
+
+private:
+    
+    int Nrows; /* number of rows */
+    int Ncols; /* number of columns */
+    int wordsPerRow; /* (Ncols + 63) / 64 */
+    std::vector<uint64_t> words; /* all rows stored one after another */
+
+public:
+    
+    /**
+     * Default constructor; empty image.
+     */
+    BinaryImage() : Nrows(0), Ncols(0), wordsPerRow(0) {};
+    
+    /**
+     * Sets the size of the image to rows x columns and sets all pixels to 0;
+     * returns rows*columns if OK or a negative value if the size is invalid.
+     */
+    int setSize(int rows, int columns);
+    
+    /**
+     * Return size of the image and the number of words of every row.
+     */
+    int getNRows() const {return Nrows;};
+    int getNCols() const {return Ncols;};
+    int getWordsPerRow() const {return wordsPerRow;};
+    
+    /**
+     * Returns pointer to the first word of row i (no bounds checking).
+     */
+    uint64_t *row(int i) {return &words[size_t(i) * wordsPerRow];};
+    const uint64_t *row(int i) const {return &words[size_t(i) * wordsPerRow];};
+    
+    /**
+     * Returns/sets pixel at row i and column j (no bounds checking).
+     */
+    bool get(int i, int j) const {return (row(i)[j >> 6] >> (j & 63)) & 1;};
+    void set(int i, int j, bool value) {
+        uint64_t mask = uint64_t(1) << (j & 63);
+        uint64_t &word = row(i)[j >> 6];
+        word = value ? (word | mask) : (word & ~mask);
+    };
+    
+    /**
+     * Returns the pixel at row i and column j (0 or 1) or -1 if (i,j) is outside the image,
+     * like Image::getPixel.
+     */
+    int getPixel(int i, int j) const;
+    
+    /**
+     * Sets padding bits at the end of every row to 0.
+     */
+    void clearPadding();
+    
+    /**
+     * Returns the number of pixels that are 1 (the area of the objects).
+     */
+    long countPixels() const;
+    
+    /**
+     * Sets every pixel to the AND, OR or exclusive OR of itself and the pixel of other at the
+     * same position; returns 0 if OK or -1 if other has another size.
+     */
+    int andWith(const BinaryImage &other);
+    int orWith(const BinaryImage &other);
+    int xorWith(const BinaryImage &other);
+    
+    /**
+     * Inverts every pixel (NOT).
+     */
+    void invert();
+    
+    /**
+     * Moves every pixel n columns to the right (to the left if n is negative); pixels moved
+     * out of the image are lost, the columns left empty are 0.
+     */
+    void shiftColumns(int n);
+    
+    /**
+     * Moves every pixel n rows down (up if n is negative); pixels moved out of the image are
+     * lost, the rows left empty are 0.
+     */
+    void shiftRows(int n);
+    
+    /**
+     * Calls f(j) with the column j of every pixel of row i that is 1, from left to right.
+     */
+    template <typename F>
+    void forEachPixelInRow(int i, F f) const {
+        const uint64_t *w = row(i);
+        for (int k=0; k<wordsPerRow; k++) {
+            for (uint64_t bits = w[k]; bits; bits &= bits - 1) {
+                f((k << 6) + countTrailingZeros(bits));
+            }
+        }
+    };
+    
+    /**
+     * Calls f(i, j) with the row i and column j of every pixel that is 1, row by row.
+     */
+    template <typename F>
+    void forEachPixel(F f) const {
+        for (int i=0; i<Nrows; i++) {
+            forEachPixelInRow(i, [&](int j) {f(i, j);});
+        }
+    };
+};
 
 /**
- * Draws detected lines in image im.
+ * Binary image stored as runs: a run is the pixels start..end (both included) of one row that
+ * are 1, and the runs of row i are row(i)[0] .. row(i)[getNumberOfRuns(i)-1], left to right.
+ * A run takes 8 bytes however long it is, so object masks, which are mostly long horizontal
+ * runs, are labeled and measured a run at a time instead of a pixel at a time.
  */
-int drawLines(Image *im, HoughDatabase &db);
+class RunLengthImage {
 
-/**
- * Draws detected line segments in image im.
+public:
+
+    struct Run {
+        int start; /* first column of the run */
+        int end; /* last column of the run */
+    };
+
+private:
+
+    int Nrows; /* number of rows */
+    int Ncols; /* number of columns */
+    std::vector<Run> runs; /* runs of all rows, row by row */
+    std::vector<int> firstRun; /* runs of row i are runs[firstRun[i]] .. runs[firstRun[i+1]-1] */
+
+public:
+
+    /**
+     * Default constructor; empty image.
+     */
+    RunLengthImage() : Nrows(0), Ncols(0) {};
+
+    /**
+     * Sets the runs to those of binary image im, found 64 pixels at a time with
+     * count-trailing-zeros; returns the number of runs.
+     */
+    int encode(const BinaryImage &im);
+
+    /**
+     * Appends the runs of a row of columns pixels, packed like a row of BinaryImage (padding
+     * bits 0), to rowRuns; returns the number of runs appended.
+     */
+    static int encodeRow(const uint64_t *words, int columns, std::vector<Run> &rowRuns);
+
+    /**
+     * Sets binary image im to the pixels of the runs; returns 0 if OK or -1 if the image is
+     * empty.
+     */
+    int decode(BinaryImage *im) const;
+
+    /**
+     * Return size of the image.
+     */
+    int getNRows() const {return Nrows;};
+    int getNCols() const {return Ncols;};
+
+    /**
+     * Return the number of runs of the image or of row i.
+     */
+    int getNumberOfRuns() const {return int(runs.size());};
+    int getNumberOfRuns(int i) const {return firstRun[i+1] - firstRun[i];};
+
+    /**
+     * Returns pointer to the first run of row i (no bounds checking); runs of the following
+     * rows come right after it, so getNumberOfRuns() runs start at row(0).
+     */
+    const Run *row(int i) const {return runs.data() + firstRun[i];};
+
+    /**
+     * Returns the number of pixels that are 1 (the area of the objects).
+     */
+    long countPixels() const;
+};
+
+/**
+ * Labeler of a binary image that arrives row by row and may never end, such as the rows of a
+ * line-scan camera: rows are labeled like labelRuns, keeping only the runs of the previous row
+ * and the sums of the objects that touch it, so memory is O(width + live objects). An object
+ * that has no pixel in the current row can't grow any more; its properties are calculated like
+ * Database::calculateProperties and it is passed to the callback right away, one row after its
+ * last pixel, e.g. to be recognized with Database::recognizeObject.
+ */
+class StreamingLabeler {
+
+public:
+
+    /**
+     * Called with the record of every finished object; rowCenter is the row number since
+     * start, the sums of i are taken from the first row of the object.
+     */
+    typedef std::function<void(const Database::Record &)> Callback;
+
+private:
+
+    struct LabeledRun {
+        int start; /* first column of the run */
+        int end; /* last column of the run */
+        int object; /* slot of the object of the run */
+    };
+
+    int Ncols; /* number of columns */
+    int rowIndex; /* number of the next row */
+    Callback callback; /* called with every finished object */
+    std::vector<LabeledRun> above, current; /* runs of the previous and of the current row */
+    std::vector<RunLengthImage::Run> rowRuns; /* runs of a packed row */
+    std::vector<Database::Record> objects; /* sums of the live objects, by slot */
+    std::vector<int> firstRow; /* first row of the object of every slot */
+    std::vector<int> lastRow; /* last row with a pixel of the object of every slot */
+    std::vector<int> parent; /* slot an object was merged into during the current row, or itself */
+    std::vector<int> freeSlots; /* slots of finished and merged objects, reused for new objects */
+    std::vector<int> merged; /* slots merged into others during the current row */
+    int numOfLiveObjects; /* number of objects not finished yet */
+    long numOfFinishedObjects; /* number of objects passed to the callback since start */
+
+    /**
+     * Returns the slot of a new object whose first row is the current one.
+     */
+    int newObject();
+
+    /**
+     * Returns the slot of the live object that the object of slot has been merged into.
+     */
+    int findObject(int slot);
+
+    /**
+     * Merges two live objects into the one that started first; returns its slot.
+     */
+    int mergeObjects(int slot1, int slot2);
+
+    /**
+     * Calculates the properties of a live object, passes it to the callback and frees its slot.
+     */
+    void finishObject(int slot);
+
+public:
+
+    /**
+     * Default constructor; start must be called before the first row.
+     */
+    StreamingLabeler() : Ncols(0), rowIndex(0), numOfLiveObjects(0), numOfFinishedObjects(0) {};
+
+    /**
+     * Starts a new stream of rows of columns pixels; objects finished by addRow and finish are
+     * passed to callback. Returns 0 if OK or -1 if columns is not positive.
+     */
+    int start(int columns, Callback finished);
+
+    /**
+     * Labels the next row, given as its runs (left to right) or packed like a row of
+     * BinaryImage; returns the number of objects finished by this row.
+     */
+    int addRow(const RunLengthImage::Run *runs, int numOfRuns);
+    int addRow(const uint64_t *words);
+
+    /**
+     * Ends the stream: the objects of the last row are finished too; returns their number.
+     */
+    int finish();
+
+    /**
+     * Return the number of rows labeled since start, of the objects not finished yet and of
+     * the objects finished since start.
+     */
+    int getNumberOfRows() const {return rowIndex;};
+    int getNumberOfLiveObjects() const {return numOfLiveObjects;};
+    long getNumberOfFinishedObjects() const {return numOfFinishedObjects;};
+};
+
+/**
+ * FUNCTIONS FOR READ-WRITE OF PGM IMAGES
+ */
+
+/**
+ * Opens fname like fopen; "-" stands for stdin (modes starting with 'r') or stdout (other modes),
+ * so images and text files can be piped from one program to the next. Messages of the functions
+ * below go to stderr, so they never mix with data written to stdout;
+ * returns the file or NULL if it cannot be opened.
+ */
+FILE *openFile(const char *fname, const char *mode);
+
+/**
+ * Closes file opened by openFile; stdin and stdout are left open (stdout is flushed);
+ * returns 0 if OK or EOF if something goes wrong.
+ */
+int closeFile(FILE *file);
+
+/**
+ * Reads the header of a binary PGM image ("P5", width, height and # of gray levels,
+ * separated by white space and possibly comments) from input, leaves input at the first pixel;
+ * returns 0 if OK or -1 if something goes wrong.
+ */
+int readPgmHeader(FILE *input, int &nRows, int &nCols, int &levels);
+
+/**
+ * Reads the header of a binary PGM ("P5") or PBM ("P4") image from input, leaves input at
+ * the first pixel; format is set to 5 or 4, levels to 1 for PBM images (they have no # of
+ * gray levels in the header);
+ * returns 0 if OK or -1 if something goes wrong.
+ */
+int readPnmHeader(FILE *input, int &format, int &nRows, int &nCols, int &levels);
+
+/**
+ * Skips the white space after an image of input; several images may be concatenated in one
+ * file or stream (a multi-image PGM stream) and read one after another with the functions
+ * below that take an open file;
+ * returns 1 if another image follows or 0 at the end of input.
+ */
+int hasNextImage(FILE *input);
+
+/**
+ * Reads getNRows() x getNCols() pixels from input into im, a whole row (or the whole image if
+ * rows are contiguous) per fread; pixels of images with more than 255 gray levels are 16-bit,
+ * most significant byte first; if histogram is not NULL, it is set to the histogram of the
+ * pixels, counted row by row as they are read;
+ * returns 0 if OK or -1 if the file is short.
+ */
+template <typename T>
+int readPgmPixels(FILE *input, Image<T> *im, int levels, Histogram *histogram = NULL);
+
+/**
+ * Read-only PGM image mapped into memory by mapPgm: the pixels are used in place, directly
+ * from the mapped file, and stay valid until the object is destroyed or mapped again.
+ */
+class MappedPgm {
+
+private:
+    
+    void *mapping; /* mapped file or NULL */
+    size_t mappingSize; /* size of the mapping in bytes */
+    Image<uint8_t> copy; /* pixels read into memory if the file cannot be mapped */
+    ImageView<const uint8_t> pixels; /* pixels of the image */
+    int Ncolors; /* number of gray level colors */
+    
+    MappedPgm(const MappedPgm &); /* not copyable */
+    MappedPgm &operator=(const MappedPgm &);
+    
+    friend int mapPgm(MappedPgm *pgm, const char *fname);
+    friend int mapPgm(MappedPgm *pgm, FILE *input);
+
+public:
+    
+    /**
+     * Default constructor; no image.
+     */
+    MappedPgm();
+    
+    /**
+     * Destructor; unmaps the file.
+     */
+    ~MappedPgm();
+    
+    /**
+     * Unmaps the file; leaves no image.
+     */
+    void unmap();
+    
+    /**
+     * Returns read-only view of the pixels.
+     */
+    ImageView<const uint8_t> view() const {return pixels;};
+    
+    /**
+     * Return size of the image and the number of gray level colors.
+     */
+    int getNRows() const {return pixels.getNRows();};
+    int getNCols() const {return pixels.getNCols();};
+    int getColors() const {return Ncolors;};
+};
+
+/**
+ * Maps 8-bit binary PGM image fname into memory (or reads it, if fname cannot be mapped);
+ * returns 0 if OK or -1 if something goes wrong.
+ */
+int mapPgm(MappedPgm *pgm, const char *fname);
+
+/**
+ * Maps the next 8-bit binary PGM image of input into memory and leaves input at the end of the
+ * image; images of pipes and stdin are read instead of mapped;
+ * returns 0 if OK or -1 if something goes wrong.
+ */
+int mapPgm(MappedPgm *pgm, FILE *input);
+
+/**
+ * Reads a binary PGM image a band of rows at a time, so images larger than memory can be
+ * processed with buffers proportional to their width; rows are read as they arrive, which
+ * also works on pipes and stdin.
+ */
+class PgmRowReader {
+
+private:
+    
+    FILE *input; /* stream positioned at the next row or NULL */
+    bool ownsInput; /* input was opened by open(fname) and is closed by close() */
+    int Nrows; /* number of rows of the image */
+    int Ncols; /* number of columns of the image */
+    int Ncolors; /* number of gray level colors */
+    int nextRow; /* number of rows read so far */
+    
+    PgmRowReader(const PgmRowReader &); /* not copyable */
+    PgmRowReader &operator=(const PgmRowReader &);
+
+public:
+    
+    /**
+     * Default constructor; no image.
+     */
+    PgmRowReader();
+    
+    /**
+     * Destructor; closes the image.
+     */
+    ~PgmRowReader();
+    
+    /**
+     * Opens PGM image fname ("-" is stdin), or reads the header of a PGM image from stream input (which is
+     * left open by close), and leaves the reader at the first row;
+     * returns 0 if OK or -1 if something goes wrong.
+     */
+    int open(const char *fname);
+    int open(FILE *stream);
+    
+    /**
+     * Reads the next rows of the image into band, at most maxRows of them: sets the size of band
+     * to the number of rows read x getNCols() and its number of colors to getColors();
+     * returns the number of rows read, 0 after the last row, or -1 if something goes wrong.
+     */
+    template <typename T>
+    int readRows(Image<T> *band, int maxRows);
+    
+    /**
+     * Closes the image.
+     */
+    void close();
+    
+    /**
+     * Return size of the image, the number of gray level colors and the number of rows read so far.
+     */
+    int getNRows() const {return Nrows;};
+    int getNCols() const {return Ncols;};
+    int getColors() const {return Ncolors;};
+    int getNextRow() const {return nextRow;};
+};
+
+/**
+ * Writes a binary PGM image a band of rows at a time; the counterpart of PgmRowReader.
+ */
+class PgmRowWriter {
+
+private:
+    
+    FILE *output; /* stream positioned at the next row or NULL */
+    bool ownsOutput; /* output was opened by open(fname) and is closed by close() */
+    int Nrows; /* number of rows of the image */
+    int Ncols; /* number of columns of the image */
+    int Ncolors; /* number of gray level colors */
+    int nextRow; /* number of rows written so far */
+    
+    PgmRowWriter(const PgmRowWriter &); /* not copyable */
+    PgmRowWriter &operator=(const PgmRowWriter &);
+
+public:
+    
+    /**
+     * Default constructor; no image.
+     */
+    PgmRowWriter();
+    
+    /**
+     * Destructor; closes the image.
+     */
+    ~PgmRowWriter();
+    
+    /**
+     * Creates PGM image fname ("-" is stdout), or starts a PGM image on stream output (which is left open by
+     * close), of rows x columns pixels and colors gray levels, and writes its header (like
+     * writeImage, images with more than 255 colors get 16-bit pixels);
+     * returns 0 if OK or -1 if something goes wrong.
+     */
+    int open(const char *fname, int rows, int columns, int colors);
+    int open(FILE *stream, int rows, int columns, int colors);
+    
+    /**
+     * Writes the rows of band, which has getNCols() columns, after the rows written so far;
+     * returns 0 if OK or -1 if something goes wrong (or the image would get too many rows).
+     */
+    template <typename T>
+    int writeRows(ImageView<const T> band);
+    
+    /**
+     * Closes the image;
+     * returns 0 if OK or -1 if not all rows were written or the image cannot be written.
+     */
+    int close();
+    
+    /**
+     * Return size of the image and the number of rows written so far.
+     */
+    int getNRows() const {return Nrows;};
+    int getNCols() const {return Ncols;};
+    int getNextRow() const {return nextRow;};
+};
+
+/**
+ * Reads image from fname (PGM, or PBM which is read as 0's and 1's with 1 color);
+ * returns 0 if OK or -1 if something goes wrong.
+ */
+template <typename T>
+int readImage(Image<T> *im, const char *fname);
+
+/**
+ * Reads the next image of input like readImage(im, fname) and leaves input at the end of the image.
+ */
+template <typename T>
+int readImage(Image<T> *im, FILE *input);
+
+/**
+ * Reads image from fname, thresholds and saves as binary image in Image object im; an automatic
+ * threshold is chosen from the histogram counted while the image is read;
+ * returns 0 if OK or -1 if something goes wrong. 
+ */
+template <typename T>
+int readAsBinaryImage(Image<T> *im, const char *fname, const Threshold &threshold);
+
+/**
+ * Reads the next image of input like readAsBinaryImage(im, fname, threshold).
+ */
+template <typename T>
+int readAsBinaryImage(Image<T> *im, FILE *input, const Threshold &threshold);
+
+/**
+ * Reads PGM image from fname and thresholds it (pixels greater than threshold are 1), or reads
+ * PBM image from fname, into packed binary image im; rows are packed as they are read, except
+ * with an automatic threshold, which needs the histogram of the whole image first;
+ * returns 0 if OK or -1 if something goes wrong.
+ */
+int readAsBinaryImage(BinaryImage *im, const char *fname, const Threshold &threshold);
+
+/**
+ * Reads the next image of input like readAsBinaryImage(im, fname, threshold).
+ */
+int readAsBinaryImage(BinaryImage *im, FILE *input, const Threshold &threshold);
+
+/**
+ * Reads binary image (PBM, or PGM with 1 color) from fname, saves labeled binary image in Image object im;
+ * returns 0 if OK or -1 if something goes wrong.
+ */
+template <typename T>
+int readAndLabelBinaryImage(Image<T> *im, const char *fname);
+
+/**
+ * Reads the next image of input like readAndLabelBinaryImage(im, fname).
+ */
+template <typename T>
+int readAndLabelBinaryImage(Image<T> *im, FILE *input);
+
+/**
+ * Labels binary Image object im; pixels are labeled in blocks of 2 rows x 1 column, whose pixels
+ * that are 1 always belong to one object, and objects are numbered in the order of their first
+ * pixels.
+ */
+template <typename T>
+int labelBinaryImage(Image<T> *im);
+
+/**
+ * Labels binary Image object im like labelBinaryImage(im) on numThreads threads (0: one per
+ * core): horizontal strips of the image are labeled at the same time, each with labels of its
+ * own, then the objects that touch across strip boundaries are merged. With canonicalLabels
+ * the objects are numbered exactly like labelBinaryImage(im) numbers them; otherwise they are
+ * the same objects, numbered in another order. Images too small to split are labeled by
+ * labelBinaryImage(im).
+ */
+template <typename T>
+int labelBinaryImageParallel(Image<T> *im, int numThreads = 0, bool canonicalLabels = true);
+
+/**
+ * Labels packed binary image binary like labelBinaryImage(im), saves labeled image in Image
+ * object im; the image is encoded as runs, 64 columns of background at a time, and labeled
+ * like labelBinaryImage(runs, im).
+ */
+template <typename T>
+int labelBinaryImage(const BinaryImage *binary, Image<T> *im);
+
+/**
+ * Labels the runs of run-length image runs like labelBinaryImage(im) labels pixels: labels[r]
+ * is set to the label of run r (counted row by row from runs.row(0)) and objects are numbered
+ * from 1 in the order of their first pixels. A run joins the runs of the row above that hold
+ * the N or NW neighbour of one of its pixels, found by one merge of the runs of both rows;
+ * returns the number of objects.
+ */
+int labelRuns(const RunLengthImage &runs, std::vector<int> &labels);
+
+/**
+ * Labels run-length image runs like labelBinaryImage(im), saves labeled image in Image object
+ * im; every run is labeled once and filled with its label.
+ */
+template <typename T>
+int labelBinaryImage(const RunLengthImage *runs, Image<T> *im);
+
+/**
+ * Labels packed binary image binary like labelBinaryImage(binary, im), saves labeled image in
+ * Image object im and objects' info in db Database in the same pass over the runs, so the
+ * labels need not be written and read back to measure the objects;
+ * returns 0 if OK or -1 if something goes wrong.
+ */
+template <typename T>
+int labelAndMeasureBinaryImage(const BinaryImage *binary, Image<T> *im, Database &db);
+
+/**
+ * Reads labeled image (8-, 16- or 32-bit, see writeLabeledImage) from fname, saves objects'
+ * info in db Database; a binary image (PBM, or PGM with 1 color) is labeled like
+ * labelAndMeasureBinaryImage;
+ * returns 0 if OK or -1 if something goes wrong. 
+ */
+template <typename T>
+int readLabeledImage(Image<T> *im, const char *filename, Database &db);
+
+/**
+ * Reads the next image of input like readLabeledImage(im, fname, db).
+ */
+template <typename T>
+int readLabeledImage(Image<T> *im, FILE *input, Database &db);
+
+/**
+ * Reads image from fname, tresholds, and saves as grey-level image in Image object im; an
+ * automatic threshold is chosen from the histogram counted while the image is read;
+ * returns 0 if OK or -1 if something goes wrong.
+ */
+template <typename T>
+int readAndThresholdImage(Image<T> *im, const char *filename, const Threshold &threshold);
+
+/**
+ * Thresholds object im (or the pixels of view im).
+ */
+template <typename T>
+int thresholdImage(Image<T> *im, int threshold);
+template <typename T>
+int thresholdImage(ImageView<T> im, int threshold);
+
+/**
+ * Thresholds Image object im (or the pixels of view im) and makes it binary.
+ */
+template <typename T>
+int thresholdAndMakeBinaryImage(Image<T> *im, int threshold);
+template <typename T>
+int thresholdAndMakeBinaryImage(ImageView<T> im, int threshold);
+
+/**
+ * Thresholds image im into packed binary image output (pixels greater than threshold are 1).
+ */
+template <typename T>
+int thresholdAndMakeBinaryImage(ImageView<const T> im, int threshold, BinaryImage *output);
+
+/**
+ * Filters im using Gaussian mask 1/16 [1, 4, 6, 4, 1]; pixels outside of im are treated as 0.
+ */
+template <typename T>
+int apply5x5GaussianFilter(Image<T> *im);
+template <typename T>
+int apply5x5GaussianFilter(ImageView<T> im);
+
+/**
+ * Scales pixel values if there are values greater than 255;
+ * maxPixelValue is the max value in image im.
+ */
+template <typename T>
+int scalePixelValues(Image<T> *im, int maxPixelValue);
+template <typename T>
+int scalePixelValues(ImageView<T> im, int maxPixelValue);
+
+/**
+ * Applies Laplacian operator to image im, saves result in output;
+ * the view version expects output of the same size as im (returns -1 otherwise).
+ */
+template <typename T, typename U>
+int applyLaplacian(Image<T> *im, Image<U> *output);
+template <typename T, typename U>
+int applyLaplacian(ImageView<const T> im, ImageView<U> output);
+
+/**
+ * Applies Sobel operator to image im, saves result in output;
+ * the view version expects output of the same size as im (returns -1 otherwise).
+ */
+template <typename T, typename U>
+int applySobelOperator(Image<T> *im, Image<U> *output);
+template <typename T, typename U>
+int applySobelOperator(ImageView<const T> im, ImageView<U> output);
+
+/**
+ * Applies the 5x5 Gaussian filter of apply5x5GaussianFilter to an image that arrives a band
+ * of rows at a time, keeping only 5 rows of state. Every output row is produced once the 2
+ * rows below it have arrived; the last 2 rows are produced by finish. The rows produced are
+ * identical to the ones of apply5x5GaussianFilter on the whole image.
+ */
+template <typename T>
+class GaussianRowFilter {
+
+private:
+    
+    int Ncols; /* number of columns of the image */
+    int rowsIn; /* number of rows received so far */
+    int rowsOut; /* number of rows produced so far */
+    Image<T> padded; /* current input row with a zero halo of 2 pixels */
+    Image<T> filtered; /* last 5 rows filtered along the row, row k in row k % 5 */
+    Image<T> zeros; /* row of 0's for the rows above and below the image */
+    
+    void produceRow(T *dst);
+
+public:
+    
+    /**
+     * Default constructor; call start before filtering.
+     */
+    GaussianRowFilter() : Ncols(0), rowsIn(0), rowsOut(0) {};
+    
+    /**
+     * Starts filtering an image of the given number of columns;
+     * returns 0 if OK or -1 if columns <= 0.
+     */
+    int start(int columns);
+    
+    /**
+     * Filters the next rows of the image (band) and stores the rows that are finished in the
+     * first rows of out, which has at least as many rows as band (out may be band itself);
+     * returns the number of rows stored in out or -1 if the sizes do not match.
+     */
+    int filterRows(ImageView<const T> band, ImageView<T> out);
+    
+    /**
+     * Stores the remaining rows of the image (at most 2) in the first rows of out;
+     * returns the number of rows stored in out or -1 if out is too small.
+     */
+    int finish(ImageView<T> out);
+};
+
+/**
+ * Operators of 3x3 stencils applied a band of rows at a time.
+ */
+enum StencilOperator {SOBEL_OPERATOR, LAPLACIAN_OPERATOR};
+
+/**
+ * Applies the Sobel or Laplacian operator to an image that arrives a band of rows at a time,
+ * keeping only 3 rows of state. Every output row is produced once the row below it has arrived;
+ * the last row is produced by finish. Unlike applySobelOperator and applyLaplacian, which scale
+ * the result by its maximum value, the rows are not scaled unless maxPixelValue is given to start:
+ * filtering the image twice, the first time to get getMaxPixelValue(), gives the same rows as
+ * the whole-image versions.
+ */
+template <typename T, typename U>
+class StencilRowFilter {
+
+private:
+    
+    StencilOperator op; /* operator applied */
+    int Ncols; /* number of columns of the image */
+    int rowsIn; /* number of rows received so far */
+    int rowsOut; /* number of rows produced so far */
+    int scale; /* maximum value the result is scaled by, or 0 */
+    int maxPixelValue; /* maximum value of the result so far */
+    Image<T> window; /* last 3 input rows, row k in row k % 3 */
+    
+    void produceRow(U *dst, bool border);
+
+public:
+    
+    /**
+     * Default constructor; call start before filtering.
+     */
+    StencilRowFilter() : op(SOBEL_OPERATOR), Ncols(0), rowsIn(0), rowsOut(0), scale(0), maxPixelValue(0) {};
+    
+    /**
+     * Starts applying operator stencil to an image of the given number of columns; the result is
+     * scaled to 0..255 like scalePixelValues does if maxPixelValue > 0;
+     * returns 0 if OK or -1 if columns <= 0.
+     */
+    int start(StencilOperator stencil, int columns, int maxPixelValue = 0);
+    
+    /**
+     * Filters the next rows of the image (band) and stores the rows that are finished in the
+     * first rows of out, which has at least as many rows as band;
+     * returns the number of rows stored in out or -1 if the sizes do not match.
+     */
+    int filterRows(ImageView<const T> band, ImageView<U> out);
+    
+    /**
+     * Stores the last row of the image in the first row of out;
+     * returns the number of rows stored in out or -1 if out is too small.
+     */
+    int finish(ImageView<U> out);
+    
+    /**
+     * Returns the maximum value of the (unscaled) result so far.
+     */
+    int getMaxPixelValue() const {return maxPixelValue;};
+};
+
+/**
+ * Applies Hough transform to image im, saves result in output;
+ * numOfRhoUnits = int(sqrt(pow(nRows,2)+pow(nCols,2)) + 0.5) pixels;
+ * rho space equals 3*numOfRhoUnits
+ * rho values are shifted by numOfRhoUnits to acomodate negative values;
+ * numOtThetaUnits = 180 * 5 = PI = 180 degrees;
+ * votes are scaled to 0..255 unless scaleVotes is false, in which case output keeps the raw
+ * votes and its number of colors is the largest vote (saved as a 16-bit image if above 255).
+ */
+template <typename T, typename U>
+int HoughTransform(Image<T> *im, Image<U> *output, bool scaleVotes = true);
+
+/**
+ * Computes the Hough transform of packed binary image im like HoughTransform(im, output,
+ * scaleVotes); only the pixels that are 1 are visited, 64 pixels of background at a time.
+ */
+template <typename U>
+int HoughTransform(const BinaryImage *im, Image<U> *output, bool scaleVotes = true);
+
+/**
+ * Sets rho shift value for Hough image of im.
+ */
+template <typename T, typename U>
+int setRhoShiftForHoughImage(Image<T> *im, Image<U> *Hough);
+
+/**
+ * Finds "areas of brightness" in grey-level thresholded Hough image, saves results in db.
+ */
+template <typename T>
+int findLocalMaxima(Image<T> *Hough, HoughDatabase &db);
+
+/**
+ * Draws objects' positions and orientations in the image in black (0).
+ */
+template <typename T>
+int addPositionAndOrientation(Image<T> *im, Database &db, bool recognizedOnly);
+
+/**
+ * Draws detected lines in image im.
+ */
+template <typename T>
+int drawLines(Image<T> *im, HoughDatabase &db);
+
+/**
+ * Draws detected line segments in image im.
+ */
+template <typename T, typename U>
+int drawLines(Image<T> *im, HoughDatabase &db, Image<U> *sobel);
+template <typename T>
+int drawLines(Image<T> *im, HoughDatabase &db, const BinaryImage *sobel);
+
+/**
+ * Writes image im into file filename, a whole row per fwrite; images with more than 255
+ * colors are saved with 16-bit pixels (most significant byte first, at most 65535); pixel
+ * values are clamped to the range of the file;
+ * returns 0 if OK or -1 if something goes wrong.
+ */
+template <typename T>
+int writeImage(const Image<T> *im, const char *filename);
+
+/**
+ * Writes labeled image im into file filename without losing labels: like writeImage for up to
+ * 65535 objects, with 32-bit pixels (most significant byte first) for more; PGM stops at 65535
+ * gray levels, so such files are read by readLabeledImage only;
+ * returns 0 if OK or -1 if something goes wrong.
  */
-int drawLines(Image *im, HoughDatabase &db, Image *sobel);
+template <typename T>
+int writeLabeledImage(const Image<T> *im, const char *filename);
 
 /**
- * Writes image im into file filename;
+ * Writes packed binary image im into file filename: as PBM (P4, 1 bit per pixel) if filename
+ * ends with ".pbm", otherwise as PGM with 1 color;
  * returns 0 if OK or -1 if something goes wrong.
  */
-int writeImage(const Image *im, const char *filename);
+int writeImage(const BinaryImage *im, const char *filename);
 
 
 /*
@@ -268,12 +1572,14 @@ function for drawing a line
 /**
  * Returns rho shift value.
  */
+template <typename T, typename Mask>
 int
-line(Image *&im, int x0, int y0, int x1, int y1, int color,Image *&sobel);
+line(Image<T> *&im, int x0, int y0, int x1, int y1, int color, Mask *&sobel);
 /**
  * Returns rho shift value.
  */
+template <typename T>
 int
-line(Image *&im, int x0, int y0, int x1, int y1, int color);
+line(Image<T> *&im, int x0, int y0, int x1, int y1, int color);
 
 #endif
@@ -32,14 +32,20 @@ class Database {
         bool            recognized;
     };
     
+    static Record emptyRecord( );
     void initializeRecords(int numberOfRecords);
+    void clear( );
     void addBasicRecord(int rowC, int colC, double theta, double minE, double maxE, long long int area);
     void updateSums(int recordLabel, int i, int j);
+    void updateSums(int recordLabel, int i, int start, int end);
+    static void updateSums(Record &r, int i, int start, int end);
     void calculateProperties( );
+    static void calculateProperties(Record &r);
     void printRecords( ) const;
     int readBasicFromTxtFile(const char *fname);
     int saveInTxtFile(const char *fname) const;
     int recognizeObjects(const Database &other);
+    int recognizeObject(Record &object) const;
     vector<Record> getRecords( ) const;
 
   private:
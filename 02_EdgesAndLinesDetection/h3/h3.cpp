@@ -8,6 +8,8 @@
                   where:
                   <arg1> is an input binary edge image
                   <arg2> is an output gray-level Hough image
+ Batch usage    : ./h3 -batch <inputs> <arg2>
+                  runs the program on every image of <inputs> (see showUsage)
  Comments       : The brightness of each pixel (voting bin) in the output image is 
                   proportional to the number of votes it received.
                   Hough image is an array of size:
@@ -24,7 +26,9 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <cstring>
 #include "Image.h"
+#include "Batch.h"
 
 using namespace std;
 
@@ -33,37 +37,90 @@ using namespace std;
  */
 void showUsage(string fileName);
 
+/**
+ * Runs the program on every image of a batch (see showUsage).
+ */
+int runBatch(int argc, char * argv[]);
+
 /******************************************************************************************
  * MAIN
  ******************************************************************************************/
 int main(int argc, char * argv[]) {
+
+    if (argc>1 && strcmp(argv[1], "-batch")==0) {
+        return runBatch(argc, argv);
+    }
     
     if (argc!=3) {
         showUsage(argv[0]);
         return 0;
     }
     
-    Image *input, *output;
-    input = new Image;
-    assert(input != 0);
-    output = new Image;
-    assert(output != 0);
+    BinaryImage input; /* pixels that are not 0 are edges */
+    Image<uint16_t> output; /* Hough accumulator */
     
-    if (readImage(input, argv[1])) {
-        printf("Can't open file %s\n", argv[1]);
+    if (readAsBinaryImage(&input, argv[1], 0)) {
+        fprintf(stderr, "Can't open file %s\n", argv[1]);
         return 0;
     }
     
-    HoughTransform(input, output);
+    HoughTransform(&input, &output);
 
-    if (writeImage(output, argv[2])) {
-        printf("Can't write to file %s\n", argv[3]);
+    if (writeImage(&output, argv[2])) {
+        fprintf(stderr, "Can't write to file %s\n", argv[2]);
         return 0;
     }
     
     return 0;
 }
 
+/******************************************************************************************
+ * runBatch
+ ******************************************************************************************/
+int runBatch(int argc, char * argv[]) {
+    
+    if (argc!=4) {
+        showUsage(argv[0]);
+        return 0;
+    }
+    
+    BatchTimer timer;
+    BatchInputs inputs;
+    if (inputs.open(argv[2])) {
+        return 0;
+    }
+    
+    /* decode the next images while the Hough transform of the current one is computed */
+    struct Frame {
+        BinaryImage input; /* pixels that are not 0 are edges */
+    };
+    BatchPrefetcher<Frame> frames(inputs, [&](Frame *frame, FILE *input, int k) {
+        return readAsBinaryImage(&frame->input, input, 0);
+    });
+    Image<uint16_t> output; /* Hough accumulator */
+    
+    Frame *frame;
+    int k, status;
+    while ((frame = frames.next(k, status)) != NULL) {
+        if (status) {
+            fprintf(stderr, "Can't load frame %d (%s)\n", k, inputs.getName(k).c_str());
+            timer.countFrame(false);
+            continue;
+        }
+        string outputName = makeBatchName(argv[3], inputs.getName(k), k);
+        HoughTransform(&frame->input, &output);
+        if (writeImage(&output, outputName.c_str())) {
+            fprintf(stderr, "Can't write to file %s\n", outputName.c_str());
+            timer.countFrame(false);
+            continue;
+        }
+        timer.countFrame(true);
+    }
+    timer.report();
+    
+    return 0;
+}
+
 /******************************************************************************************
  * showUsage
  ******************************************************************************************/
@@ -74,5 +131,11 @@ void showUsage(string fileName) {
     << "where:\n"
     << "\t<arg1> is an input binary edge image\n"
     << "\t<arg2> is an output gray-level Hough image\n"
-    << "example:\n\t" << fileName <<  " input.pgm output.pgm\n";
+    << "batch:\t" << fileName << " -batch <inputs> <arg2>\n"
+    << "\t<inputs> is a directory, a quoted glob pattern, a numbered sequence such as frame_%05d.pgm,\n"
+    << "\t@list (a file listing images), or an image file or - holding one or more images;\n"
+    << "\toutput names (and other per-frame image names) are patterns: %s is the input name\n"
+    << "\twithout directory and extension, %d (or %05d) the frame number\n"
+    << "example:\n\t" << fileName <<  " input.pgm output.pgm\n"
+    << "\t" << fileName << " -batch 'binary/*.pgm' hough/%s_H.pgm\n";
 }
\ No newline at end of file
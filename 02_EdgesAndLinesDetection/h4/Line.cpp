@@ -18,7 +18,8 @@ enum /* scan direction */
 /******************************************************************************************
  * line
  ******************************************************************************************/
-int line(Image *&im, int x0, int y0, int x1, int y1, int color)
+template <typename T>
+int line(Image<T> *&im, int x0, int y0, int x1, int y1, int color)
 /*
  draws a line of given gray-level color from (x0,y0) to (x1,y1);
  im is the pointer to the user defined image structure -
@@ -204,9 +205,11 @@ int line(Image *&im, int x0, int y0, int x1, int y1, int color)
 /******************************************************************************************
  * line - overloaded for drawing edges
  ******************************************************************************************/
-int line(Image *&im, int x0, int y0, int x1, int y1, int color, Image *&sobel)
+template <typename T, typename Mask>
+int line(Image<T> *&im, int x0, int y0, int x1, int y1, int color, Mask *&sobel)
 /*
- draws a line of given gray-level color from (x0,y0) to (x1,y1);
+ draws a line of given gray-level color from (x0,y0) to (x1,y1), only over pixels of the
+ edge mask sobel (an Image or a BinaryImage) that are not 0;
  im is the pointer to the user defined image structure -
  whatever it is;
  
@@ -389,3 +392,14 @@ int line(Image *&im, int x0, int y0, int x1, int y1, int color, Image *&sobel)
     return 0; /* no error */
 }
 
+/******************************************************************************************
+ * explicit instantiations for supported pixel types
+ ******************************************************************************************/
+#define INSTANTIATE_LINE_2(T, U) \
+    template int line(Image<T> *&im, int x0, int y0, int x1, int y1, int color, Image<U> *&sobel);
+#define INSTANTIATE_LINE(T) \
+    template int line(Image<T> *&im, int x0, int y0, int x1, int y1, int color); \
+    template int line(Image<T> *&im, int x0, int y0, int x1, int y1, int color, const BinaryImage *&sobel); \
+    FOR_EACH_PIXEL_TYPE_2(INSTANTIATE_LINE_2, T)
+
+FOR_EACH_PIXEL_TYPE(INSTANTIATE_LINE)
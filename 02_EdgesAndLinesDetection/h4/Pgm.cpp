@@ -33,10 +33,16 @@
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
+#include <cctype>
+#include <climits>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <vector>
 #include <iostream>
 #include <cmath>
 #include <cassert>
+#include <algorithm>
+#include <thread>
 #include "Image.h"
 #include "DisjSets.h"
 #include "HoughDatabase.h"
@@ -44,624 +50,1647 @@
 
 using namespace std;
 
+/******************************************************************************************
+ * PGM header readers
+ ******************************************************************************************/
+/* characters of a PGM header read from a file */
+struct PgmFileReader {
+    FILE *input;
+    int get() {return fgetc(input);};
+};
+
+/* characters of a PGM header read from memory; EOF at the end of the block */
+struct PgmMemoryReader {
+    const unsigned char *next;
+    const unsigned char *end;
+    int get() {return (next < end) ? *next++ : EOF;};
+};
+
+/******************************************************************************************
+ * openFile
+ ******************************************************************************************/
+FILE *openFile(const char *fname, const char *mode) {
+    if (!fname || !mode) {
+        return NULL;
+    }
+    if (strcmp(fname, "-")==0) {
+        return (mode[0]=='r') ? stdin : stdout;
+    }
+    return fopen(fname, mode);
+}
+
+/******************************************************************************************
+ * closeFile
+ ******************************************************************************************/
+int closeFile(FILE *file) {
+    if (file==stdin) {
+        return 0;
+    }
+    if (file==stdout) {
+        return fflush(file);
+    }
+    return fclose(file);
+}
+
+/******************************************************************************************
+ * readPgmHeaderValue
+ ******************************************************************************************/
+/* reads a non-negative decimal value of the PGM header, skipping white space and comments before
+   it and the single white space character after it; returns 0 if OK or -1 if something goes wrong */
+template <typename Reader>
+static int readPgmHeaderValue(Reader &input, int &value) {
+    int c = input.get();
+    
+    /* skip white space and comments */
+    while (c!=EOF && (isspace(c) || c=='#')) {
+        if (c=='#') {
+            while (c!=EOF && c!='\n') {
+                c = input.get();
+            }
+        }
+        else {
+            c = input.get();
+        }
+    }
+    if (!isdigit(c)) {
+        return -1;
+    }
+    
+    value = 0;
+    while (isdigit(c)) {
+        if (value > (INT_MAX - 9) / 10) { /* too large */
+            return -1;
+        }
+        value = value * 10 + (c - '0');
+        c = input.get();
+    }
+    return isspace(c) ? 0 : -1;
+}
+
+/******************************************************************************************
+ * parsePnmHeader
+ ******************************************************************************************/
+template <typename Reader>
+static int parsePnmHeader(Reader &input, int &format, int &nRows, int &nCols, int &levels) {
+    int c;
+    
+    /* check for the right "magic number": P5 (PGM) or P4 (PBM) */
+    if (input.get()!='P' || ((c=input.get())!='5' && c!='4')) {
+        fprintf(stderr, "readImage: Expected .pgm file\n");
+        return -1;
+    }
+    format = c - '0';
+    
+    /* read the width, height and # of gray levels (PBM images have 1 color) */
+    levels = 1;
+    if (readPgmHeaderValue(input, nCols)!=0
+        || readPgmHeaderValue(input, nRows)!=0
+        || (format==5 && readPgmHeaderValue(input, levels)!=0)) {
+        fprintf(stderr, "readImage: Corrupted .pgm header\n");
+        return -1;
+    }
+    return 0; /* OK */
+}
+
+/******************************************************************************************
+ * parsePgmHeader
+ ******************************************************************************************/
+template <typename Reader>
+static int parsePgmHeader(Reader &input, int &nRows, int &nCols, int &levels) {
+    int format;
+    
+    if (parsePnmHeader(input, format, nRows, nCols, levels)!=0) {
+        return -1;
+    }
+    if (format!=5) {
+        fprintf(stderr, "readImage: Expected .pgm file\n");
+        return -1;
+    }
+    return 0; /* OK */
+}
+
+/******************************************************************************************
+ * readPgmHeader
+ ******************************************************************************************/
+int readPgmHeader(FILE *input, int &nRows, int &nCols, int &levels) {
+    PgmFileReader reader = {input};
+    return parsePgmHeader(reader, nRows, nCols, levels);
+}
+
+/******************************************************************************************
+ * readPnmHeader
+ ******************************************************************************************/
+int readPnmHeader(FILE *input, int &format, int &nRows, int &nCols, int &levels) {
+    PgmFileReader reader = {input};
+    return parsePnmHeader(reader, format, nRows, nCols, levels);
+}
+
+/******************************************************************************************
+ * hasNextImage
+ ******************************************************************************************/
+int hasNextImage(FILE *input) {
+    int c;
+    
+    /* images of a stream may be separated by white space */
+    while ((c=getc(input))!=EOF && isspace(c)) {
+    }
+    if (c==EOF) {
+        return 0;
+    }
+    ungetc(c, input);
+    return 1;
+}
+
+/******************************************************************************************
+ * openImageFile
+ ******************************************************************************************/
+/* opens image fname for reading; returns the file or NULL if it cannot be opened */
+static FILE *openImageFile(const char *fname) {
+    FILE *input;
+    
+    if (!fname || (input=openFile(fname,"rb"))==0) {
+        fprintf(stderr, "readImage: Cannot open file\n");
+        return NULL;
+    }
+    return input;
+}
+
+/******************************************************************************************
+ * readPgmImageHeader
+ ******************************************************************************************/
+/* reads the header of PGM image from input and sets the size of im; returns 0 if OK or -1 if
+   something goes wrong */
+template <typename T>
+static int readPgmImageHeader(FILE *input, Image<T> *im, int &levels) {
+    int format, nCols, nRows;
+    
+    if (readPnmHeader(input, format, nRows, nCols, levels)!=0) {
+        return -1;
+    }
+    if (format!=5) {
+        fprintf(stderr, "readImage: Expected .pgm file\n");
+        return -1;
+    }
+    im->setSize(nRows, nCols);
+    return 0; /* OK */
+}
+
+/******************************************************************************************
+ * unpackBinaryRow
+ ******************************************************************************************/
+/* unpacks nCols pixels from bits into 0's and 1's */
+template <typename T>
+static void unpackBinaryRow(const uint8_t *bits, int nCols, T *pixels) {
+    for (int j=0; j<nCols; j++) {
+        pixels[j] = T((bits[j >> 3] >> (7 - (j & 7))) & 1);
+    }
+}
+
+/******************************************************************************************
+ * PBM rows
+ ******************************************************************************************/
+/* reverses the order of the bits of a byte; bytes of PBM files hold the leftmost pixel in the
+   most significant bit, words of BinaryImage in the least significant one */
+static inline uint8_t reverseBits(uint8_t b) {
+    b = uint8_t(((b & 0xF0) >> 4) | ((b & 0x0F) << 4));
+    b = uint8_t(((b & 0xCC) >> 2) | ((b & 0x33) << 2));
+    b = uint8_t(((b & 0xAA) >> 1) | ((b & 0x55) << 1));
+    return b;
+}
+
+/* converts a row of nBytes bytes of a PBM file into the words of a row of BinaryImage */
+static void pbmRowToWords(const uint8_t *bytes, int nBytes, uint64_t *words) {
+    for (int b=0; b<nBytes; b++) {
+        if ((b & 7)==0) {
+            words[b >> 3] = 0;
+        }
+        words[b >> 3] |= uint64_t(reverseBits(bytes[b])) << (8 * (b & 7));
+    }
+}
+
+/* converts the words of a row of BinaryImage into a row of nBytes bytes of a PBM file */
+static void wordsToPbmRow(const uint64_t *words, int nBytes, uint8_t *bytes) {
+    for (int b=0; b<nBytes; b++) {
+        bytes[b] = reverseBits(uint8_t(words[b >> 3] >> (8 * (b & 7))));
+    }
+}
+
+/* unpacks nCols pixels from the words of a row of BinaryImage into 0's and 1's */
+template <typename T>
+static void unpackWordRow(const uint64_t *words, int nCols, T *pixels) {
+    for (int j=0; j<nCols; j++) {
+        pixels[j] = T((words[j >> 6] >> (j & 63)) & 1);
+    }
+}
+
+/******************************************************************************************
+ * readPgmRows
+ ******************************************************************************************/
+/* reads the pixels of the next im.getNRows() rows from input into im and counts them in
+   histogram unless it is NULL; returns 0 if OK or -1 if the file is short */
+template <typename T>
+static int readPgmRows(FILE *input, ImageView<T> im, int levels, Histogram *histogram = NULL) {
+    int nRows = im.getNRows(), nCols = im.getNCols();
+    int bytesPerPixel = (levels > 255) ? 2 : 1;
+    int i, j;
+    
+    if (nRows==0 || nCols==0) {
+        return 0;
+    }
+    
+    if (sizeof(T)==1 && bytesPerPixel==1) {
+        /* bytes go straight into the pixel buffer; rows to be counted are read one at a
+           time, so that they are counted while they are still in the cache */
+        if (im.getStride()==nCols && !histogram) {
+            size_t n = size_t(nRows) * nCols;
+            if (fread(im.row(0), 1, n, input)!=n) {
+                fprintf(stderr, "readImage: short file\n");
+                return -1;
+            }
+        }
+        else {
+            for(i=0; i<nRows; i++) {
+                if (fread(im.row(i), 1, nCols, input)!=size_t(nCols)) {
+                    fprintf(stderr, "readImage: short file\n");
+                    return -1;
+                }
+                if (histogram) {
+                    histogram->addRow(im.row(i), nCols);
+                }
+            }
+        }
+        return 0; /* OK */
+    }
+    
+    /* wider pixels or 16-bit samples: read each row into a byte buffer and convert it */
+    ScratchImage<uint8_t> bufferScratch(1, nCols * bytesPerPixel);
+    uint8_t *bytes = bufferScratch.image().row(0);
+    for(i=0; i<nRows; i++) {
+        if (fread(bytes, bytesPerPixel, nCols, input)!=size_t(nCols)) {
+            fprintf(stderr, "readImage: short file\n");
+            return -1;
+        }
+        T *pixels = im.row(i);
+        if (bytesPerPixel==1) {
+            for(j=0; j<nCols; j++) {
+                pixels[j] = T(bytes[j]);
+            }
+        }
+        else {
+            for(j=0; j<nCols; j++) {
+                pixels[j] = T((bytes[2*j] << 8) | bytes[2*j+1]);
+            }
+        }
+        if (histogram) {
+            histogram->addRow(pixels, nCols);
+        }
+    }
+    return 0; /* OK */
+}
+
+/******************************************************************************************
+ * readPgmPixels
+ ******************************************************************************************/
+template <typename T>
+int readPgmPixels(FILE *input, Image<T> *im, int levels, Histogram *histogram) {
+    if (histogram) {
+        histogram->reset(levels);
+    }
+    return readPgmRows(input, im->view(), levels, histogram);
+}
+
+/******************************************************************************************
+ * writePgmHeader
+ ******************************************************************************************/
+/* writes the header of a binary PGM image of nRows x nCols pixels and colors gray levels
+   (at most 65535) to output; returns 0 if OK or -1 if something goes wrong */
+static int writePgmHeader(FILE *output, int nRows, int nCols, int colors) {
+    if (colors > 65535) {
+        colors = 65535;
+    }
+    if (fprintf(output,"P5\n")<0 /* magic number */
+        || fprintf(output,"#\n")<0  /* empty comment */
+        || fprintf(output,"%d %d\n%03d\n",nCols,nRows,colors)<0) { /* image info */
+        fprintf(stderr, "writeImage: could not write\n");
+        return -1;
+    }
+    return 0; /* OK */
+}
+
+/******************************************************************************************
+ * writePgmRows
+ ******************************************************************************************/
+/* writes the pixels of the rows of im to output as pixels of a PGM image of colors gray levels:
+   16-bit, most significant byte first, if colors > 255; values are clamped to the range of the
+   pixels; returns 0 if OK or -1 if something goes wrong */
+template <typename T>
+static int writePgmRows(FILE *output, ImageView<const T> im, int colors) {
+    int nRows = im.getNRows(), nCols = im.getNCols();
+    int i, j;
+    
+    /* more than 255 colors need 16-bit pixels */
+    int bytesPerPixel = (colors > 255) ? 2 : 1;
+    int maxValue = (colors > 255) ? 65535 : 255;
+    
+    if (nRows==0 || nCols==0) {
+        return 0;
+    }
+    
+    /* write pixels row by row; 8-bit pixels are written straight from the image */
+    bool convert = (sizeof(T)!=1 || bytesPerPixel!=1);
+    ScratchImage<uint8_t> bufferScratch(1, convert ? nCols * bytesPerPixel : 1);
+    uint8_t *bytes = bufferScratch.image().row(0);
+    for(i=0; i<nRows; i++)  {
+        const T *pixels = im.row(i);
+        const void *data = pixels;
+        if (convert) {
+            for(j=0; j<nCols; j++) {
+                double v = double(pixels[j]);
+                int value = (v <= 0) ? 0 : (v >= maxValue) ? maxValue : int(v);
+                if (bytesPerPixel==1) {
+                    bytes[j] = uint8_t(value);
+                }
+                else {
+                    bytes[2*j] = uint8_t(value >> 8);
+                    bytes[2*j+1] = uint8_t(value & 0xFF);
+                }
+            }
+            data = bytes;
+        }
+        if (fwrite(data, bytesPerPixel, nCols, output)!=size_t(nCols)) /* couldn't write */ {
+            fprintf(stderr, "writeImage: could not write\n");
+            return -1;
+        }
+    }
+    return 0; /* OK */
+}
+
+/******************************************************************************************
+ * MappedPgm
+ ******************************************************************************************/
+MappedPgm::MappedPgm() {
+    mapping=NULL;
+    mappingSize=0;
+    Ncolors=0;
+}
+
+MappedPgm::~MappedPgm() {
+    unmap();
+}
+
+void MappedPgm::unmap() {
+    if (mapping) {
+        munmap(mapping, mappingSize);
+    }
+    mapping=NULL;
+    mappingSize=0;
+    copy=Image<uint8_t>();
+    pixels=ImageView<const uint8_t>();
+    Ncolors=0;
+}
+
+/******************************************************************************************
+ * mapPgm
+ ******************************************************************************************/
+int mapPgm(MappedPgm *pgm, const char *fname) {
+    FILE *input;
+    
+    pgm->unmap();
+    
+    /* open it; the mapping stays valid after the file is closed */
+    if ((input=openImageFile(fname))==NULL) {
+        return -1;
+    }
+    int result = mapPgm(pgm, input);
+    closeFile(input);
+    return result;
+}
+
+/******************************************************************************************
+ * mapPgm - overloaded for open files
+ ******************************************************************************************/
+int mapPgm(MappedPgm *pgm, FILE *input) {
+    struct stat info;
+    int nCols, nRows, levels;
+    
+    pgm->unmap();
+    
+    /* map regular files from the current position on, read anything else (pipes, stdin) */
+    void *mapping = MAP_FAILED;
+    long offset = ftell(input);
+    if (offset>=0 && fstat(fileno(input), &info)==0 && S_ISREG(info.st_mode) && info.st_size>offset) {
+        mapping = mmap(NULL, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fileno(input), 0);
+    }
+    if (mapping==MAP_FAILED) {
+        if (readPgmHeader(input, nRows, nCols, levels)!=0) {
+            return -1;
+        }
+        if (levels > 255) {
+            fprintf(stderr, "mapPgm: Expected 8-bit .pgm file\n");
+            return -1;
+        }
+        if (pgm->copy.setSize(nRows, nCols)<0 || readPgmPixels(input, &pgm->copy, levels)!=0) {
+            pgm->copy=Image<uint8_t>();
+            return -1;
+        }
+        pgm->pixels=pgm->copy.view();
+        pgm->Ncolors=levels;
+        return 0; /* OK */
+    }
+    
+    /* parse the header in place */
+    const unsigned char *data = (const unsigned char *)mapping;
+    PgmMemoryReader reader = {data + offset, data + info.st_size};
+    if (parsePgmHeader(reader, nRows, nCols, levels)!=0) {
+        munmap(mapping, size_t(info.st_size));
+        return -1;
+    }
+    if (levels > 255) {
+        munmap(mapping, size_t(info.st_size));
+        fprintf(stderr, "mapPgm: Expected 8-bit .pgm file\n");
+        return -1;
+    }
+    
+    /* the pixels follow the header, row after row */
+    if (size_t(reader.end - reader.next) < size_t(nRows) * size_t(nCols)) {
+        munmap(mapping, size_t(info.st_size));
+        fprintf(stderr, "readImage: short file\n");
+        return -1;
+    }
+    pgm->mapping=mapping;
+    pgm->mappingSize=size_t(info.st_size);
+    pgm->pixels=ImageView<const uint8_t>(reader.next, nRows, nCols, nCols);
+    pgm->Ncolors=levels;
+    
+    /* leave input at the end of the image, where the next image of a stream starts */
+    fseek(input, long(reader.next - data) + long(nRows) * nCols, SEEK_SET);
+    
+    return 0; /* OK */
+}
+
+/******************************************************************************************
+ * PgmRowReader
+ ******************************************************************************************/
+PgmRowReader::PgmRowReader() {
+    input=NULL;
+    ownsInput=false;
+    Nrows=Ncols=Ncolors=nextRow=0;
+}
+
+PgmRowReader::~PgmRowReader() {
+    close();
+}
+
+int PgmRowReader::open(const char *fname) {
+    FILE *stream;
+    
+    close();
+    if (!fname || (stream=openFile(fname,"rb"))==0) {
+        fprintf(stderr, "readImage: Cannot open file\n");
+        return -1;
+    }
+    if (open(stream)!=0) {
+        closeFile(stream);
+        return -1;
+    }
+    ownsInput=true;
+    return 0; /* OK */
+}
+
+int PgmRowReader::open(FILE *stream) {
+    int nRows, nCols, levels;
+    
+    close();
+    if (readPgmHeader(stream, nRows, nCols, levels)!=0) {
+        return -1;
+    }
+    input=stream;
+    Nrows=nRows;
+    Ncols=nCols;
+    Ncolors=levels;
+    return 0; /* OK */
+}
+
+template <typename T>
+int PgmRowReader::readRows(Image<T> *band, int maxRows) {
+    if (!input || maxRows<=0) {
+        return -1;
+    }
+    int rows = Nrows - nextRow;
+    if (rows > maxRows) {
+        rows = maxRows;
+    }
+    if (rows<=0 || Ncols<=0) {
+        return 0; /* no more rows */
+    }
+    if (band->setSize(rows, Ncols)<0 || readPgmRows(input, band->view(), Ncolors)!=0) {
+        return -1;
+    }
+    band->setColors(Ncolors);
+    nextRow+=rows;
+    return rows;
+}
+
+void PgmRowReader::close() {
+    if (input && ownsInput) {
+        closeFile(input);
+    }
+    input=NULL;
+    ownsInput=false;
+    Nrows=Ncols=Ncolors=nextRow=0;
+}
+
+/******************************************************************************************
+ * PgmRowWriter
+ ******************************************************************************************/
+PgmRowWriter::PgmRowWriter() {
+    output=NULL;
+    ownsOutput=false;
+    Nrows=Ncols=Ncolors=nextRow=0;
+}
+
+PgmRowWriter::~PgmRowWriter() {
+    close();
+}
+
+int PgmRowWriter::open(const char *fname, int rows, int columns, int colors) {
+    FILE *stream;
+    
+    close();
+    if (!fname || (stream=openFile(fname,"wb"))==0) {
+        fprintf(stderr, "writeImage: cannot open file\n");
+        return -1;
+    }
+    if (open(stream, rows, columns, colors)!=0) {
+        closeFile(stream);
+        return -1;
+    }
+    ownsOutput=true;
+    return 0; /* OK */
+}
+
+int PgmRowWriter::open(FILE *stream, int rows, int columns, int colors) {
+    close();
+    if (rows<0 || columns<0) {
+        fprintf(stderr, "writeImage: rows, columns must not be negative\n");
+        return -1;
+    }
+    if (writePgmHeader(stream, rows, columns, colors)!=0) {
+        return -1;
+    }
+    output=stream;
+    Nrows=rows;
+    Ncols=columns;
+    Ncolors=colors;
+    return 0; /* OK */
+}
+
+template <typename T>
+int PgmRowWriter::writeRows(ImageView<const T> band) {
+    if (!output || band.getNCols()!=Ncols || band.getNRows() > Nrows - nextRow) {
+        fprintf(stderr, "writeImage: rows do not fit the image\n");
+        return -1;
+    }
+    if (writePgmRows(output, band, Ncolors)!=0) {
+        return -1;
+    }
+    nextRow+=band.getNRows();
+    return 0; /* OK */
+}
+
+int PgmRowWriter::close() {
+    int result = 0;
+    
+    if (!output) {
+        return 0;
+    }
+    if (nextRow!=Nrows) {
+        fprintf(stderr, "writeImage: only %d of %d rows written\n", nextRow, Nrows);
+        result = -1;
+    }
+    if ((ownsOutput ? closeFile(output) : fflush(output))!=0) {
+        fprintf(stderr, "writeImage: could not write\n");
+        result = -1;
+    }
+    output=NULL;
+    ownsOutput=false;
+    Nrows=Ncols=Ncolors=nextRow=0;
+    return result;
+}
+
 /******************************************************************************************
  * readImage
  ******************************************************************************************/
-int readImage(Image *im, const char *fname) {
-  FILE *input;
-  char line[1024];
-  int nCols,nRows;
-  int levels;
-  int i, j;
+template <typename T>
+int readImage(Image<T> *im, const char *fname) {
+    FILE *input;
+    
+    if ((input=openImageFile(fname))==NULL) {
+        return -1;
+    }
+    int result = readImage(im, input);
+    closeFile(input);
+    return result;
+}
 
-  /* open it */
-  if (!fname || (input=fopen(fname,"r"))==0){
-    printf("readImage: Cannot open file\n");
-    return-1;
-  }
+/******************************************************************************************
+ * readImage - overloaded for open files
+ ******************************************************************************************/
+template <typename T>
+int readImage(Image<T> *im, FILE *input) {
+  int format, nCols, nRows;
+  int levels;
 
-  /* check for the right "magic number" */
-  if (
-        fread(line,1,3,input)!=3
-      ||strncmp(line,"P5\n",3)
-     )
-  {
-    fclose(input);
-    printf("readImage: Expected .pgm file\n");
+  if (readPnmHeader(input, format, nRows, nCols, levels)!=0) {
     return -1;
   }
-
-  /* skip the comments */
-  do
-    fgets(line,sizeof line,input);
-  while(*line=='#');
-
-  /* read the width and height */
-  sscanf(line,"%d %d\n",&nCols,&nRows);
   im->setSize(nRows, nCols);
-
-  /* read # of gray levels */
-  fgets(line,sizeof line,input);
-  sscanf(line,"%d\n",&levels);
   im->setColors(levels);
 
-  /* read pixel row by row */
-  for(i=0;i<nRows;i++)
-  {
-    for(j=0;j<nCols;j++)
-    {
-      int byte=fgetc(input);
-
-      if (byte==EOF) /* short file */
-      {
-        fclose(input);
-        printf("readImage: short file\n");
+  if (format==4) {
+    /* PBM: unpack rows of bits into 0's and 1's */
+    int bytesPerRow = (nCols + 7) / 8;
+    ScratchImage<uint8_t> bitsScratch(1, bytesPerRow);
+    uint8_t *bits = bitsScratch.image().row(0);
+    for (int i=0; i<nRows; i++) {
+      if (fread(bits, 1, bytesPerRow, input)!=size_t(bytesPerRow)) {
+        fprintf(stderr, "readImage: short file\n");
         return -1;
       }
-      else
-        im->setPixel(i,j,byte);
+      unpackBinaryRow(bits, nCols, im->row(i));
     }
+    return 0; /* OK */
   }
 
-  /* close the file */
-  fclose(input);
-  return 0; /* OK */
+  /* read pixels */
+  return readPgmPixels(input, im, levels);
+}
+
+/******************************************************************************************
+ * readAsBinaryImage
+ ******************************************************************************************/
+template <typename T>
+int readAsBinaryImage(Image<T> *im, const char *fname, const Threshold &threshold) {
+    FILE *input;
+    
+    if ((input=openImageFile(fname))==NULL) {
+        return -1;
+    }
+    int result = readAsBinaryImage(im, input, threshold);
+    closeFile(input);
+    return result;
+}
+
+/******************************************************************************************
+ * readAsBinaryImage - overloaded for open files
+ ******************************************************************************************/
+template <typename T>
+int readAsBinaryImage(Image<T> *im, FILE *input, const Threshold &threshold) {
+    int levels;
+    Histogram histogram;
+    
+    if (readPgmImageHeader(input, im, levels)!=0) {
+        return -1;
+    }
+    
+    /* read pixels */
+    if (readPgmPixels(input, im, levels, threshold.isAuto() ? &histogram : NULL)!=0) {
+        return -1;
+    }
+    
+    /* 0 is black, 255 is white; a binary image can be saved as a PGM file with 1 as the number of colors in the header */
+    return thresholdAndMakeBinaryImage(im, threshold.choose(histogram));
+}
+
+/******************************************************************************************
+ * readAndPackPgmPixels
+ ******************************************************************************************/
+/* reads the pixels of a PGM image from input into a scratch image, counting their histogram,
+   then packs them into packed binary image im (which has the size of the image) with the
+   threshold chosen from the histogram */
+template <typename T>
+static int readAndPackPgmPixels(FILE *input, int levels, const Threshold &threshold, BinaryImage *im) {
+    int nRows = im->getNRows(), nCols = im->getNCols();
+    ScratchImage<T> pixels(nRows, nCols);
+    Histogram histogram;
+    
+    if (readPgmPixels(input, &pixels.image(), levels, &histogram)!=0) {
+        return -1;
+    }
+    int level = threshold.choose(histogram);
+    for (int i=0; i<nRows; i++) {
+        packBinaryRow(pixels.image().row(i), nCols, level, im->row(i));
+    }
+    return 0; /* OK */
+}
+
+/******************************************************************************************
+ * readBinaryPixels
+ ******************************************************************************************/
+/* reads pixels of PBM (format 4) or PGM (format 5) image from input into packed binary image im,
+   which has the size of the image; PGM pixels greater than threshold are 1 */
+static int readBinaryPixels(FILE *input, int format, int levels, const Threshold &threshold, BinaryImage *im) {
+    int nRows = im->getNRows(), nCols = im->getNCols();
+    int i, j;
+    
+    if (format==4) {
+        /* PBM: read each row of bytes and convert it to words */
+        int bytesPerRow = (nCols + 7) / 8;
+        ScratchImage<uint8_t> bytesScratch(1, bytesPerRow);
+        uint8_t *bytes = bytesScratch.image().row(0);
+        for (i=0; i<nRows; i++) {
+            if (fread(bytes, 1, bytesPerRow, input)!=size_t(bytesPerRow)) {
+                fprintf(stderr, "readImage: short file\n");
+                return -1;
+            }
+            pbmRowToWords(bytes, bytesPerRow, im->row(i));
+        }
+        im->clearPadding();
+        return 0; /* OK */
+    }
+    
+    /* PGM with an automatic threshold: read the whole image and its histogram, then pack it */
+    if (threshold.isAuto()) {
+        return (levels > 255) ? readAndPackPgmPixels<uint16_t>(input, levels, threshold, im)
+                              : readAndPackPgmPixels<uint8_t>(input, levels, threshold, im);
+    }
+    
+    /* PGM: read each row into a buffer and pack it */
+    Histogram unused; /* a fixed threshold needs no histogram */
+    int level = threshold.choose(unused);
+    int bytesPerPixel = (levels > 255) ? 2 : 1;
+    ScratchImage<uint8_t> bufferScratch(1, nCols * bytesPerPixel);
+    ScratchImage<uint16_t> samplesScratch(1, bytesPerPixel==2 ? nCols : 1);
+    uint8_t *bytes = bufferScratch.image().row(0);
+    uint16_t *samples = samplesScratch.image().row(0);
+    for (i=0; i<nRows; i++) {
+        if (fread(bytes, bytesPerPixel, nCols, input)!=size_t(nCols)) {
+            fprintf(stderr, "readImage: short file\n");
+            return -1;
+        }
+        if (bytesPerPixel==1) {
+            packBinaryRow(bytes, nCols, level, im->row(i));
+        }
+        else {
+            for (j=0; j<nCols; j++) {
+                samples[j] = uint16_t((bytes[2*j] << 8) | bytes[2*j+1]);
+            }
+            packBinaryRow(samples, nCols, level, im->row(i));
+        }
+    }
+    return 0; /* OK */
+}
+
+/******************************************************************************************
+ * readAsBinaryImage - overloaded for packed binary images
+ ******************************************************************************************/
+int readAsBinaryImage(BinaryImage *im, const char *fname, const Threshold &threshold) {
+    FILE *input;
+    
+    if ((input=openImageFile(fname))==NULL) {
+        return -1;
+    }
+    int result = readAsBinaryImage(im, input, threshold);
+    closeFile(input);
+    return result;
+}
+
+/******************************************************************************************
+ * readAsBinaryImage - overloaded for packed binary images and open files
+ ******************************************************************************************/
+int readAsBinaryImage(BinaryImage *im, FILE *input, const Threshold &threshold) {
+    int format, nCols, nRows, levels;
+    
+    if (readPnmHeader(input, format, nRows, nCols, levels)!=0) {
+        return -1;
+    }
+    if (im->setSize(nRows, nCols) < 0 || readBinaryPixels(input, format, levels, threshold, im)!=0) {
+        return -1;
+    }
+    return 0; /* OK */
+}
+
+/******************************************************************************************
+ * readAndLabelBinaryImage
+ ******************************************************************************************/
+template <typename T>
+int readAndLabelBinaryImage(Image<T> *im, const char *fname) {
+    FILE *input;
+    
+    if ((input=openImageFile(fname))==NULL) {
+        return -1;
+    }
+    int result = readAndLabelBinaryImage(im, input);
+    closeFile(input);
+    return result;
+}
+
+/******************************************************************************************
+ * readAndLabelBinaryImage - overloaded for open files
+ ******************************************************************************************/
+template <typename T>
+int readAndLabelBinaryImage(Image<T> *im, FILE *input) {
+    int format, nCols, nRows, levels;
+    BinaryImage binary;
+    
+    if (readPnmHeader(input, format, nRows, nCols, levels)!=0) {
+        return -1;
+    }
+    
+    /* check if binary image */
+    if (levels!=1) {
+        fprintf(stderr, "readImage: Expected binary .pgm file\n");
+        return -1;
+    }
+    
+    /* read pixels */
+    if (binary.setSize(nRows, nCols) < 0 || readBinaryPixels(input, format, levels, 0, &binary)!=0) {
+        return -1;
+    }
+    
+    /* label starting from 1, save # levels (num of objects) */
+    labelBinaryImage(&binary, im);
+    fprintf(stderr, "Number of objects: %d\n", im->getColors());
+    
+    return 0; /* OK */
+}
+
+/******************************************************************************************
+ * LabelOrder
+ ******************************************************************************************/
+/* lists the labels of the block-based labeling in the order of their first pixels: the blocks
+   of a pair of rows are labeled left to right, so labels whose first pixel is in the bottom
+   row wait until the end of the pair, unless a pixel of the top row takes them first */
+struct LabelOrder {
+    vector<int> labels; /* labels in the order of their first pixels */
+    vector<int> bottom; /* labels of the current pair first seen in its bottom row */
+    vector<char> waiting; /* waiting[l] is 1 while label l is in bottom only */
+    
+    void addLabel(int label, bool isTop) {
+        if (label >= int(waiting.size( ))) {
+            waiting.resize(2 * label + 64, 0);
+        }
+        if (isTop) {
+            labels.push_back(label);
+        }
+        else {
+            bottom.push_back(label);
+            waiting[label] = 1;
+        }
+    }
+    void listTopPixel(int label) {
+        if (waiting[label]) {
+            labels.push_back(label);
+            waiting[label] = 0;
+        }
+    }
+    void endPair() {
+        for (size_t k=0; k<bottom.size(); k++) {
+            if (waiting[bottom[k]]) {
+                labels.push_back(bottom[k]);
+                waiting[bottom[k]] = 0;
+            }
+        }
+        bottom.clear();
+    }
+};
+
+/******************************************************************************************
+ * labelBlock
+ ******************************************************************************************/
+/* first run of the labeling for the block of column j of rows top and bottom, whose pixels
+   that are 1 (isTop, isBottom; at least one) get one label: they are neighbours. Only the
+   neighbours that can change the label are read: NW, N (in row above) and W of the top pixel
+   and W of the bottom pixel (SW); e.g. if NW is 1, N, NW and W are one object already. New
+   labels are added to labels and listed in order. */
+template <typename T>
+static inline void labelBlock(T *top, T *bottom, const T *above, int j, bool isTop, bool isBottom,
+                              DisjSets &labels, LabelOrder &order) {
+    int label = 0;
+    int W = (j!=0) ? int(top[j-1]) : 0;
+    int SW = (j!=0 && isBottom) ? int(bottom[j-1]) : 0;
+    
+    if (isTop) {
+        int N = above ? int(above[j]) : 0;
+        int NW = (above && j!=0) ? int(above[j-1]) : 0;
+        if (N!=0) {
+            label = N;
+            if (NW==0 && W!=0) { /* N and W meet only here */
+                labels.unionSets(N, W);
+            }
+        }
+        else if (NW!=0) { /* W, if 1, is below NW */
+            label = NW;
+        }
+        else if (W!=0) {
+            label = W;
+        }
+        if (SW!=0 && W==0) { /* SW, if W is 1, is below W */
+            if (label!=0) {
+                labels.unionSets(label, SW);
+            }
+            else { /* the first pixel of SW's label in the top row */
+                label = SW;
+                order.listTopPixel(label);
+            }
+        }
+    }
+    else { /* only the bottom pixel: its neighbours W (NW of it) and SW are one object */
+        label = (W!=0) ? W : SW;
+    }
+    
+    if (label==0) {
+        labels.addElement( );
+        label = labels.getNumberOfLabels( );
+        order.addLabel(label, isTop);
+    }
+    if (isTop) {
+        top[j] = T(label);
+    }
+    if (isBottom) {
+        bottom[j] = T(label);
+    }
+}
+
+/******************************************************************************************
+ * labelRows
+ ******************************************************************************************/
+/* first run of the labeling of rows firstRow..lastRow-1 of im, which are labeled like a whole
+   image (the row above firstRow is not read): blocks of 2 rows x 1 column, left to right,
+   starting from 1; order lists the labels in the order of their first pixels */
+template <typename T>
+static void labelRows(Image<T> *im, int firstRow, int lastRow, DisjSets &labels, LabelOrder &order) {
+    int nCols = im->getNCols( );
+    vector<T> zeros(((lastRow - firstRow) % 2 != 0) ? nCols : 0, T(0)); /* below the last row */
+    
+    for(int i=firstRow; i<lastRow; i+=2) {
+        T *top = im->row(i);
+        T *bottom = (i+1<lastRow) ? im->row(i+1) : &zeros[0];
+        const T *above = (i!=firstRow) ? im->row(i-1) : 0;
+        
+        for(int j=0; j<nCols; j++) {
+
+            /* 0 is black, 255 is white */
+            bool isTop = (top[j] != 0), isBottom = (bottom[j] != 0);
+            if (isTop || isBottom) {
+                labelBlock(top, bottom, above, j, isTop, isBottom, labels, order);
+            }
+        }
+        order.endPair();
+    }
 }
 
 /******************************************************************************************
- * readAsBinaryImage
+ * relabelRows
  ******************************************************************************************/
-int readAsBinaryImage(Image *im, const char *fname, int threshold) {
-    FILE *input;
-    char line[1024];
-    int nCols,nRows;
-    int i, j;
-    
-    /* open it */
-    if (!fname || (input=fopen(fname,"r"))==0){
-        printf("readImage: Cannot open file\n");
-        return-1;
-    }
-    
-    /* check for the right "magic number" */
-    if (fread(line,1,3,input)!=3 || strncmp(line,"P5\n",3)) {
-        fclose(input);
-        printf("readImage: Expected .pgm file\n");
-        return -1;
+/* second run of the labeling of rows firstRow..lastRow-1 of im: label l becomes finalLabel[l]
+   (finalLabel[0] is 0), with one lookup per pixel */
+template <typename T>
+static void relabelRows(Image<T> *im, int firstRow, int lastRow, const int *finalLabel) {
+    int nCols = im->getNCols( );
+    for(int i=firstRow; i<lastRow; i++) {
+        T *pixels = im->row(i);
+        for(int j=0; j<nCols; j++) {
+            pixels[j] = T(finalLabel[int(pixels[j])]);
+        }
     }
+}
+
+/******************************************************************************************
+ * labelBinaryImage
+ ******************************************************************************************/
+template <typename T>
+int labelBinaryImage(Image<T> *im) {
+    int nRows, levels;
     
-    /* skip the comments */
-    do
-        fgets(line,sizeof line,input);
-    while(*line=='#');
+    nRows = im->getNRows( );
     
-    /* read the width and height */
-    sscanf(line,"%d %d\n",&nCols,&nRows);
-    im->setSize(nRows, nCols);
+    /* FIRST RUN */
     
-    /* read line with # of gray levels */
-    fgets(line,sizeof line,input);
-    im->setColors(1); /* a binary image can be saved as a PGM file with 1 as the number of colors in the header */
+    /* the labels are listed in order in the order of their first pixels, so the objects are
+       numbered like they were when the image was labeled pixel by pixel */
+    DisjSets labels;
+    LabelOrder order;
+    labelRows(im, 0, nRows, labels, order);
     
-    /* read pixels row by row */
-    for(i=0; i<nRows; i++) {
-        for(j=0; j<nCols; j++) {
-            int byte=fgetc(input);
-            
-            if (byte==EOF) /* short file */ {
-                fclose(input);
-                printf("readImage: short file\n");
-                return -1;
-            }
-            else {
-                /* 0 is black, 255 is white */
-                if (byte<=threshold) {
-                    im->setPixel(i,j,0);
-                }
-                else {
-                    im->setPixel(i,j,1);
-                }
-            }
-        }
-    }
+    /* SECOND RUN */
     
-    /* close the file */
-    fclose(input);
+    /* flatten the equivalences into a table of final labels (finalLabels[0] is 0), save # levels
+       (num of objects) */
+    vector<int> finalLabels;
+    levels = labels.flatten(finalLabels, order.labels);
+    im->setColors(levels);
+    //fprintf(stderr, "Number of objects: %d\n", levels);
+
+    relabelRows(im, 0, nRows, &finalLabels[0]);
+
     return 0; /* OK */
 }
 
 /******************************************************************************************
- * readAndLabelBinaryImage
+ * labelBinaryImageParallel
  ******************************************************************************************/
-int readAndLabelBinaryImage(Image *im, const char *fname) {
-    FILE *input;
-    char line[1024];
-    int nCols,nRows;
-    int levels;
-    int i, j;
+template <typename T>
+int labelBinaryImageParallel(Image<T> *im, int numThreads, bool canonicalLabels) {
+    int nRows = im->getNRows( ), nCols = im->getNCols( );
+    int k, j;
     
-    /* open it */
-    if (!fname || (input=fopen(fname,"r"))==0) {
-        printf("readImage: Cannot open file\n");
-        return -1;
+    if (numThreads <= 0) {
+        numThreads = int(thread::hardware_concurrency( ));
     }
     
-    /* check for the right "magic number" */
-    if (fread(line,1,3,input)!=3 || strncmp(line,"P5\n",3)) {
-        fclose(input);
-        printf("readImage: Expected .pgm file\n");
-        return -1;
+    /* horizontal strips of an even # of rows, so that blocks do not cross them */
+    int stripRows = (nRows + max(numThreads, 1) - 1) / max(numThreads, 1);
+    stripRows += stripRows % 2;
+    int numStrips = (stripRows > 0) ? (nRows + stripRows - 1) / stripRows : 0;
+    if (numStrips <= 1) {
+        return labelBinaryImage(im);
     }
-    
-    /* skip the comments */
-    do {
-        fgets(line,sizeof line,input);
+    vector<int> firstRow(numStrips + 1);
+    for (k=0; k<=numStrips; k++) {
+        firstRow[k] = min(k * stripRows, nRows);
     }
-    while (*line=='#');
     
-    /* read the width and height */
-    sscanf(line,"%d %d\n",&nCols,&nRows);
-    im->setSize(nRows, nCols);
-    
-    /* read line with # of gray levels, check if binary image  */
-    fgets(line,sizeof line,input);
-    sscanf(line,"%d\n",&levels);
-    if (levels!=1) {
-        fclose(input);
-        printf("readImage: Expected binary .pgm file\n");
-        return -1;
+    /* FIRST RUN: every strip on its own thread (the first one on this thread), with its own
+       labels 1, 2, ... */
+    vector<DisjSets> stripLabels(numStrips);
+    vector<LabelOrder> stripOrders(numStrips);
+    vector<thread> threads;
+    for (k=1; k<numStrips; k++) {
+        threads.push_back(thread(labelRows<T>, im, firstRow[k], firstRow[k+1], ref(stripLabels[k]),
+                                 ref(stripOrders[k])));
     }
+    labelRows(im, firstRow[0], firstRow[1], stripLabels[0], stripOrders[0]);
+    for (k=0; k<int(threads.size( )); k++) {
+        threads[k].join( );
+    }
+    threads.clear( );
     
-    /* FIRST RUN */
-    
-    /* read pixel row by row, label starting from 1 */
-    int nextLabel = 0;
+    /* MERGE: the labels of strip k become base[k]+1, base[k]+2, ...; objects that touch across
+       a strip boundary are pixels of the first row of a strip and their neighbours NW and N in
+       the last row of the strip above (if N is 1, NW is the same object) */
     DisjSets labels;
-    
-    for(i=0; i<nRows; i++) {
-        
-        for(j=0; j<nCols; j++) {
-            
-            int byte = fgetc(input);
-            
-            if (byte==EOF) /* short file */ {
-                fclose(input);
-                printf("readImage: short file\n");
-                return -1;
-            }
-            else {
-                /* 0 is black, 255 is white */
-                if (byte!=0) {
-                    int NW, N, W;
-                    
-                    /* most pixels--except for top row and left column */
-                    if (i!=0 && j!=0) { /* check pixels in the following order: NW, N, W */
-                        
-                        NW = im->getPixel(i-1,j-1);
-                        N = im->getPixel(i-1,j);
-                        W = im->getPixel(i,j-1);
-                        
-                        if (NW!=0) {
-                            im->setPixel(i,j,NW);
-                            if (N!=0 && W==0 && N!=NW) {
-                                labels.unionSets(NW,N);
-                            }
-                            if (W!=0 && N==0 && W!=NW) {
-                                labels.unionSets(NW,W);
-                            }
-                            if (W!=0 && N!=0 && W!=N) {
-                                labels.unionSets(N,W);
-                            }
-                        }
-                        else {
-                            if (N!=0 && W==0) {
-                                im->setPixel(i,j,N);
-                            }
-                            else if (N==0 && W!=0) {
-                                im->setPixel(i,j,W);
-                            }
-                            else if (N==0 && W==0) {
-                                im->setPixel(i,j,++nextLabel);
-                                labels.addElement( );
-                            }
-                            else if (N!=0 && W!=0) {
-                                if (N==W) {
-                                    im->setPixel(i,j,N);
-                                }
-                                else {
-                                    labels.unionSets(N,W);
-                                    im->setPixel(i,j,N);
-                                }
-                            }
-                        }
-                    }
-                    /* top left corner */
-                    if (i==0 && j==0) {
-                        im->setPixel(i,j,++nextLabel);
-                        labels.addElement( );
-                    }
-                    /* top row */
-                    if (i==0 && j!=0) {
-                        W = im->getPixel(i,j-1);
-                        if (W!=0) {
-                            im->setPixel(i,j,W);
-                        }
-                        else {
-                            im->setPixel(i,j,++nextLabel);
-                            labels.addElement( );
-                        }
-                    }
-                    /* left column */
-                    if (i!=0 && j==0)  {
-                        N = im->getPixel(i-1,j);
-                        if (N!=0) {
-                            im->setPixel(i,j,N);
-                        }
-                        else {
-                            im->setPixel(i,j,++nextLabel);
-                            labels.addElement( );
-                        }
-                    }
+    vector<int> base(numStrips);
+    for (k=0; k<numStrips; k++) {
+        base[k] = labels.getNumberOfLabels( );
+        labels.append(stripLabels[k]);
+    }
+    for (k=1; k<numStrips; k++) {
+        const T *above = im->row(firstRow[k] - 1);
+        const T *current = im->row(firstRow[k]);
+        for (j=0; j<nCols; j++) {
+            if (current[j] != 0) {
+                if (above[j] != 0) {
+                    labels.unionSets(base[k] + int(current[j]), base[k-1] + int(above[j]));
+                }
+                else if (j!=0 && above[j-1] != 0) {
+                    labels.unionSets(base[k] + int(current[j]), base[k-1] + int(above[j-1]));
                 }
             }
         }
     }
     
-    /* save # levels (num of objects) */
-    levels = labels.getNumberOfLevels( );
-    im->setColors(levels);
-    printf("Number of objects: %d\n", levels);
-    
-    /* SECOND RUN */
-    
-    /* create a finalLabels vector with labels of all sets */
+    /* SECOND RUN: canonical labels number the objects like labelBinaryImage(im), in the order
+       of their first pixels; otherwise they are numbered in the order of their labels */
     vector<int> finalLabels;
-    finalLabels.push_back(-1);
-    vector<int> listOfLevels = labels.getLevels( );
-    int label, numOfLabels = labels.getNumberOfLabels( );
-    
-    for (i=1; i<=numOfLabels; i++) {
-        label = labels.find(i);
-        for (j=0; j < listOfLevels.size(); j++) {
-            if (label==listOfLevels[j]) {
-                label = j+1;
+    int levels;
+    if (canonicalLabels) {
+        vector<int> order;
+        for (k=0; k<numStrips; k++) {
+            const vector<int> &stripOrder = stripOrders[k].labels;
+            for (size_t l=0; l<stripOrder.size( ); l++) {
+                order.push_back(base[k] + stripOrder[l]);
             }
         }
-        finalLabels.push_back(label);
+        levels = labels.flatten(finalLabels, order);
     }
+    else {
+        levels = labels.flatten(finalLabels);
+    }
+    im->setColors(levels);
     
-    /* relabel the image */
-    int l;
-    for(i=0; i<nRows; i++) {
-        for(j=0; j<nCols; j++) {
-            l = im->getPixel(i,j);
-            if (l>0 && l<=finalLabels.size( )) {
-                im->setPixel(i,j,finalLabels[l]);
-            }
-        }
+    /* relabel every strip on its own thread, with a table of its own labels */
+    vector<vector<int> > stripFinalLabels(numStrips);
+    for (k=0; k<numStrips; k++) {
+        int numOfLabels = stripLabels[k].getNumberOfLabels( );
+        stripFinalLabels[k].assign(finalLabels.begin() + base[k], finalLabels.begin() + base[k] + numOfLabels + 1);
+        stripFinalLabels[k][0] = 0;
+    }
+    for (k=1; k<numStrips; k++) {
+        threads.push_back(thread(relabelRows<T>, im, firstRow[k], firstRow[k+1], &stripFinalLabels[k][0]));
+    }
+    relabelRows(im, firstRow[0], firstRow[1], &stripFinalLabels[0][0]);
+    for (k=0; k<int(threads.size( )); k++) {
+        threads[k].join( );
     }
     
-    /* close the file */
-    fclose(input);
     return 0; /* OK */
 }
 
 /******************************************************************************************
- * labelBinaryImage
+ * labelBinaryImage - overloaded for packed binary images
  ******************************************************************************************/
-int labelBinaryImage(Image *im) {
-    int nRows, nCols, levels;
-    int i, j;
+template <typename T>
+int labelBinaryImage(const BinaryImage *binary, Image<T> *im) {
+    RunLengthImage runs;
     
-    nRows = im->getNRows( );
-    nCols = im->getNCols( );
+    runs.encode(*binary);
+    return labelBinaryImage(&runs, im);
+}
+
+/******************************************************************************************
+ * labelRuns
+ ******************************************************************************************/
+int labelRuns(const RunLengthImage &runs, vector<int> &labels) {
+    int nRows = runs.getNRows();
+    int numOfRuns = runs.getNumberOfRuns();
     
-    /* FIRST RUN */
+    labels.assign(numOfRuns, 0);
+    if (numOfRuns==0) {
+        return 0;
+    }
     
-    /* read pixel row by row, label starting from 1 */
-    int nextLabel = 0;
-    DisjSets labels;
+    /* FIRST RUN */
     
-    for(i=0; i<nRows; i++) {
-        
-        for(j=0; j<nCols; j++) {
-
-            /* 0 is black, 255 is white */
-            if (im->getPixel(i, j) != 0) {
-                int NW, N, W;
-                    
-                /* most pixels--except for top row and left column */
-                if (i!=0 && j!=0) { /* check pixels in the following order: NW, N, W */
-                        
-                    NW = im->getPixel(i-1,j-1);
-                    N = im->getPixel(i-1,j);
-                    W = im->getPixel(i,j-1);
-                        
-                    if (NW!=0) {
-                        im->setPixel(i,j,NW);
-                        if (N!=0 && W==0 && N!=NW) {
-                            labels.unionSets(NW,N);
-                        }
-                        if (W!=0 && N==0 && W!=NW) {
-                            labels.unionSets(NW,W);
-                        }
-                        if (W!=0 && N!=0 && W!=N) {
-                            labels.unionSets(N,W);
-                        }
-                    }
-                    else {
-                        if (N!=0 && W==0) {
-                            im->setPixel(i,j,N);
-                        }
-                        else if (N==0 && W!=0) {
-                            im->setPixel(i,j,W);
-                        }
-                        else if (N==0 && W==0) {
-                            im->setPixel(i,j,++nextLabel);
-                            labels.addElement( );
-                        }
-                        else if (N!=0 && W!=0) {
-                            if (N==W) {
-                                im->setPixel(i,j,N);
-                            }
-                            else {
-                                labels.unionSets(N,W);
-                                im->setPixel(i,j,N);
-                            }
-                        }
-                    }
-                }
-                /* top left corner */
-                if (i==0 && j==0) {
-                    im->setPixel(i,j,++nextLabel);
-                    labels.addElement( );
-                }
-                /* top row */
-                if (i==0 && j!=0) {
-                    W = im->getPixel(i,j-1);
-                    if (W!=0) {
-                        im->setPixel(i,j,W);
-                    }
-                    else {
-                        im->setPixel(i,j,++nextLabel);
-                        labels.addElement( );
-                    }
+    /* a run gets the label of the first run above that it touches and joins the others; a
+       run that touches none gets a new label, so new labels are in the order of the objects'
+       first pixels */
+    DisjSets sets;
+    const RunLengthImage::Run *all = runs.row(0);
+    int above = 0, aboveEnd = 0; /* runs of the row above */
+    for (int i=0; i<nRows; i++) {
+        int first = int(runs.row(i) - all), end = first + runs.getNumberOfRuns(i);
+        for (int r=first; r<end; r++) {
+            /* runs above that end before NW of the first pixel touch neither this run nor the
+               next ones */
+            while (above < aboveEnd && all[above].end < all[r].start - 1) {
+                above++;
+            }
+            int label = 0;
+            for (int a=above; a<aboveEnd && all[a].start <= all[r].end; a++) {
+                if (label==0) {
+                    label = labels[a];
                 }
-                /* left column */
-                if (i!=0 && j==0)  {
-                    N = im->getPixel(i-1,j);
-                    if (N!=0) {
-                        im->setPixel(i,j,N);
-                    }
-                    else {
-                        im->setPixel(i,j,++nextLabel);
-                        labels.addElement( );
-                    }
+                else {
+                    sets.unionSets(label, labels[a]);
                 }
             }
+            if (label==0) {
+                sets.addElement( );
+                label = sets.getNumberOfLabels( );
+            }
+            labels[r] = label;
         }
+        above = first;
+        aboveEnd = end;
     }
     
-    /* save # levels (num of objects) */
-    levels = labels.getNumberOfLevels( );
-    im->setColors(levels);
-    //printf("Number of objects: %d\n", levels);
-    
     /* SECOND RUN */
     
-    /* create a finalLabels vector with labels of all sets */
     vector<int> finalLabels;
-    finalLabels.push_back(-1);
-    vector<int> listOfLevels = labels.getLevels( );
-    int label, numOfLabels = labels.getNumberOfLabels( );
- 
-    for (i=1; i<=numOfLabels; i++) {
-        label = labels.find(i);
-        for (j=0; j < listOfLevels.size(); j++) {
-            if (label==listOfLevels[j]) {
-                label = j+1;
+    int numOfObjects = sets.flatten(finalLabels);
+    for (int r=0; r<numOfRuns; r++) {
+        labels[r] = finalLabels[labels[r]];
+    }
+    return numOfObjects;
+}
+
+/******************************************************************************************
+ * StreamingLabeler::start
+ ******************************************************************************************/
+int StreamingLabeler::start(int columns, Callback finished) {
+    if (columns<=0) {
+        fprintf(stderr, "start: columns must be positive\n");
+        return -1;
+    }
+    Ncols = columns;
+    rowIndex = 0;
+    callback = finished;
+    above.clear();
+    current.clear();
+    objects.clear();
+    firstRow.clear();
+    lastRow.clear();
+    parent.clear();
+    freeSlots.clear();
+    merged.clear();
+    numOfLiveObjects = 0;
+    numOfFinishedObjects = 0;
+    return 0;
+}
+
+/******************************************************************************************
+ * StreamingLabeler::newObject
+ ******************************************************************************************/
+int StreamingLabeler::newObject() {
+    int slot;
+    
+    if (!freeSlots.empty()) {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    else {
+        slot = int(objects.size());
+        objects.push_back(Database::emptyRecord());
+        firstRow.push_back(0);
+        lastRow.push_back(0);
+        parent.push_back(0);
+    }
+    objects[slot] = Database::emptyRecord();
+    firstRow[slot] = rowIndex;
+    lastRow[slot] = rowIndex;
+    parent[slot] = slot;
+    numOfLiveObjects++;
+    return slot;
+}
+
+/******************************************************************************************
+ * StreamingLabeler::findObject
+ ******************************************************************************************/
+int StreamingLabeler::findObject(int slot) {
+    /* objects are merged only during a row, so the paths are short; halve them anyway */
+    while (parent[slot]!=slot) {
+        parent[slot] = parent[parent[slot]];
+        slot = parent[slot];
+    }
+    return slot;
+}
+
+/******************************************************************************************
+ * StreamingLabeler::mergeObjects
+ ******************************************************************************************/
+int StreamingLabeler::mergeObjects(int slot1, int slot2) {
+    if (firstRow[slot2] < firstRow[slot1]) {
+        swap(slot1, slot2);
+    }
+    
+    /* the sums of i of both objects are taken from their first rows; those of slot2 are moved
+       to the first row of slot1: i - first1 = (i - first2) + d */
+    Database::Record &r = objects[slot1];
+    const Database::Record &other = objects[slot2];
+    long long int d = firstRow[slot2] - firstRow[slot1];
+    r.areaSum += other.areaSum;
+    r.iSum += other.iSum + d * other.areaSum;
+    r.jSum += other.jSum;
+    r.ijSum += other.ijSum + d * other.jSum;
+    r.iSquaredSum += other.iSquaredSum + 2 * d * other.iSum + d * d * other.areaSum;
+    r.jSquaredSum += other.jSquaredSum;
+    lastRow[slot1] = max(lastRow[slot1], lastRow[slot2]);
+    
+    /* runs of both rows may still point at slot2; it is freed at the end of the row */
+    parent[slot2] = slot1;
+    merged.push_back(slot2);
+    numOfLiveObjects--;
+    return slot1;
+}
+
+/******************************************************************************************
+ * StreamingLabeler::finishObject
+ ******************************************************************************************/
+void StreamingLabeler::finishObject(int slot) {
+    Database::Record r = objects[slot];
+    
+    Database::calculateProperties(r);
+    r.rowCenter += firstRow[slot];
+    lastRow[slot] = -1; /* finished: not finished again by another run of the row above */
+    freeSlots.push_back(slot);
+    numOfLiveObjects--;
+    numOfFinishedObjects++;
+    if (callback) {
+        callback(r);
+    }
+}
+
+/******************************************************************************************
+ * StreamingLabeler::addRow
+ ******************************************************************************************/
+int StreamingLabeler::addRow(const RunLengthImage::Run *runs, int numOfRuns) {
+    int numOfFinished = 0;
+    size_t a = 0;
+    size_t k;
+    
+    /* a run joins the objects of the runs above that hold the N or NW neighbour of one of its
+       pixels, like in labelRuns, and adds its pixels to their sums */
+    current.clear();
+    for (int r=0; r<numOfRuns; r++) {
+        while (a < above.size() && above[a].end < runs[r].start - 1) {
+            a++;
+        }
+        int object = -1;
+        for (k=a; k<above.size() && above[k].start <= runs[r].end; k++) {
+            int other = findObject(above[k].object);
+            if (object<0) {
+                object = other;
             }
+            else if (other!=object) {
+                object = mergeObjects(object, other);
+            }
+        }
+        if (object<0) {
+            object = newObject();
+        }
+        Database::updateSums(objects[object], rowIndex - firstRow[object], runs[r].start, runs[r].end);
+        lastRow[object] = rowIndex;
+        LabeledRun run = {runs[r].start, runs[r].end, object};
+        current.push_back(run);
+    }
+    
+    /* objects of the row above without a pixel in this row can't grow any more */
+    for (k=0; k<above.size(); k++) {
+        int object = findObject(above[k].object);
+        if (lastRow[object]>=0 && lastRow[object]<rowIndex) {
+            finishObject(object);
+            numOfFinished++;
+        }
+    }
+    
+    /* point the runs of this row at live objects; then nothing points at the merged slots */
+    for (k=0; k<current.size(); k++) {
+        current[k].object = findObject(current[k].object);
+    }
+    for (k=0; k<merged.size(); k++) {
+        parent[merged[k]] = merged[k];
+        freeSlots.push_back(merged[k]);
+    }
+    merged.clear();
+    
+    above.swap(current);
+    rowIndex++;
+    return numOfFinished;
+}
+
+/******************************************************************************************
+ * StreamingLabeler::addRow - overloaded for packed rows
+ ******************************************************************************************/
+int StreamingLabeler::addRow(const uint64_t *words) {
+    rowRuns.clear();
+    RunLengthImage::encodeRow(words, Ncols, rowRuns);
+    return addRow(rowRuns.data(), int(rowRuns.size()));
+}
+
+/******************************************************************************************
+ * StreamingLabeler::finish
+ ******************************************************************************************/
+int StreamingLabeler::finish() {
+    int numOfFinished = 0;
+    
+    for (size_t k=0; k<above.size(); k++) {
+        int object = findObject(above[k].object);
+        if (lastRow[object]>=0) {
+            finishObject(object);
+            numOfFinished++;
         }
-        finalLabels.push_back(label);
     }
+    above.clear();
+    return numOfFinished;
+}
 
-    /* relabel the image */
-    int l;
-    for(i=0; i<nRows; i++) {
-        for(j=0; j<nCols; j++) {
-            l = im->getPixel(i,j);
-            if (l>0 && l<=finalLabels.size( )) {
-                im->setPixel(i,j,finalLabels[l]);
+/******************************************************************************************
+ * labelAndFillRuns
+ ******************************************************************************************/
+/* labels runs like labelRuns, saves labeled image in Image object im (background pixels are 0,
+   every run is filled with its label) and, unless db is NULL, adds every run to the sums of its
+   object in db in the same pass; returns 0 if OK or -1 if the image is empty */
+template <typename T>
+static int labelAndFillRuns(const RunLengthImage *runs, Image<T> *im, Database *db) {
+    int nRows = runs->getNRows(), nCols = runs->getNCols();
+    vector<int> labels;
+    
+    if (im->setSizeAndInitialize(nRows, nCols) < 0) {
+        return -1;
+    }
+    int numOfObjects = labelRuns(*runs, labels);
+    im->setColors(numOfObjects);
+    if (db) {
+        db->initializeRecords(numOfObjects);
+    }
+    const int *label = labels.data();
+    for (int i=0; i<nRows; i++) {
+        T *pixels = im->row(i);
+        const RunLengthImage::Run *run = runs->row(i);
+        for (int r=0; r<runs->getNumberOfRuns(i); r++, label++) {
+            fill(pixels + run[r].start, pixels + run[r].end + 1, T(*label));
+            if (db) {
+                db->updateSums(*label, i, run[r].start, run[r].end);
             }
         }
     }
+    
+    return 0; /* OK */
+}
+
+/******************************************************************************************
+ * labelBinaryImage - overloaded for run-length images
+ ******************************************************************************************/
+template <typename T>
+int labelBinaryImage(const RunLengthImage *runs, Image<T> *im) {
+    return labelAndFillRuns(runs, im, NULL);
+}
+
+/******************************************************************************************
+ * labelAndMeasureBinaryImage
+ ******************************************************************************************/
+template <typename T>
+int labelAndMeasureBinaryImage(const BinaryImage *binary, Image<T> *im, Database &db) {
+    RunLengthImage runs;
+    
+    runs.encode(*binary);
+    return labelAndFillRuns(&runs, im, &db);
+}
 
+/******************************************************************************************
+ * readLabelPixels
+ ******************************************************************************************/
+/* reads the pixels of a labeled image from input: 8- or 16-bit like readPgmPixels, or 32-bit,
+   most significant byte first, if there are more than 65535 labels (see writeLabeledImage);
+   returns 0 if OK or -1 if the file is short */
+template <typename T>
+static int readLabelPixels(FILE *input, Image<T> *im, int levels) {
+    if (levels <= 65535) {
+        return readPgmPixels(input, im, levels);
+    }
+    
+    int nRows = im->getNRows(), nCols = im->getNCols();
+    vector<uint8_t> bytes(size_t(nCols) * 4);
+    for (int i=0; i<nRows; i++) {
+        T *pixels = im->row(i);
+        if (fread(&bytes[0], 4, nCols, input)!=size_t(nCols)) {
+            fprintf(stderr, "readImage: short file\n");
+            return -1;
+        }
+        for (int j=0; j<nCols; j++) {
+            const uint8_t *b = &bytes[4*j];
+            pixels[j] = T((uint32_t(b[0]) << 24) | (uint32_t(b[1]) << 16) | (uint32_t(b[2]) << 8) | b[3]);
+        }
+    }
     return 0; /* OK */
 }
 
 /******************************************************************************************
  * readLabeledImage
  ******************************************************************************************/
-int readLabeledImage(Image *im, const char *fname, Database &db) {
+template <typename T>
+int readLabeledImage(Image<T> *im, const char *fname, Database &db) {
     FILE *input;
-    char line[1024];
-    int nCols,nRows;
-    int levels;
-    int i, j;
     
-    /* open it */
-    if (!fname || (input=fopen(fname,"r"))==0) {
-        printf("readImage: Cannot open file\n");
+    if ((input=openImageFile(fname))==NULL) {
         return -1;
     }
+    int result = readLabeledImage(im, input, db);
+    closeFile(input);
+    return result;
+}
+
+/******************************************************************************************
+ * readLabeledImage - overloaded for open files
+ ******************************************************************************************/
+template <typename T>
+int readLabeledImage(Image<T> *im, FILE *input, Database &db) {
+    int format, nCols, nRows, levels;
+    int i, j;
     
-    /* check for the right "magic number" */
-    if ( fread(line,1,3,input)!=3 ||strncmp(line,"P5\n",3)) {
-        fclose(input);
-        printf("readImage: Expected .pgm file\n");
+    if (readPnmHeader(input, format, nRows, nCols, levels)!=0) {
         return -1;
     }
     
-    /* skip the comments */
-    do {
-        fgets(line,sizeof line,input);
+    /* a binary image (PBM, or PGM with 1 color) is labeled while its objects are measured; a
+       labeled image of one object is labeled the same */
+    if (levels==1) {
+        BinaryImage binary;
+        if (binary.setSize(nRows, nCols) < 0 || readBinaryPixels(input, format, levels, 0, &binary)!=0) {
+            return -1;
+        }
+        return labelAndMeasureBinaryImage(&binary, im, db);
+    }
+    if (format!=5) {
+        fprintf(stderr, "readImage: Expected .pgm file\n");
+        return -1;
     }
-    while (*line=='#');
-    
-    /* read the width and height */
-    sscanf(line,"%d %d\n",&nCols,&nRows);
-    im->setSize(nRows, nCols);
     
-    /* read # of gray levels, i.e. the number of objects in the image */
-    fgets(line,sizeof line,input);
-    sscanf(line,"%d\n",&levels);
+    /* # of gray levels is the number of objects in the image */
+    if (im->setSize(nRows, nCols) < 0) {
+        return -1;
+    }
     im->setColors(levels);
     db.initializeRecords(levels);
     
-    /* read pixel row by row */
-    for(i=0; i<nRows; i++)
-    {
-        for(j=0; j<nCols; j++)
-        {
-            int byte=fgetc(input);
-            
-            if (byte==EOF) /* short file */
-            {
-                fclose(input);
-                printf("readImage: short file\n");
-                return -1;
+    /* read pixels */
+    if (readLabelPixels(input, im, levels)!=0) {
+        return -1;
+    }
+    
+    /* collect objects' info row by row, a run of pixels with the same label at a time */
+    for(i=0; i<nRows; i++) {
+        const T *pixels = im->row(i);
+        for(j=0; j<nCols; ) {
+            if (pixels[j]==0) {
+                j++;
+                continue;
             }
-            else {
-                im->setPixel(i,j,byte);
-                if (byte!=0) {
-                    db.updateSums(byte, i, j);
-                    
-                }
+            int start = j;
+            T label = pixels[j];
+            while (++j<nCols && pixels[j]==label) {
             }
+            db.updateSums(int(label), i, start, j-1);
         }
     }
     
-    /* close the file */
-    fclose(input);
     return 0; /* OK */
 }
 
 /******************************************************************************************
  * readAndThresholdImage
  ******************************************************************************************/
-int readAndThresholdImage(Image *im, const char *fname, int threshold) {
+template <typename T>
+int readAndThresholdImage(Image<T> *im, const char *fname, const Threshold &threshold) {
     FILE *input;
-    char line[1024];
-    int nCols,nRows;
-    int i, j;
+    int levels;
     
-    /* open it */
-    if (!fname || (input=fopen(fname,"r"))==0) {
-        printf("readImage: Cannot open file\n");
-        return-1;
+    if ((input=openImageFile(fname))==NULL) {
+        return -1;
     }
-    
-    /* check for the right "magic number" */
-    if (
-        fread(line,1,3,input)!=3
-        ||strncmp(line,"P5\n",3)
-        )
-    {
-        fclose(input);
-        printf("readImage: Expected .pgm file\n");
+    if (readPgmImageHeader(input, im, levels)!=0) {
+        closeFile(input);
         return -1;
     }
+    im->setColors(255);
     
-    /* skip the comments */
-    do
-        fgets(line,sizeof line,input);
-    while(*line=='#');
-    
-    /* read the width and height */
-    sscanf(line,"%d %d\n",&nCols,&nRows);
-    im->setSize(nRows, nCols);
+    /* read pixels */
+    Histogram histogram;
+    if (readPgmPixels(input, im, levels, threshold.isAuto() ? &histogram : NULL)!=0) {
+        closeFile(input);
+        return -1;
+    }
+    closeFile(input);
     
-    /* read line with # of gray levels */
-    fgets(line,sizeof line,input);
-    im->setColors(255);
+    /* 0 is black, 255 is white */
+    return thresholdImage(im->view(), threshold.choose(histogram));
+}
+
+/******************************************************************************************
+ * thresholdImage
+ ******************************************************************************************/
+template <typename T>
+int thresholdImage(Image<T> *im, int threshold) {
+    return thresholdImage(im->view(), threshold);
+}
+
+/******************************************************************************************
+ * thresholdImage - overloaded for views
+ ******************************************************************************************/
+template <typename T>
+int thresholdImage(ImageView<T> im, int threshold) {
+    int nCols = im.getNCols(), nRows = im.getNRows();
+    int i;
     
-    /* read pixels row by row */
+    /* threshold row by row; 0 is black, 255 is white */
     for(i=0; i<nRows; i++) {
-        for(j=0; j<nCols; j++) {
-            int byte=fgetc(input);
-            
-            if (byte==EOF) /* short file */ {
-                fclose(input);
-                printf("readImage: short file\n");
-                return -1;
-            }
-            else {
-                /* 0 is black, 255 is white */
-                if (byte<=threshold) {
-                    im->setPixel(i,j,0);
-                }
-                else {
-                    im->setPixel(i,j,byte);
-                }
-            }
-        }
+        thresholdRow(im.row(i), nCols, threshold);
     }
+
+    return 0; /* OK */
+}
+
+/******************************************************************************************
+ * thresholdAndMakeBinaryImage
+ ******************************************************************************************/
+template <typename T>
+int thresholdAndMakeBinaryImage(Image<T> *im, int threshold) {
+    thresholdAndMakeBinaryImage(im->view(), threshold);
+    im->setColors(1);
     
-    /* close the file */
-    fclose(input);
     return 0; /* OK */
 }
 
 /******************************************************************************************
- * thresholdImage
+ * thresholdAndMakeBinaryImage - overloaded for views
  ******************************************************************************************/
-int thresholdImage(Image *im, int threshold) {
-    int nCols = im->getNCols(), nRows = im->getNRows();
-    int i, j;
+template <typename T>
+int thresholdAndMakeBinaryImage(ImageView<T> im, int threshold) {
+    int nCols = im.getNCols(), nRows = im.getNRows();
+    int i;
     
-    /* read pixels row by row */
+    /* threshold row by row; 0 is black, 255 is white */
     for(i=0; i<nRows; i++) {
-        for(j=0; j<nCols; j++) {
-            int pixVal = im->getPixel(i, j);
-
-            /* 0 is black, 255 is white */
-            if (pixVal<=threshold) {
-                im->setPixel(i,j,0);
-            }
-            else {
-                im->setPixel(i,j,pixVal);
-            }
-            
-        }
+        binarizeRow(im.row(i), nCols, threshold);
     }
-
+    
     return 0; /* OK */
 }
 
 /******************************************************************************************
- * thresholdAndMakeBinaryImage
+ * thresholdAndMakeBinaryImage - overloaded for packed binary images
  ******************************************************************************************/
-int thresholdAndMakeBinaryImage(Image *im, int threshold) {
-    int nCols = im->getNCols(), nRows = im->getNRows();
-    int i, j;
+template <typename T>
+int thresholdAndMakeBinaryImage(ImageView<const T> im, int threshold, BinaryImage *output) {
+    int nCols = im.getNCols(), nRows = im.getNRows();
     
-    /* read pixels row by row */
-    for(i=0; i<nRows; i++) {
-        for(j=0; j<nCols; j++) {
-            int pixVal = im->getPixel(i, j);
-            
-            /* 0 is black, 255 is white */
-            if (pixVal<=threshold) {
-                im->setPixel(i,j,0);
-            }
-            else {
-                im->setPixel(i,j,1);
-            }
-            
-        }
+    if (output->setSize(nRows, nCols) < 0) {
+        return -1;
+    }
+    for (int i=0; i<nRows; i++) {
+        packBinaryRow(im.row(i), nCols, threshold, output->row(i));
     }
-    
-    im->setColors(1);
     
     return 0; /* OK */
 }
@@ -669,73 +1698,61 @@ int thresholdAndMakeBinaryImage(Image *im, int threshold) {
 /******************************************************************************************
  * apply5x5GaussianFilter
  ******************************************************************************************/
-int apply5x5GaussianFilter(Image *im) {
+template <typename T>
+int apply5x5GaussianFilter(Image<T> *im) {
+    return apply5x5GaussianFilter(im->view());
+}
+
+/******************************************************************************************
+ * apply5x5GaussianFilter - overloaded for views
+ ******************************************************************************************/
+template <typename T>
+int apply5x5GaussianFilter(ImageView<T> im) {
     // Gaussian mask: 1/16 [1, 4, 6, 4, 1]
+    // pixels outside the view are treated as 0: the input and the result of the
+    // first pass are kept in images with a zero halo of 2 pixels, so both passes
+    // run over aligned rows without tests for the border
+    
+    int nRows = im.getNRows();
+    int nCols = im.getNCols();
+    if (nRows == 0 || nCols == 0) {
+        return 0;
+    }
     
-    int nRows = im->getNRows();
-    int nCols = im->getNCols();
-    int Minus2 = 0;
-    int Minus1 = 0;
-    int Current = 0;
-    int Plus1 = 0;
-    int Plus2 = 0;
-    int newCurrent = 0;
+    ScratchImage<T> paddedScratch(nRows, nCols, 2, true);
+    Image<T> &padded = paddedScratch.image();
+    for(int i=0; i<nRows; i++) {
+        memcpy(padded.row(i), im.row(i), sizeof(T) * nCols);
+    }
+    padded.fillHalo(BORDER_ZERO);
     
-    Image *temp;
-    temp = new Image;
-    assert(temp != 0);
-    temp->setSize(im->getNRows(), im->getNCols());
-    temp->setColors(im->getColors());
+    ScratchImage<T> tempScratch(nRows, nCols, 2, true);
+    Image<T> &temp = tempScratch.image();
+    temp.fillHalo(BORDER_ZERO);
     
-    // convolve Gaussian mask with rows of im
+    // convolve Gaussian mask with rows of im;
+    // (sum + 8) / 16 equals int(sum/16.0 + 0.5)
     for(int i=0; i<nRows; i++) {
+        const T *src = padded.row(i);
+        T *dst = temp.row(i);
         for(int j=0; j<nCols; j++) {
-            Current = im->getPixel(i, j);
-            if (j == 0) {
-                Minus2 = 0;
-                Minus1 = 0;
-                Plus1 = im->getPixel(i, 1);
-                Plus2 = im->getPixel(i, 2);
-            }
-            newCurrent = int((Minus2 + Minus1*4 + Current*6 + Plus1*4 + Plus2)/16.0 + 0.5);
-            temp->setPixel(i, j, newCurrent);
-            
-            // reassign pixel values
-            Minus2 = Minus1;
-            Minus1 = Current;
-            Plus1 = Plus2;
-            if (j >= nCols-3) {
-                Plus2 = 0;
-            }
-            else {
-                Plus2 = im->getPixel(i, j+3);
-            }
+            int sum = int(src[j-2]) + int(src[j-1])*4 + int(src[j])*6 + int(src[j+1])*4 + int(src[j+2]);
+            dst[j] = T((sum + 8) / 16);
         }
     }
     
-    // convolve Gaussian mask with columns of temp
-    for(int j=0; j<nCols; j++) {
-        for(int i=0; i<nRows; i++) {
-            Current = temp->getPixel(i, j);
-            if (j == 0) {
-                Minus2 = 0;
-                Minus1 = 0;
-                Plus1 = temp->getPixel(1, j);
-                Plus2 = temp->getPixel(2, j);
-            }
-            newCurrent = int((Minus2 + Minus1*4 + Current*6 + Plus1*4 + Plus2)/16.0 + 0.5);
-            im->setPixel(i, j, newCurrent);
-            
-            // reassign pixel values
-            Minus2 = Minus1;
-            Minus1 = Current;
-            Plus1 = Plus2;
-            if (i >= nRows-3) {
-                Plus2 = 0;
-            }
-            else {
-                Plus2 = temp->getPixel(i+3, j);
-            }
+    // convolve Gaussian mask with columns of temp, walking the rows in memory order
+    for(int i=0; i<nRows; i++) {
+        const T *rowMinus2 = temp.row(i-2);
+        const T *rowMinus1 = temp.row(i-1);
+        const T *rowCurrent = temp.row(i);
+        const T *rowPlus1 = temp.row(i+1);
+        const T *rowPlus2 = temp.row(i+2);
+        T *dst = im.row(i);
+        for(int j=0; j<nCols; j++) {
+            int sum = int(rowMinus2[j]) + int(rowMinus1[j])*4 + int(rowCurrent[j])*6
+                      + int(rowPlus1[j])*4 + int(rowPlus2[j]);
+            dst[j] = T((sum + 8) / 16);
         }
     }
     return 0;
@@ -744,58 +1761,120 @@ int apply5x5GaussianFilter(Image *im) {
 /******************************************************************************************
  * scalePixelValues
  ******************************************************************************************/
-int scalePixelValues(Image *im, int maxPixelValue) {
-    int nRows = im->getNRows();
-    int nCols = im->getNCols();
+template <typename T>
+int scalePixelValues(Image<T> *im, int maxPixelValue) {
+    return scalePixelValues(im->view(), maxPixelValue);
+}
+
+/******************************************************************************************
+ * scalePixelValues - overloaded for views
+ ******************************************************************************************/
+template <typename T>
+int scalePixelValues(ImageView<T> im, int maxPixelValue) {
+    int nRows = im.getNRows();
+    int nCols = im.getNCols();
     int curPixVal = 0;
     int newPixVal = 0;
     
     for(int i=0; i<nRows; i++) {
+        T *pixels = im.row(i);
         for(int j=0; j<nCols; j++) {
-            curPixVal = im->getPixel(i, j);
+            curPixVal = int(pixels[j]);
             newPixVal = int(curPixVal*255.0/maxPixelValue + 0.5);
-            im->setPixel(i, j, newPixVal);
+            pixels[j] = T(newPixVal);
         }
     }
     return 0;
 }
 
+/******************************************************************************************
+ * laplacianAt
+ ******************************************************************************************/
+/* Laplacian of pixel j of row middle (not in the outermost ring of pixels) */
+template <typename T>
+static inline int laplacianAt(const T *above, const T *middle, const T *below, int j) {
+    int current = int(middle[j]);
+    int N = int(above[j]);
+    int E = int(middle[j+1]);
+    int S = int(below[j]);
+    int W = int(middle[j-1]);
+    return int(4*((N+E+S+W)/4.0 - current)+0.5);
+}
+
+/******************************************************************************************
+ * sobelAt
+ ******************************************************************************************/
+/* Sobel gradient magnitude of pixel j of row middle (not in the outermost ring of pixels) */
+template <typename T>
+static inline int sobelAt(const T *above, const T *middle, const T *below, int j) {
+    int NW = int(above[j-1]);
+    int N = int(above[j]);
+    int NE = int(above[j+1]);
+    int E = int(middle[j+1]);
+    int SE = int(below[j+1]);
+    int S = int(below[j]);
+    int SW = int(below[j-1]);
+    int W = int(middle[j-1]);
+    
+    int delta1 = -NW + NE + 2*E + SE - SW -2*W;
+    int delta2 = NE + 2*N + NE - SE -2*S - SW;
+    return int(sqrt(pow(delta1,2) + pow(delta2,2))+0.5);
+}
+
 /******************************************************************************************
  * applyLaplacian
  ******************************************************************************************/
-int applyLaplacian(Image *im, Image *output) {
+template <typename T, typename U>
+int applyLaplacian(Image<T> *im, Image<U> *output) {
+    output->setSize(im->getNRows(), im->getNCols());
+    output->setColors(im->getColors());
+    return applyLaplacian<T, U>(im->view(), output->view());
+}
+
+/******************************************************************************************
+ * applyLaplacian - overloaded for views
+ ******************************************************************************************/
+template <typename T, typename U>
+int applyLaplacian(ImageView<const T> im, ImageView<U> output) {
     // Laplacial stencil:
     // |  0  1  0  |
     // |  1 -4  1  |
     // |  0  1  0  |
     
-    int nRows = im->getNRows();
-    int nCols = im->getNCols();
-    output->setSize(im->getNRows(), im->getNCols());
-    output->setColors(im->getColors());
+    int nRows = im.getNRows();
+    int nCols = im.getNCols();
+    if (output.getNRows() != nRows || output.getNCols() != nCols) {
+        fprintf(stderr, "applyLaplacian: output size differs from input size\n");
+        return -1;
+    }
     
     // for scaling the output
     int maxPixelValue = 0;
     
     for(int i=0; i<nRows; i++) {
-        for(int j=0; j<nCols; j++) {
-            // pad outermost ring of pixels with 0's
-            if (i==0 || i==nRows-1 || j==0 || j==nCols-1) {
-                output->setPixel(i, j, 0);
+        U *out = output.row(i);
+        
+        // pad outermost ring of pixels with 0's
+        if (i==0 || i==nRows-1) {
+            for(int j=0; j<nCols; j++) {
+                out[j] = 0;
             }
-            else {
-                int current = im->getPixel(i, j);
-                int N = im->getPixel(i-1, j);
-                int E = im->getPixel(i, j+1);
-                int S = im->getPixel(i+1, j);
-                int W = im->getPixel(i, j-1);
-                int newCurrent = int(4*((N+E+S+W)/4.0 - current)+0.5);
-                output->setPixel(i, j, newCurrent);
-                
-                // for scaling the output
-                if (newCurrent > maxPixelValue) {
-                    maxPixelValue = newCurrent;
-                }
+            continue;
+        }
+        out[0] = 0;
+        out[nCols-1] = 0;
+        
+        const T *above = im.row(i-1);
+        const T *middle = im.row(i);
+        const T *below = im.row(i+1);
+        
+        for(int j=1; j<nCols-1; j++) {
+            int newCurrent = laplacianAt(above, middle, below, j);
+            out[j] = U(newCurrent);
+            
+            // for scaling the output
+            if (newCurrent > maxPixelValue) {
+                maxPixelValue = newCurrent;
             }
         }
     }
@@ -804,65 +1883,57 @@ int applyLaplacian(Image *im, Image *output) {
     
     return 0;
 }
+
 /******************************************************************************************
  * applySobelOperator
  ******************************************************************************************/
-int applySobelOperator(Image *im, Image *output) {
-    int nRows = im->getNRows();
-    int nCols = im->getNCols();
+template <typename T, typename U>
+int applySobelOperator(Image<T> *im, Image<U> *output) {
     output->setSize(im->getNRows(), im->getNCols());
     output->setColors(im->getColors());
-    int NW = 0;
-    int N = 0;
-    int NE = 0;
-    int E = 0;
-    int SE = 0;
-    int S = 0;
-    int SW = 0;
-    int W = 0;
+    return applySobelOperator<T, U>(im->view(), output->view());
+}
+
+/******************************************************************************************
+ * applySobelOperator - overloaded for views
+ ******************************************************************************************/
+template <typename T, typename U>
+int applySobelOperator(ImageView<const T> im, ImageView<U> output) {
+    int nRows = im.getNRows();
+    int nCols = im.getNCols();
+    if (output.getNRows() != nRows || output.getNCols() != nCols) {
+        fprintf(stderr, "applySobelOperator: output size differs from input size\n");
+        return -1;
+    }
     int newCurrent = 0;
-    int delta1 = 0;
-    int delta2 = 0;
     
     // for scaling the output
     int maxPixelValue = 0;
     
     for(int i=0; i<nRows; i++) {
-        for(int j=0; j<nCols; j++) {
-            // pad outermost ring of pixels with 0's
-            if (i==0 || i==nRows-1 || j==0 || j==nCols-1) {
-                output->setPixel(i, j, 0);
+        U *out = output.row(i);
+        
+        // pad outermost ring of pixels with 0's
+        if (i==0 || i==nRows-1) {
+            for(int j=0; j<nCols; j++) {
+                out[j] = 0;
             }
-            else {
-                if (i==1 & j==1) {
-                    NW = im->getPixel(i-1, j-1);
-                    N = im->getPixel(i-1, j);
-                    NE = im->getPixel(i-1, j+1);
-                    E = im->getPixel(i, j+1);
-                    SE = im->getPixel(i+1, j+1);
-                    S = im->getPixel(i+1, j);
-                    SW = im->getPixel(i+1, j-1);
-                    W = im->getPixel(i, j-1);
-                }
-                delta1 = -NW + NE + 2*E + SE - SW -2*W;
-                delta2 = NE + 2*N + NE - SE -2*S - SW;
-                newCurrent = int(sqrt(pow(delta1,2) + pow(delta2,2))+0.5);
-                output->setPixel(i, j, newCurrent);
-                
-                // for scaling the output
-                if (newCurrent > maxPixelValue) {
-                    maxPixelValue = newCurrent;
-                }
-                
-                // reassign pixel values
-                NW = N;
-                W = im->getPixel(i, j);
-                SW = S;
-                N = NE;
-                S = SE;
-                NE = im->getPixel(i-1, j+2);
-                E = im->getPixel(i, j+2);
-                SE = im->getPixel(i+1, j+2);
+            continue;
+        }
+        out[0] = 0;
+        out[nCols-1] = 0;
+        
+        const T *above = im.row(i-1);
+        const T *middle = im.row(i);
+        const T *below = im.row(i+1);
+        
+        for(int j=1; j<nCols-1; j++) {
+            newCurrent = sobelAt(above, middle, below, j);
+            out[j] = U(newCurrent);
+            
+            // for scaling the output
+            if (newCurrent > maxPixelValue) {
+                maxPixelValue = newCurrent;
             }
         }
     }
@@ -873,13 +1944,185 @@ int applySobelOperator(Image *im, Image *output) {
 }
 
 /******************************************************************************************
- * HoughTransform
+ * GaussianRowFilter
  ******************************************************************************************/
-int HoughTransform(Image *im, Image *output) {
-    int nRows = im->getNRows();
-    int nCols = im->getNCols();
-    int i,j,t;
+template <typename T>
+int GaussianRowFilter<T>::start(int columns) {
+    if (columns<=0) {
+        fprintf(stderr, "GaussianRowFilter: columns must be positive\n");
+        return -1;
+    }
+    Ncols=columns;
+    rowsIn=0;
+    rowsOut=0;
+    padded.setSize(1, columns, 2, true);
+    padded.fillHalo(BORDER_ZERO);
+    filtered.setSize(5, columns);
+    zeros.setSizeAndInitialize(1, columns);
+    return 0;
+}
+
+/* produces row rowsOut from the filtered rows around it; rows outside the image are 0's */
+template <typename T>
+void GaussianRowFilter<T>::produceRow(T *dst) {
+    const T *rows[5];
+    for(int k=0; k<5; k++) {
+        int r = rowsOut - 2 + k;
+        rows[k] = (r < 0 || r >= rowsIn) ? zeros.row(0) : filtered.row(r % 5);
+    }
+    
+    // convolve Gaussian mask with columns of the filtered rows
+    for(int j=0; j<Ncols; j++) {
+        int sum = int(rows[0][j]) + int(rows[1][j])*4 + int(rows[2][j])*6
+                  + int(rows[3][j])*4 + int(rows[4][j]);
+        dst[j] = T((sum + 8) / 16);
+    }
+    rowsOut++;
+}
+
+template <typename T>
+int GaussianRowFilter<T>::filterRows(ImageView<const T> band, ImageView<T> out) {
+    if (band.getNRows()==0) {
+        return 0;
+    }
+    if (band.getNCols()!=Ncols || out.getNCols()!=Ncols || out.getNRows() < band.getNRows()) {
+        fprintf(stderr, "GaussianRowFilter: band size differs from image size\n");
+        return -1;
+    }
+    int produced = 0;
+    
+    for(int i=0; i<band.getNRows(); i++) {
+        // convolve Gaussian mask with the row; the zero halo stands for pixels outside the image
+        T *src = padded.row(0);
+        memcpy(src, band.row(i), sizeof(T) * Ncols);
+        T *dst = filtered.row(rowsIn % 5);
+        for(int j=0; j<Ncols; j++) {
+            int sum = int(src[j-2]) + int(src[j-1])*4 + int(src[j])*6 + int(src[j+1])*4 + int(src[j+2]);
+            dst[j] = T((sum + 8) / 16);
+        }
+        rowsIn++;
+        
+        // the row 2 rows above is finished; it is stored no later than the row just read,
+        // so out may be band
+        if (rowsIn - rowsOut > 2) {
+            produceRow(out.row(produced++));
+        }
+    }
+    return produced;
+}
+
+template <typename T>
+int GaussianRowFilter<T>::finish(ImageView<T> out) {
+    int produced = 0;
+    
+    if (rowsIn > rowsOut && (out.getNCols()!=Ncols || out.getNRows() < rowsIn - rowsOut)) {
+        fprintf(stderr, "GaussianRowFilter: output too small\n");
+        return -1;
+    }
+    while (rowsOut < rowsIn) {
+        produceRow(out.row(produced++));
+    }
+    return produced;
+}
+
+/******************************************************************************************
+ * StencilRowFilter
+ ******************************************************************************************/
+template <typename T, typename U>
+int StencilRowFilter<T, U>::start(StencilOperator stencil, int columns, int maxPixelValue) {
+    if (columns<=0) {
+        fprintf(stderr, "StencilRowFilter: columns must be positive\n");
+        return -1;
+    }
+    op=stencil;
+    Ncols=columns;
+    rowsIn=0;
+    rowsOut=0;
+    scale=(maxPixelValue > 0) ? maxPixelValue : 0;
+    this->maxPixelValue=0;
+    window.setSize(3, columns);
+    return 0;
+}
+
+/* produces row rowsOut from the rows around it; border rows and columns are 0's */
+template <typename T, typename U>
+void StencilRowFilter<T, U>::produceRow(U *dst, bool border) {
+    int i = rowsOut++;
+    
+    // pad outermost ring of pixels with 0's
+    if (border) {
+        for(int j=0; j<Ncols; j++) {
+            dst[j] = 0;
+        }
+        return;
+    }
+    dst[0] = 0;
+    dst[Ncols-1] = 0;
+    
+    const T *above = window.row((i-1) % 3);
+    const T *middle = window.row(i % 3);
+    const T *below = window.row((i+1) % 3);
+    
+    for(int j=1; j<Ncols-1; j++) {
+        int newCurrent = (op==SOBEL_OPERATOR) ? sobelAt(above, middle, below, j)
+                                              : laplacianAt(above, middle, below, j);
+        U value = U(newCurrent);
+        if (scale > 0) {
+            // scale like scalePixelValues
+            value = U(int(int(value)*255.0/scale + 0.5));
+        }
+        dst[j] = value;
+        if (newCurrent > maxPixelValue) {
+            maxPixelValue = newCurrent;
+        }
+    }
+}
+
+template <typename T, typename U>
+int StencilRowFilter<T, U>::filterRows(ImageView<const T> band, ImageView<U> out) {
+    if (band.getNRows()==0) {
+        return 0;
+    }
+    if (band.getNCols()!=Ncols || out.getNCols()!=Ncols || out.getNRows() < band.getNRows()) {
+        fprintf(stderr, "StencilRowFilter: band size differs from image size\n");
+        return -1;
+    }
+    int produced = 0;
     
+    for(int i=0; i<band.getNRows(); i++) {
+        memcpy(window.row(rowsIn % 3), band.row(i), sizeof(T) * Ncols);
+        rowsIn++;
+        
+        // the row above is finished; the first row of the image is a border row
+        if (rowsIn - rowsOut > 1) {
+            produceRow(out.row(produced++), rowsOut==0);
+        }
+    }
+    return produced;
+}
+
+template <typename T, typename U>
+int StencilRowFilter<T, U>::finish(ImageView<U> out) {
+    if (rowsOut == rowsIn) {
+        return 0;
+    }
+    if (out.getNCols()!=Ncols || out.getNRows() < 1) {
+        fprintf(stderr, "StencilRowFilter: output too small\n");
+        return -1;
+    }
+    // the last row of the image is a border row
+    produceRow(out.row(0), true);
+    return 1;
+}
+
+/******************************************************************************************
+ * startHoughTransform
+ ******************************************************************************************/
+/* sets the size of Hough image output for an image of nRows x nCols pixels and initializes all
+   pixels to 0; fills cosines and sines with cos and sin of the theta of every column of output;
+   returns numOfRhoUnits, the shift of rho values */
+template <typename U>
+static int startHoughTransform(int nRows, int nCols, Image<U> *output, vector<double> &cosines, vector<double> &sines) {
     int numOfRhoUnits = int(sqrt(pow(nRows,2)+pow(nCols,2)) + 0.5);
     int numOtThetaUnits = 180 * 5;
     
@@ -887,40 +2130,105 @@ int HoughTransform(Image *im, Image *output) {
     output->setSizeAndInitialize(3*numOfRhoUnits, numOtThetaUnits);
     output->setColors(255);
     output->setRhoShift(numOfRhoUnits);
+    
+    cosines.resize(numOtThetaUnits);
+    sines.resize(numOtThetaUnits);
+    for (int t=0; t<numOtThetaUnits; t++) {
+        cosines[t] = cos(t*M_PI/numOtThetaUnits);
+        sines[t] = sin(t*M_PI/numOtThetaUnits);
+    }
+    return numOfRhoUnits;
+}
+
+/******************************************************************************************
+ * voteForLines
+ ******************************************************************************************/
+/* adds the votes of pixel (i, j) for all lines through it to Hough image output and updates
+   maxPixelValue, the largest vote */
+template <typename U>
+static inline void voteForLines(int i, int j, const vector<double> &cosines, const vector<double> &sines, int numOfRhoUnits, Image<U> *output, int &maxPixelValue) {
+    int numOtThetaUnits = int(cosines.size());
+    int possibleMaxPixelValue;
+    
+    for (int t=0; t<numOtThetaUnits; t++) {
+        int rho = int(i * cosines[t] + j * sines[t] + 0.5) + numOfRhoUnits;
+        if (rho >= 3 * numOfRhoUnits || rho < 0) {
+            continue;
+        }
+        
+        //possibleMaxPixelValue = output->incrementPatchAroundPixel(rho, t);
+        possibleMaxPixelValue = int(++(*output)(rho, t));
+        if (possibleMaxPixelValue > maxPixelValue) {
+            maxPixelValue = possibleMaxPixelValue;
+        }
+    }
+}
+
+/******************************************************************************************
+ * finishHoughTransform
+ ******************************************************************************************/
+template <typename U>
+static void finishHoughTransform(Image<U> *output, int maxPixelValue, bool scaleVotes) {
+    if (scaleVotes) {
+        scalePixelValues(output, maxPixelValue);
+    }
+    else {
+        output->setColors(maxPixelValue > 0 ? maxPixelValue : 1);
+    }
+}
 
+/******************************************************************************************
+ * HoughTransform
+ ******************************************************************************************/
+template <typename T, typename U>
+int HoughTransform(Image<T> *im, Image<U> *output, bool scaleVotes) {
+    int nRows = im->getNRows();
+    int nCols = im->getNCols();
+    int i,j;
+    
+    vector<double> cosines, sines;
+    int numOfRhoUnits = startHoughTransform(nRows, nCols, output, cosines, sines);
     int maxPixelValue = 0;
-    int possibleMaxPixelValue = 0;
     
     // iterate through image im
     for (i=0; i<nRows; i++) {
+        const T *pixels = im->row(i);
         for (j=0; j<nCols; j++) {
-            if (im->getPixel(i, j) != 0) {
-
-                for (t=0; t<numOtThetaUnits; t++) {
-                    int rho = int(i * cos(t*M_PI/numOtThetaUnits) + j * sin(t*M_PI/numOtThetaUnits) + 0.5) + numOfRhoUnits;
-                    if (rho >= 3 * numOfRhoUnits || rho < 0) {
-                        continue;
-                    }
-                    
-                    //possibleMaxPixelValue = output->incrementPatchAroundPixel(rho, t);
-                    possibleMaxPixelValue = output->incrementPixel(rho, t);
-                    if (possibleMaxPixelValue > maxPixelValue) {
-                        maxPixelValue = possibleMaxPixelValue;
-                    }
-                }
+            if (pixels[j] != 0) {
+                voteForLines(i, j, cosines, sines, numOfRhoUnits, output, maxPixelValue);
             }
         }
     }
     
-    scalePixelValues(output, maxPixelValue);
+    finishHoughTransform(output, maxPixelValue, scaleVotes);
+    return 0;
+}
 
+/******************************************************************************************
+ * HoughTransform - overloaded for packed binary images
+ ******************************************************************************************/
+template <typename U>
+int HoughTransform(const BinaryImage *im, Image<U> *output, bool scaleVotes) {
+    vector<double> cosines, sines;
+    int numOfRhoUnits = startHoughTransform(im->getNRows(), im->getNCols(), output, cosines, sines);
+    int maxPixelValue = 0;
+    
+    // only the pixels that are 1 vote
+    for (int i=0; i<im->getNRows(); i++) {
+        im->forEachPixelInRow(i, [&](int j) {
+            voteForLines(i, j, cosines, sines, numOfRhoUnits, output, maxPixelValue);
+        });
+    }
+    
+    finishHoughTransform(output, maxPixelValue, scaleVotes);
     return 0;
 }
 
 /******************************************************************************************
  * setRhoShiftForHoughImage
  ******************************************************************************************/
-int setRhoShiftForHoughImage(Image *im, Image *Hough) {
+template <typename T, typename U>
+int setRhoShiftForHoughImage(Image<T> *im, Image<U> *Hough) {
     int numOfRhoUnits = int(sqrt(pow(im->getNRows(),2)+pow(im->getNCols(),2)) + 0.5);
     Hough->setRhoShift(numOfRhoUnits);
     return 0;
@@ -929,28 +2237,38 @@ int setRhoShiftForHoughImage(Image *im, Image *Hough) {
 /******************************************************************************************
  * findLocalMaxima
  ******************************************************************************************/
-int findLocalMaxima(Image *Hough, HoughDatabase &db) {
-    // 1. make a copy of hough, make it binary, label
-    Image *temp;
-    temp = new Image(*Hough, true);
-    // writeImage(temp, "Hough_T_B.pgm");
-    assert(temp != 0);
+template <typename T>
+int findLocalMaxima(Image<T> *Hough, HoughDatabase &db) {
+    // 1. make a copy of hough (in a scratch image), make it binary, label
+    ScratchImage<int32_t> tempScratch(Hough->getNRows(), Hough->getNCols());
+    Image<int32_t> &temp = tempScratch.image();
+    for(int i=0; i<Hough->getNRows(); i++) {
+        const T *votes = Hough->row(i);
+        int32_t *bits = temp.row(i);
+        for(int j=0; j<Hough->getNCols(); j++) {
+            bits[j] = (votes[j]==0) ? 0 : 1;
+        }
+    }
+    temp.setColors(1);
+    // writeImage(&temp, "Hough_T_B.pgm");
     
-    labelBinaryImage(temp);
-    //writeImage(temp, "Hough_T_B_L.pgm");
+    labelBinaryImageParallel(&temp); /* a Hough image has millions of pixels */
+    //writeImage(&temp, "Hough_T_B_L.pgm");
 
-    int numOfColors = temp->getColors();
-    int nRows = temp->getNRows();
-    int nCols = temp->getNCols();
+    int numOfColors = temp.getColors();
+    int nRows = temp.getNRows();
+    int nCols = temp.getNCols();
     int objLabel, pixVal;
     
     db.initializeRecords(numOfColors);
 
     for(int i=0; i<nRows; i++) {
+        const int32_t *labels = temp.row(i);
+        const T *votes = Hough->row(i);
         for(int j=0; j<nCols; j++) {
-            objLabel = temp->getPixel(i, j);
+            objLabel = labels[j];
             if (objLabel != 0) {
-                pixVal = Hough->getPixel(i, j);
+                pixVal = int(votes[j]);
                 db.updateSums(objLabel, i, j, pixVal);
             }
         }
@@ -968,7 +2286,8 @@ int findLocalMaxima(Image *Hough, HoughDatabase &db) {
 /******************************************************************************************
  * addPositionAndOrientation
  ******************************************************************************************/
-int addPositionAndOrientation(Image *im, Database &db, bool recognizedOnly) {
+template <typename T>
+int addPositionAndOrientation(Image<T> *im, Database &db, bool recognizedOnly) {
     vector<Database::Record> objects = db.getRecords( );
     int numOfObjects = int(objects.size( ));
     int x0, y0, x1, y1;
@@ -990,11 +2309,7 @@ int addPositionAndOrientation(Image *im, Database &db, bool recognizedOnly) {
         line(im, x0, y0, x1, y1, 0);
         
         // draw point (position)
-        for (int k=x0-1; k<=x0+1; k++) {
-            for (int j=y0-1; j<=y0+1; j++) {
-                im->setPixel(k, j, 0);
-            }
-        }
+        im->view(x0-1, y0-1, 3, 3).fill(0);
     }
     return 0;
 }
@@ -1002,8 +2317,9 @@ int addPositionAndOrientation(Image *im, Database &db, bool recognizedOnly) {
 /******************************************************************************************
  * drawLines
  ******************************************************************************************/
-int drawLines(Image *im, HoughDatabase &db) {
-    vector<HoughDatabase::Record> objects = db.getRecords( );
+template <typename T>
+int drawLines(Image<T> *im, HoughDatabase &db) {
+    const vector<HoughDatabase::Record> &objects = db.getRecords( );
     int numOfObjects = int(objects.size( ));
     int x ,y, xMax, yMax;
     double rho, theta, sinTheta, cosTheta;
@@ -1016,29 +2332,30 @@ int drawLines(Image *im, HoughDatabase &db) {
         theta = objects[i].theta * M_PI / 180;
         sinTheta = sin(theta);
         cosTheta = cos(theta);
-        vector<int> coords;
+        int coords[8]; /* up to 4 intersections with the image border */
+        int numOfCoords = 0;
         
         // case 1
         x = 0;
         y = int(rho / sinTheta + 0.5);
         if ( x>=0 && x<=xMax && y>=0 && y<=yMax) {
-            coords.push_back(x);
-            coords.push_back(y);
+            coords[numOfCoords++] = x;
+            coords[numOfCoords++] = y;
         }
         
         // case 2
         x = xMax;
         y = int((rho - x * cosTheta) / sinTheta + 0.5);
         if ( x>=0 && x<=xMax && y>=0 && y<=yMax) {
-            if (coords.size() == 2) {
+            if (numOfCoords == 2) {
                 if (x!=coords[0] && y!=coords[1]) {
-                    coords.push_back(x);
-                    coords.push_back(y);
+                    coords[numOfCoords++] = x;
+                    coords[numOfCoords++] = y;
                 }
             }
             else {
-                coords.push_back(x);
-                coords.push_back(y);
+                coords[numOfCoords++] = x;
+                coords[numOfCoords++] = y;
             }
         }
         
@@ -1046,15 +2363,15 @@ int drawLines(Image *im, HoughDatabase &db) {
         y = 0;
         x = int(rho / cosTheta + 0.5);
         if ( x>=0 && x<=xMax && y>=0 && y<=yMax) {
-            if (coords.size() == 2) {
+            if (numOfCoords == 2) {
                 if (x!=coords[0] && y!=coords[1]) {
-                    coords.push_back(x);
-                    coords.push_back(y);
+                    coords[numOfCoords++] = x;
+                    coords[numOfCoords++] = y;
                 }
             }
             else {
-                coords.push_back(x);
-                coords.push_back(y);
+                coords[numOfCoords++] = x;
+                coords[numOfCoords++] = y;
             }
         }
         
@@ -1062,20 +2379,20 @@ int drawLines(Image *im, HoughDatabase &db) {
         y = yMax;
         x = int((rho - y * sinTheta) / cosTheta + 0.5);
         if ( x>=0 && x<=xMax && y>=0 && y<=yMax) {
-            if (coords.size() == 2) {
+            if (numOfCoords == 2) {
                 if (x!=coords[0] && y!=coords[1]) {
-                    coords.push_back(x);
-                    coords.push_back(y);
+                    coords[numOfCoords++] = x;
+                    coords[numOfCoords++] = y;
                 }
             }
             else {
-                coords.push_back(x);
-                coords.push_back(y);
+                coords[numOfCoords++] = x;
+                coords[numOfCoords++] = y;
             }
         }
         
         // draw line
-        if (coords.size() >= 4) {
+        if (numOfCoords >= 4) {
             line(im, coords[0], coords[1], coords[2], coords[3], 255);
         }
         
@@ -1084,10 +2401,12 @@ int drawLines(Image *im, HoughDatabase &db) {
 }
 
 /******************************************************************************************
- * drawLines - overloaded to draw only edges
+ * drawLineSegments
  ******************************************************************************************/
-int drawLines(Image *im, HoughDatabase &db, Image *sobel) {
-    vector<HoughDatabase::Record> objects = db.getRecords( );
+/* draws detected lines only over pixels of edge mask sobel (an Image or a BinaryImage) that are not 0 */
+template <typename T, typename Mask>
+static int drawLineSegments(Image<T> *im, HoughDatabase &db, Mask *sobel) {
+    const vector<HoughDatabase::Record> &objects = db.getRecords( );
     int numOfObjects = int(objects.size( ));
     int x ,y, xMax, yMax;
     double rho, theta, sinTheta, cosTheta;
@@ -1100,29 +2419,30 @@ int drawLines(Image *im, HoughDatabase &db, Image *sobel) {
         theta = objects[i].theta * M_PI / 180;
         sinTheta = sin(theta);
         cosTheta = cos(theta);
-        vector<int> coords;
+        int coords[8]; /* up to 4 intersections with the image border */
+        int numOfCoords = 0;
         
         // case 1
         x = 0;
         y = int(rho / sinTheta + 0.5);
         if ( x>=0 && x<=xMax && y>=0 && y<=yMax) {
-            coords.push_back(x);
-            coords.push_back(y);
+            coords[numOfCoords++] = x;
+            coords[numOfCoords++] = y;
         }
         
         // case 2
         x = xMax;
         y = int((rho - x * cosTheta) / sinTheta + 0.5);
         if ( x>=0 && x<=xMax && y>=0 && y<=yMax) {
-            if (coords.size() == 2) {
+            if (numOfCoords == 2) {
                 if (x!=coords[0] && y!=coords[1]) {
-                    coords.push_back(x);
-                    coords.push_back(y);
+                    coords[numOfCoords++] = x;
+                    coords[numOfCoords++] = y;
                 }
             }
             else {
-                coords.push_back(x);
-                coords.push_back(y);
+                coords[numOfCoords++] = x;
+                coords[numOfCoords++] = y;
             }
         }
         
@@ -1130,15 +2450,15 @@ int drawLines(Image *im, HoughDatabase &db, Image *sobel) {
         y = 0;
         x = int(rho / cosTheta + 0.5);
         if ( x>=0 && x<=xMax && y>=0 && y<=yMax) {
-            if (coords.size() == 2) {
+            if (numOfCoords == 2) {
                 if (x!=coords[0] && y!=coords[1]) {
-                    coords.push_back(x);
-                    coords.push_back(y);
+                    coords[numOfCoords++] = x;
+                    coords[numOfCoords++] = y;
                 }
             }
             else {
-                coords.push_back(x);
-                coords.push_back(y);
+                coords[numOfCoords++] = x;
+                coords[numOfCoords++] = y;
             }
         }
         
@@ -1146,20 +2466,20 @@ int drawLines(Image *im, HoughDatabase &db, Image *sobel) {
         y = yMax;
         x = int((rho - y * sinTheta) / cosTheta + 0.5);
         if ( x>=0 && x<=xMax && y>=0 && y<=yMax) {
-            if (coords.size() == 2) {
+            if (numOfCoords == 2) {
                 if (x!=coords[0] && y!=coords[1]) {
-                    coords.push_back(x);
-                    coords.push_back(y);
+                    coords[numOfCoords++] = x;
+                    coords[numOfCoords++] = y;
                 }
             }
             else {
-                coords.push_back(x);
-                coords.push_back(y);
+                coords[numOfCoords++] = x;
+                coords[numOfCoords++] = y;
             }
         }
         
         // draw line (orientation)
-        if (coords.size() >= 4) {
+        if (numOfCoords >= 4) {
             line(im, coords[0], coords[1], coords[2], coords[3], 255, sobel);
         }
         
@@ -1167,45 +2487,214 @@ int drawLines(Image *im, HoughDatabase &db, Image *sobel) {
     return 0;
 }
 
+/******************************************************************************************
+ * drawLines - overloaded to draw only edges
+ ******************************************************************************************/
+template <typename T, typename U>
+int drawLines(Image<T> *im, HoughDatabase &db, Image<U> *sobel) {
+    return drawLineSegments(im, db, sobel);
+}
+
+/******************************************************************************************
+ * drawLines - overloaded to draw only edges of a packed binary mask
+ ******************************************************************************************/
+template <typename T>
+int drawLines(Image<T> *im, HoughDatabase &db, const BinaryImage *sobel) {
+    return drawLineSegments(im, db, sobel);
+}
+
 /******************************************************************************************
  * writeImage
  ******************************************************************************************/
-int writeImage(const Image *im, const char *fname) {
+template <typename T>
+int writeImage(const Image<T> *im, const char *fname) {
     FILE *output;
     int nRows;
     int nCols;
-    int colors;
+    
+    /* open the file */
+    if (!fname || (output=openFile(fname,"wb"))==0) {
+        fprintf(stderr, "writeImage: cannot open file\n");
+        return(-1);
+    }
+    nRows=im->getNRows();
+    nCols=im->getNCols();
+    
+    fprintf(stderr, "Saving image of size %d %d\n", nRows, nCols);
+    /* write the header and the pixels */
+    if (writePgmHeader(output, nRows, nCols, im->getColors())!=0
+        || writePgmRows(output, im->view(), im->getColors())!=0) {
+        closeFile(output);
+        return -1;
+    }
+    
+    /* close the file */
+    if (closeFile(output)!=0) {
+        fprintf(stderr, "writeImage: could not write\n");
+        return -1;
+    }
+    return 0; /* OK */
+}
+
+/******************************************************************************************
+ * writeLabeledImage
+ ******************************************************************************************/
+template <typename T>
+int writeLabeledImage(const Image<T> *im, const char *fname) {
+    FILE *output;
+    int nRows = im->getNRows(), nCols = im->getNCols();
+    int colors = im->getColors();
     int i, j;
     
+    if (colors <= 65535) {
+        return writeImage(im, fname);
+    }
+    
+    /* open the file */
+    if (!fname || (output=openFile(fname,"wb"))==0) {
+        fprintf(stderr, "writeImage: cannot open file\n");
+        return(-1);
+    }
+    
+    fprintf(stderr, "Saving image of size %d %d\n", nRows, nCols);
+    /* write the header (PGM stops at 65535 gray levels, so it is written here) */
+    if (fprintf(output,"P5\n#\n%d %d\n%03d\n",nCols,nRows,colors)<0) {
+        fprintf(stderr, "writeImage: could not write\n");
+        closeFile(output);
+        return -1;
+    }
+    
+    /* write 32-bit pixels row by row, most significant byte first */
+    vector<uint8_t> bytes(size_t(nCols) * 4);
+    for(i=0; i<nRows; i++) {
+        const T *pixels = im->row(i);
+        for(j=0; j<nCols; j++) {
+            uint32_t value = (pixels[j] <= 0) ? 0 : uint32_t(pixels[j]);
+            bytes[4*j] = uint8_t(value >> 24);
+            bytes[4*j+1] = uint8_t(value >> 16);
+            bytes[4*j+2] = uint8_t(value >> 8);
+            bytes[4*j+3] = uint8_t(value & 0xFF);
+        }
+        if (fwrite(&bytes[0], 4, nCols, output)!=size_t(nCols)) /* couldn't write */ {
+            fprintf(stderr, "writeImage: could not write\n");
+            closeFile(output);
+            return -1;
+        }
+    }
+    
+    /* close the file */
+    if (closeFile(output)!=0) {
+        fprintf(stderr, "writeImage: could not write\n");
+        return -1;
+    }
+    return 0; /* OK */
+}
+
+/******************************************************************************************
+ * writeImage - overloaded for packed binary images
+ ******************************************************************************************/
+int writeImage(const BinaryImage *im, const char *fname) {
+    FILE *output;
+    int nRows, nCols;
+    int i;
+    
+    /* .pbm files get 1 bit per pixel, anything else a PGM image with 1 color */
+    size_t length = fname ? strlen(fname) : 0;
+    bool pbm = (length >= 4 && strcmp(fname + length - 4, ".pbm")==0);
+    
     /* open the file */
-    if (!fname || (output=fopen(fname,"w"))==0) {
-        printf("writeImage: cannot open file\n");
+    if (!fname || (output=openFile(fname,"wb"))==0) {
+        fprintf(stderr, "writeImage: cannot open file\n");
         return(-1);
     }
     nRows=im->getNRows();
     nCols=im->getNCols();
-    colors=im->getColors();
     
-    printf("Saving image of size %d %d\n", nRows, nCols);
+    fprintf(stderr, "Saving image of size %d %d\n", nRows, nCols);
     /* write the header */
-    fprintf(output,"P5\n"); /* magic number */
+    fprintf(output, pbm ? "P4\n" : "P5\n"); /* magic number */
     fprintf(output,"#\n");  /* empty comment */
-    fprintf(output,"%d %d\n%03d\n",nCols,nRows,colors); /* image info */
+    if (pbm) {
+        fprintf(output,"%d %d\n",nCols,nRows); /* image info */
+    }
+    else {
+        fprintf(output,"%d %d\n%03d\n",nCols,nRows,1); /* image info */
+    }
     
     /* write pixels row by row */
-    for(i=0; i<nRows; i++)  {
-        for(j=0; j<nCols; j++) {
-            int byte=im->getPixel(i,j);
-            if (fputc(byte,output)==EOF) /* couldn't write */ {
-                fclose(output);
-                printf("writeImage: could not write\n");
-                return -1;
-            }
+    int rowSize = pbm ? (nCols + 7) / 8 : nCols;
+    ScratchImage<uint8_t> bufferScratch(1, (rowSize==0) ? 1 : rowSize);
+    uint8_t *bytes = bufferScratch.image().row(0);
+    for(i=0; i<nRows && rowSize>0; i++) {
+        if (pbm) {
+            wordsToPbmRow(im->row(i), rowSize, bytes);
+        }
+        else {
+            unpackWordRow(im->row(i), nCols, bytes);
+        }
+        if (fwrite(bytes, 1, rowSize, output)!=size_t(rowSize)) /* couldn't write */ {
+            closeFile(output);
+            fprintf(stderr, "writeImage: could not write\n");
+            return -1;
         }
     }
     
     /* close the file */
-    fclose(output);
+    if (closeFile(output)!=0) {
+        fprintf(stderr, "writeImage: could not write\n");
+        return -1;
+    }
     return 0; /* OK */
 }
 
+/******************************************************************************************
+ * explicit instantiations for supported pixel types
+ ******************************************************************************************/
+#define INSTANTIATE_PGM_FUNCTIONS(T) \
+    template int readPgmPixels(FILE *input, Image<T> *im, int levels, Histogram *histogram); \
+    template int readImage(Image<T> *im, const char *fname); \
+    template int readImage(Image<T> *im, FILE *input); \
+    template int readAsBinaryImage(Image<T> *im, const char *fname, const Threshold &threshold); \
+    template int readAsBinaryImage(Image<T> *im, FILE *input, const Threshold &threshold); \
+    template int readAndLabelBinaryImage(Image<T> *im, const char *fname); \
+    template int readAndLabelBinaryImage(Image<T> *im, FILE *input); \
+    template int labelBinaryImage(Image<T> *im); \
+    template int labelBinaryImageParallel(Image<T> *im, int numThreads, bool canonicalLabels); \
+    template int labelBinaryImage(const BinaryImage *binary, Image<T> *im); \
+    template int labelBinaryImage(const RunLengthImage *runs, Image<T> *im); \
+    template int labelAndMeasureBinaryImage(const BinaryImage *binary, Image<T> *im, Database &db); \
+    template int readLabeledImage(Image<T> *im, const char *fname, Database &db); \
+    template int readLabeledImage(Image<T> *im, FILE *input, Database &db); \
+    template int readAndThresholdImage(Image<T> *im, const char *fname, const Threshold &threshold); \
+    template int thresholdImage(Image<T> *im, int threshold); \
+    template int thresholdImage(ImageView<T> im, int threshold); \
+    template int thresholdAndMakeBinaryImage(Image<T> *im, int threshold); \
+    template int thresholdAndMakeBinaryImage(ImageView<T> im, int threshold); \
+    template int thresholdAndMakeBinaryImage(ImageView<const T> im, int threshold, BinaryImage *output); \
+    template int apply5x5GaussianFilter(Image<T> *im); \
+    template int apply5x5GaussianFilter(ImageView<T> im); \
+    template int scalePixelValues(Image<T> *im, int maxPixelValue); \
+    template int scalePixelValues(ImageView<T> im, int maxPixelValue); \
+    template int PgmRowReader::readRows(Image<T> *band, int maxRows); \
+    template int PgmRowWriter::writeRows(ImageView<const T> band); \
+    template class GaussianRowFilter<T>; \
+    template int findLocalMaxima(Image<T> *Hough, HoughDatabase &db); \
+    template int addPositionAndOrientation(Image<T> *im, Database &db, bool recognizedOnly); \
+    template int drawLines(Image<T> *im, HoughDatabase &db); \
+    template int drawLines(Image<T> *im, HoughDatabase &db, const BinaryImage *sobel); \
+    template int HoughTransform(const BinaryImage *im, Image<T> *output, bool scaleVotes); \
+    template int writeImage(const Image<T> *im, const char *fname); \
+    template int writeLabeledImage(const Image<T> *im, const char *fname); \
+    FOR_EACH_PIXEL_TYPE_2(INSTANTIATE_PGM_FUNCTIONS_2, T)
+
+#define INSTANTIATE_PGM_FUNCTIONS_2(T, U) \
+    template int applyLaplacian(Image<T> *im, Image<U> *output); \
+    template int applyLaplacian(ImageView<const T> im, ImageView<U> output); \
+    template int applySobelOperator(Image<T> *im, Image<U> *output); \
+    template int applySobelOperator(ImageView<const T> im, ImageView<U> output); \
+    template class StencilRowFilter<T, U>; \
+    template int HoughTransform(Image<T> *im, Image<U> *output, bool scaleVotes); \
+    template int setRhoShiftForHoughImage(Image<T> *im, Image<U> *Hough); \
+    template int drawLines(Image<T> *im, HoughDatabase &db, Image<U> *sobel);
+
+FOR_EACH_PIXEL_TYPE(INSTANTIATE_PGM_FUNCTIONS)
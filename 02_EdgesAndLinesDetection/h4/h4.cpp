@@ -5,12 +5,18 @@
  Description    : The program finds lines in the image from its Hough Transform space using 
                   a given threshold and draws the detected lines on a copy of the original 
                   scene image.
- Usage          : ./h4 <arg1> <arg2> <arg3> <arg4>
+ Usage          : ./h4 <arg1> <arg2> <arg3> <arg4> [<arg5>]
                   where:
                   <arg1> is an input original gray-level image
                   <arg2> is an input gray-level Hough image
-                  <arg3> is an input gray-level Hough threshold value
+                  <arg3> is an input gray-level Hough threshold value, or auto (chosen
+                         for the Hough image with Otsu's method) or auto:P (the P-th
+                         percentile of its gray levels)
                   <arg4> is an output gray-level line image
+                  <arg5> is an output gray-level edge-limited line image
+                         (edges.pgm if omitted)
+ Batch usage    : ./h4 -batch <inputs> <arg2> <arg3> <arg4> [<arg5>]
+                  runs the program on every image of <inputs> (see showUsage)
  Comments       : Hough image is thrsholded  and saved as a grey-level image and its binary 
                   copy. The objects in the binary copy are labeled, and a HoughDatabase
                   object is used to record all "areas of brightness" weights and weighted
@@ -29,7 +35,9 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <cstring>
 #include "Image.h"
+#include "Batch.h"
 #include "DisjSets.h"
 #include "HoughDatabase.h"
 #include "Database.h"
@@ -41,82 +49,187 @@ using namespace std;
  */
 void showUsage(string fileName);
 
+/**
+ * Runs the program on every image of a batch (see showUsage).
+ */
+int runBatch(int argc, char * argv[]);
+
 /******************************************************************************************
  * MAIN
  ******************************************************************************************/
 int main(int argc, char * argv[]) {
+
+    if (argc>1 && strcmp(argv[1], "-batch")==0) {
+        return runBatch(argc, argv);
+    }
     
-    if (argc!=5) {
+    if (argc!=5 && argc!=6) {
         showUsage(argv[0]);
         return 0;
     }
     
-    Image *input, *inputCopy, *Hough, *Sobel, *output;
-    input = new Image;
-    assert(input != 0);
-    Hough = new Image;
-    assert(Hough != 0);
-    Sobel = new Image;
-    assert(Sobel != 0);
-    output = new Image;
-    assert(output != 0);
+    Image<uint8_t> input, Hough;
+    Image<uint16_t> Sobel; /* Sobel magnitudes exceed 255 before scaling */
     
-    if (readImage(input, argv[1])) {
-        printf("Can't open file %s\n", argv[1]);
+    if (readImage(&input, argv[1])) {
+        fprintf(stderr, "Can't open file %s\n", argv[1]);
         return 0;
     }
     
-    inputCopy = new Image(*input);
-    assert(inputCopy != 0);
+    Image<uint8_t> inputCopy(input);
+    Threshold threshold;
+    if (threshold.parse(argv[3])) {
+        fprintf(stderr, "Invalid threshold %s\n", argv[3]);
+        return 0;
+    }
 
-    //writeImage(input, "input.pgm");
+    //writeImage(&input, "input.pgm");
 
-    if (readAndThresholdImage(Hough, argv[2], atoi(argv[3]))) {
-        printf("Can't open file %s\n", argv[2]);
+    if (readAndThresholdImage(&Hough, argv[2], threshold)) {
+        fprintf(stderr, "Can't open file %s\n", argv[2]);
         return 0;
     }
-    //writeImage(Hough, "Hough_T.pgm");
+    //writeImage(&Hough, "Hough_T.pgm");
 
-    setRhoShiftForHoughImage(input, Hough);
+    setRhoShiftForHoughImage(&input, &Hough);
     HoughDatabase db;
-    findLocalMaxima(Hough, db);
+    findLocalMaxima(&Hough, db);
     
     /* For drawing detected lines that do not extend beyond actual edges */
-    apply5x5GaussianFilter(input);
-    //writeImage(input, "input_G.pgm");
-    applySobelOperator(input, Sobel);
-    //writeImage(Sobel, "input_G_S.pgm");
-    apply5x5GaussianFilter(Sobel);
-    //writeImage(Sobel, "input_G_S_G.pgm");
-    thresholdAndMakeBinaryImage(Sobel, 15);
-    //writeImage(Sobel, "input_G_S_G_TB.pgm");
+    apply5x5GaussianFilter(&input);
+    //writeImage(&input, "input_G.pgm");
+    applySobelOperator(&input, &Sobel);
+    //writeImage(&Sobel, "input_G_S.pgm");
+    apply5x5GaussianFilter(&Sobel);
+    //writeImage(&Sobel, "input_G_S_G.pgm");
+    BinaryImage edges; /* thresholded Sobel mask, 1 bit per pixel */
+    thresholdAndMakeBinaryImage<uint16_t>(Sobel.view(), 15, &edges);
+    //writeImage(&edges, "input_G_S_G_TB.pbm");
     
-    drawLines(input, db);
-    drawLines(inputCopy, db, Sobel);
+    drawLines(&input, db);
+    drawLines(&inputCopy, db, &edges);
 
-    if (writeImage(input, argv[4])) {
-        printf("Can't write to file %s\n", argv[3]);
+    const char *edgesName = (argc==6) ? argv[5] : "edges.pgm";
+    if (writeImage(&input, argv[4])) {
+        fprintf(stderr, "Can't write to file %s\n", argv[4]);
         return 0;
     }
-    if (writeImage(inputCopy, "edges.pgm")) {
-        printf("Can't write to file %s\n", argv[3]);
+    if (writeImage(&inputCopy, edgesName)) {
+        fprintf(stderr, "Can't write to file %s\n", edgesName);
         return 0;
     }
     
     return 0;
 }
 
+/******************************************************************************************
+ * runBatch
+ ******************************************************************************************/
+int runBatch(int argc, char * argv[]) {
+    
+    if (argc!=6 && argc!=7) {
+        showUsage(argv[0]);
+        return 0;
+    }
+    
+    BatchTimer timer;
+    BatchInputs inputs;
+    if (inputs.open(argv[2])) {
+        return 0;
+    }
+    
+    /* decode the next original and Hough images while lines are found in the current ones */
+    Threshold threshold; /* an automatic one is chosen for every Hough image */
+    if (threshold.parse(argv[4])) {
+        fprintf(stderr, "Invalid threshold %s\n", argv[4]);
+        return 0;
+    }
+    struct Frame {
+        Image<uint8_t> input, Hough;
+    };
+    BatchPrefetcher<Frame> frames(inputs, [&](Frame *frame, FILE *input, int k) {
+        string HoughName = makeBatchName(argv[3], inputs.getName(k), k);
+        if (readImage(&frame->input, input)) {
+            return -1;
+        }
+        if (readAndThresholdImage(&frame->Hough, HoughName.c_str(), threshold)) {
+            fprintf(stderr, "Can't open file %s\n", HoughName.c_str());
+            return -1;
+        }
+        return 0;
+    });
+    Image<uint16_t> Sobel; /* Sobel magnitudes exceed 255 before scaling */
+    BinaryImage edges; /* thresholded Sobel mask, 1 bit per pixel */
+    Image<uint8_t> inputCopy; /* input for the edge-limited lines */
+    HoughDatabase db;
+    
+    Frame *frame;
+    int k, status;
+    while ((frame = frames.next(k, status)) != NULL) {
+        if (status) {
+            fprintf(stderr, "Can't load frame %d (%s)\n", k, inputs.getName(k).c_str());
+            timer.countFrame(false);
+            continue;
+        }
+        string outputName = makeBatchName(argv[5], inputs.getName(k), k);
+        Image<uint8_t> &input = frame->input;
+        inputCopy = input;
+        
+        setRhoShiftForHoughImage(&input, &frame->Hough);
+        db.clear();
+        findLocalMaxima(&frame->Hough, db);
+        
+        /* For drawing detected lines that do not extend beyond actual edges */
+        apply5x5GaussianFilter(&input);
+        applySobelOperator(&input, &Sobel);
+        apply5x5GaussianFilter(&Sobel);
+        thresholdAndMakeBinaryImage<uint16_t>(Sobel.view(), 15, &edges);
+        
+        drawLines(&input, db);
+        drawLines(&inputCopy, db, &edges);
+        
+        if (writeImage(&input, outputName.c_str())) {
+            fprintf(stderr, "Can't write to file %s\n", outputName.c_str());
+            timer.countFrame(false);
+            continue;
+        }
+        if (argc==7) {
+            string edgesName = makeBatchName(argv[6], inputs.getName(k), k);
+            if (writeImage(&inputCopy, edgesName.c_str())) {
+                fprintf(stderr, "Can't write to file %s\n", edgesName.c_str());
+                timer.countFrame(false);
+                continue;
+            }
+        }
+        timer.countFrame(true);
+    }
+    timer.report();
+    
+    return 0;
+}
+
 /******************************************************************************************
  * showUsage
  ******************************************************************************************/
 void showUsage(string fileName) {
     cout << "********************************************************************************\n"
-    << "Usage:\t" << fileName << " <arg1> <arg2> <arg3> <arg4>\n"
+    << "Usage:\t" << fileName << " <arg1> <arg2> <arg3> <arg4> [<arg5>]\n"
     << "********************************************************************************\n"
     << "where:\n"
     << "\t<arg1> is an input original gray-level image\n"
     << "\t<arg2> is an input gray-level Hough image\n"
-    << "\t<arg3> is an input gray-level Hough threshold value\n"
+    << "\t<arg3> is an input gray-level Hough threshold value, or auto (chosen for every Hough\n"
+    << "\timage with Otsu's method) or auto:P (the P-th percentile of its gray levels, 0 <= P <= 100)\n"
     << "\t<arg4> is an output gray-level line image\n"
-    << "example:\n\t" << fileName <<  " inputImage.pgm inputHoughImage.pgm 100 output.pgm\n";
+    << "\t<arg5> is an output gray-level edge-limited line image (edges.pgm if omitted)\n"
+    << "\t- as an image name reads stdin or writes stdout\n"
+    << "batch:\t" << fileName << " -batch <inputs> <arg2> <arg3> <arg4> [<arg5>]\n"
+    << "\t<inputs> is a directory, a quoted glob pattern, a numbered sequence such as frame_%05d.pgm,\n"
+    << "\t@list (a file listing images), or an image file or - holding one or more images;\n"
+    << "\toutput names (and other per-frame image names) are patterns: %s is the input name\n"
+    << "\twithout directory and extension, %d (or %05d) the frame number\n"
+    << "\t(in batch mode <arg2> is a pattern too, and the edge-limited images are saved only if <arg5> is given)\n"
+    << "example:\n\t" << fileName <<  " inputImage.pgm inputHoughImage.pgm 100 output.pgm\n"
+    << "\t" << fileName << " -batch 'frames/*.pgm' hough/%s_H.pgm 134 lines/%s_L.pgm\n"
+    << "\t" << fileName << " -batch 'frames/*.pgm' hough/%s_H.pgm auto:99.9 lines/%s_L.pgm\n";
 }
\ No newline at end of file
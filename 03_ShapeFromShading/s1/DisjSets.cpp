@@ -19,8 +19,9 @@ DisjSets::DisjSets( ) {
 }
 
 /**
- * Union two disjoint sets.
- * If root1 and root2 are in the same set, do nothing.
+ * Union two disjoint sets (union by rank).
+ * The root of the shorter tree is linked under the root of the taller one, so trees stay
+ * O(log n) deep. If root1 and root2 are in the same set, do nothing.
  */
 void DisjSets::unionSets( int root1, int root2 ) {
     if (root1!=0 && root2!=0) {
@@ -28,13 +29,14 @@ void DisjSets::unionSets( int root1, int root2 ) {
         r1 = find(root1);
         r2 = find(root2);
         if (r1!=r2) {
-            if (r1<r2) {
-                s[root2] = r1;
-                s[r2] = r1;
+            if (s[r2] < s[r1]) { /* r2 is taller */
+                s[r1] = r2;
             }
             else {
-                s[root1] = r2;
-                s[r1] = r2;
+                if (s[r1]==s[r2]) {
+                    s[r1]--;
+                }
+                s[r2] = r1;
             }
         }
     }
@@ -42,19 +44,22 @@ void DisjSets::unionSets( int root1, int root2 ) {
 
 
 /**
- * Perform a find.
+ * Perform a find with path halving: every other element on the path to the root is linked
+ * to its grandparent, so later finds are shorter. Iterative, so deep trees can't overflow
+ * the stack.
  * Return index of the set containing x if element is found, otherwise return -1.
  */
-int DisjSets::find( int x ) const {
-    if (x > 0) {
-        if( s[ x ] < 0 )
-            return x;
-        else
-            return find( s[ x ] );
-    }
-    else {
+int DisjSets::find( int x ) {
+    if (x <= 0) {
         return -1;
     }
+    while (s[x] >= 0) {
+        if (s[s[x]] >= 0) {
+            s[x] = s[s[x]];
+        }
+        x = s[x];
+    }
+    return x;
 }
 
 /**
@@ -64,6 +69,17 @@ void DisjSets::addElement( ) {
     s.push_back(-1);
 }
 
+/**
+ * Append the elements of other: element x of other becomes element x + getNumberOfLabels( )
+ * (the number before the call), in the same sets.
+ */
+void DisjSets::append( const DisjSets &other ) {
+    int offset = int(s.size( )) - 1;
+    for (size_t i=1; i<other.s.size( ); i++) {
+        s.push_back((other.s[i] < 0) ? other.s[i] : other.s[i] + offset);
+    }
+}
+
 /**
  * Return the maximum number of labels
  */
@@ -96,15 +112,55 @@ int DisjSets::getNumberOfLevels( ) const {
 }
 
 /**
- * Return a list of distinct labels (levels)
+ * Return a list of distinct labels (levels): the root of every set, in the order of the
+ * smallest element of the sets
  */
-vector<int> DisjSets::getLevels( ) const {
-    vector<int> listOfLevels;
-    int setSize = int(s.size( ));
+vector<int> DisjSets::getLevels( ) {
+    vector<int> listOfLevels, finalLabels;
+    int numOfLevels = flatten(finalLabels), setSize = int(s.size( ));
+    listOfLevels.resize(numOfLevels);
     for (int i=1; i<setSize; i++) {
         if (s[i]<0) {
-            listOfLevels.push_back(i);
+            listOfLevels[finalLabels[i]-1] = i;
         }
     }
     return listOfLevels;
 }
+
+/**
+ * Set finalLabels[x] to the number (1, 2, ..., # of sets) of the set containing x, in one
+ * pass over the elements; sets are numbered in the order of their smallest element, and
+ * finalLabels[0] is 0, so finalLabels maps provisional labels to final labels directly.
+ * Return the number of sets.
+ */
+int DisjSets::flatten( vector<int> &finalLabels ) {
+    int numOfLevels = 0, setSize = int(s.size( ));
+    finalLabels.assign(setSize, 0);
+    for (int i=1; i<setSize; i++) {
+        int root = find(i);
+        if (finalLabels[root]==0) {
+            finalLabels[root] = ++numOfLevels;
+        }
+        finalLabels[i] = finalLabels[root];
+    }
+    return numOfLevels;
+}
+
+/**
+ * Like flatten(finalLabels), but number the sets in the order of the first of their elements
+ * listed in order, which must list every element once (for labels that were not created in
+ * raster order, order lists them in the order of their first pixels).
+ * Return the number of sets.
+ */
+int DisjSets::flatten( vector<int> &finalLabels, const vector<int> &order ) {
+    int numOfLevels = 0, orderSize = int(order.size( ));
+    finalLabels.assign(s.size( ), 0);
+    for (int k=0; k<orderSize; k++) {
+        int i = order[k], root = find(i);
+        if (finalLabels[root]==0) {
+            finalLabels[root] = ++numOfLevels;
+        }
+        finalLabels[i] = finalLabels[root];
+    }
+    return numOfLevels;
+}
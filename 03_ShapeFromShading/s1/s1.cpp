@@ -7,8 +7,11 @@
  Usage          : ./s1 <arg1> <arg2> <arg3>
                   where:
                   <arg1> is an input original gray-level image
-                  <arg2> is an input threshold value
+                  <arg2> is an input threshold value, or auto (chosen for the image with
+                  Otsu's method) or auto:P (the P-th percentile of its gray levels)
                   <arg3> is an output parameters file
+ Batch usage    : ./s1 -batch <inputs> <arg2> <arg3>
+                  runs the program on every image of <inputs> (see showUsage)
  Comments       : Assuming an orthographic projection, the sphere projects into a circle on 
                   the image plane. The greyscale image is thresholded in orded to obtain a 
                   binary one. The resulting parameters file is a text file consisting of a 
@@ -21,7 +24,9 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <cstring>
 #include "Image.h"
+#include "Batch.h"
 #include "DisjSets.h"
 #include "HoughDatabase.h"
 #include "Database.h"
@@ -33,33 +38,95 @@ using namespace std;
  */
 void showUsage(string fileName);
 
+/**
+ * Runs the program on every image of a batch (see showUsage).
+ */
+int runBatch(int argc, char * argv[]);
+
 /******************************************************************************************
  * MAIN
  ******************************************************************************************/
 int main(int argc, char * argv[]) {
+
+    if (argc>1 && strcmp(argv[1], "-batch")==0) {
+        return runBatch(argc, argv);
+    }
     
     if (argc!=4) {
         showUsage(argv[0]);
         return 0;
     }
     
-    Image *input;
-    input = new Image;
-    assert(input != 0);
+    Image<uint8_t> input;
+    Threshold threshold;
     
-    if (readAsBinaryImage(input, argv[1], atoi(argv[2]))) {
-        printf("Can't open file %s\n", argv[1]);
+    if (threshold.parse(argv[2])) {
+        fprintf(stderr, "Invalid threshold %s\n", argv[2]);
+        return 0;
+    }
+    if (readAsBinaryImage(&input, argv[1], threshold)) {
+        fprintf(stderr, "Can't open file %s\n", argv[1]);
         return 0;
     }
     
-    if (calculateSpherePropertiesAndSaveAsTxt(input, argv[3])) {
-        printf("Can't calculate sphere properties\n");
+    if (calculateSpherePropertiesAndSaveAsTxt(&input, argv[3])) {
+        fprintf(stderr, "Can't calculate sphere properties\n");
         return 0;
     }
     
     return 0;
 }
 
+/******************************************************************************************
+ * runBatch
+ ******************************************************************************************/
+int runBatch(int argc, char * argv[]) {
+    
+    if (argc!=5) {
+        showUsage(argv[0]);
+        return 0;
+    }
+    
+    BatchTimer timer;
+    BatchInputs inputs;
+    if (inputs.open(argv[2])) {
+        return 0;
+    }
+    
+    /* decode and threshold the next images while the current sphere is measured */
+    Threshold threshold; /* an automatic one is chosen for every frame */
+    if (threshold.parse(argv[3])) {
+        fprintf(stderr, "Invalid threshold %s\n", argv[3]);
+        return 0;
+    }
+    struct Frame {
+        Image<uint8_t> input;
+    };
+    BatchPrefetcher<Frame> frames(inputs, [&](Frame *frame, FILE *input, int k) {
+        return readAsBinaryImage(&frame->input, input, threshold);
+    });
+    
+    Frame *frame;
+    int k, status;
+    while ((frame = frames.next(k, status)) != NULL) {
+        if (status) {
+            fprintf(stderr, "Can't load frame %d (%s)\n", k, inputs.getName(k).c_str());
+            timer.countFrame(false);
+            continue;
+        }
+        string outputName = makeBatchName(argv[4], inputs.getName(k), k);
+        if (calculateSpherePropertiesAndSaveAsTxt(&frame->input, outputName.c_str())) {
+            fprintf(stderr, "Can't calculate sphere properties\n");
+            timer.countFrame(false);
+            continue;
+        }
+        timer.countFrame(true);
+    }
+    timer.report();
+    
+    return 0;
+}
+
 /******************************************************************************************
  * showUsage
  ******************************************************************************************/
@@ -69,7 +136,15 @@ void showUsage(string fileName) {
     << "********************************************************************************\n"
     << "where:\n"
     << "\t<arg1> is an input original gray-level image\n"
-    << "\t<arg2> is an input input threshold value\n"
+    << "\t<arg2> is an input input threshold value, or auto (chosen for every image with\n"
+    << "\tOtsu's method) or auto:P (the P-th percentile of its gray levels, 0 <= P <= 100)\n"
     << "\t<arg3> is an output parameters file\n"
-    << "example:\n\t" << fileName <<  " inputImage.pgm 85 sphereProperties.txt\n";
+    << "batch:\t" << fileName << " -batch <inputs> <arg2> <arg3>\n"
+    << "\t<inputs> is a directory, a quoted glob pattern, a numbered sequence such as frame_%05d.pgm,\n"
+    << "\t@list (a file listing images), or an image file or - holding one or more images;\n"
+    << "\toutput names (and other per-frame image names) are patterns: %s is the input name\n"
+    << "\twithout directory and extension, %d (or %05d) the frame number\n"
+    << "example:\n\t" << fileName <<  " inputImage.pgm 85 sphereProperties.txt\n"
+    << "\t" << fileName << " -batch 'spheres/*.pgm' 85 properties/%s.txt\n"
+    << "\t" << fileName << " -batch 'spheres/*.pgm' auto properties/%s.txt\n";
 }
\ No newline at end of file
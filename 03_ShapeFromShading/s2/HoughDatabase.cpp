@@ -14,6 +14,13 @@
 
 using namespace std;
 
+/**
+ * Remove all records; the memory is kept for the records of the next image.
+ */
+void HoughDatabase::clear() {
+    records.clear();
+}
+
 /**
  * Initialize database object with NumberOfRecords records.
  * (Label of the element is i+1).
@@ -89,7 +96,7 @@ void HoughDatabase::printRecords() const {
 /**
  * Return database records.
  */
-vector<HoughDatabase::Record> HoughDatabase::getRecords() const {
+const vector<HoughDatabase::Record> &HoughDatabase::getRecords() const {
     return records;
 }
 
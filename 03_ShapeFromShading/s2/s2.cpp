@@ -11,6 +11,8 @@
                   <arg3> is an input image 2
                   <arg4> is an input image 3
                   <arg5> is an output directions file
+ Batch usage    : ./s2 -batch <arg1> <inputs> <arg3> <arg4> <arg5>
+                  runs the program on every image of <inputs> (see showUsage)
  Comments       : Formula to compute the normal vector gives the result in a 3-D coordinate 
                   system, originating at the sphere’s center, having its x-axis and y-axis 
                   parallel respectively to the x-axis and the y-axis of the image, and z-axis 
@@ -27,7 +29,9 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <cstring>
 #include "Image.h"
+#include "Batch.h"
 #include "DisjSets.h"
 #include "HoughDatabase.h"
 #include "Database.h"
@@ -39,10 +43,19 @@ using namespace std;
  */
 void showUsage(string fileName);
 
+/**
+ * Runs the program on every image of a batch (see showUsage).
+ */
+int runBatch(int argc, char * argv[]);
+
 /******************************************************************************************
  * MAIN
  ******************************************************************************************/
 int main(int argc, char * argv[]) {
+
+    if (argc>1 && strcmp(argv[1], "-batch")==0) {
+        return runBatch(argc, argv);
+    }
     
     if (argc!=6) {
         showUsage(argv[0]);
@@ -51,39 +64,98 @@ int main(int argc, char * argv[]) {
     
     /* Read images */
     
-    Image *input1;
-    input1 = new Image;
-    assert(input1 != 0);
-    Image *input2;
-    input2 = new Image;
-    assert(input2 != 0);
-    Image *input3;
-    input3 = new Image;
-    assert(input3 != 0);
+    MappedPgm input1; /* pixels are used in place, directly from the input files */
+    MappedPgm input2;
+    MappedPgm input3;
     
-    if (readImage(input1, argv[2])) {
-        printf("Can't open file %s\n", argv[2]);
+    if (mapPgm(&input1, argv[2])) {
+        fprintf(stderr, "Can't open file %s\n", argv[2]);
         return 0;
     }
-    if (readImage(input2, argv[3])) {
-        printf("Can't open file %s\n", argv[3]);
+    if (mapPgm(&input2, argv[3])) {
+        fprintf(stderr, "Can't open file %s\n", argv[3]);
         return 0;
     }
-    if (readImage(input3, argv[4])) {
-        printf("Can't open file %s\n", argv[4]);
+    if (mapPgm(&input3, argv[4])) {
+        fprintf(stderr, "Can't open file %s\n", argv[4]);
         return 0;
     }
     
     /* Read sphere properties, calculate light sources directions and intensities, save results in a text file */
     
-    if (calculateLightSourcesDirectionsAndIntensities(argv[1], input1, input2, input3, argv[5])) {
-        printf("Can't calculate light sources directions and intensities\n");
+    if (calculateLightSourcesDirectionsAndIntensities(argv[1], input1.view(), input2.view(), input3.view(), argv[5])) {
+        fprintf(stderr, "Can't calculate light sources directions and intensities\n");
         return 0;
     }
     
     return 0;
 }
 
+/******************************************************************************************
+ * runBatch
+ ******************************************************************************************/
+int runBatch(int argc, char * argv[]) {
+    
+    if (argc!=7) {
+        showUsage(argv[0]);
+        return 0;
+    }
+    
+    BatchTimer timer;
+    BatchInputs inputs;
+    if (inputs.open(argv[3])) {
+        return 0;
+    }
+    
+    /* the sphere properties are read once */
+    double xCenter, yCenter, radius;
+    if (readSphereProperties(argv[2], xCenter, yCenter, radius)) {
+        fprintf(stderr, "Can't open file %s\n", argv[2]);
+        return 0;
+    }
+    
+    /* decode the next images while the light sources of the current ones are calculated */
+    struct Frame {
+        MappedPgm input1, input2, input3; /* pixels are used in place, directly from the input files */
+    };
+    BatchPrefetcher<Frame> frames(inputs, [&](Frame *frame, FILE *input, int k) {
+        string name2 = makeBatchName(argv[4], inputs.getName(k), k);
+        string name3 = makeBatchName(argv[5], inputs.getName(k), k);
+        if (mapPgm(&frame->input1, input)) {
+            return -1;
+        }
+        if (mapPgm(&frame->input2, name2.c_str())) {
+            fprintf(stderr, "Can't open file %s\n", name2.c_str());
+            return -1;
+        }
+        if (mapPgm(&frame->input3, name3.c_str())) {
+            fprintf(stderr, "Can't open file %s\n", name3.c_str());
+            return -1;
+        }
+        return 0;
+    });
+    
+    Frame *frame;
+    int k, status;
+    while ((frame = frames.next(k, status)) != NULL) {
+        if (status) {
+            fprintf(stderr, "Can't load frame %d (%s)\n", k, inputs.getName(k).c_str());
+            timer.countFrame(false);
+            continue;
+        }
+        string outputName = makeBatchName(argv[6], inputs.getName(k), k);
+        if (calculateLightSourcesDirectionsAndIntensities(xCenter, yCenter, radius, frame->input1.view(), frame->input2.view(), frame->input3.view(), outputName.c_str())) {
+            fprintf(stderr, "Can't calculate light sources directions and intensities\n");
+            timer.countFrame(false);
+            continue;
+        }
+        timer.countFrame(true);
+    }
+    timer.report();
+    
+    return 0;
+}
+
 /******************************************************************************************
  * showUsage
  ******************************************************************************************/
@@ -97,5 +169,11 @@ void showUsage(string fileName) {
          << "\t<arg3> is an input image 2\n"
          << "\t<arg4> is an input image 3\n"
          << "\t<arg5> is an output directions file\n"
-         << "example:\n\t" << fileName << " sphereParameters.txt input1.pgm input2.pgm input3.pgm directions.txt\n";
+         << "batch:\t" << fileName << " -batch <arg1> <inputs> <arg3> <arg4> <arg5>\n"
+         << "\t<inputs> is a directory, a quoted glob pattern, a numbered sequence such as frame_%05d.pgm,\n"
+         << "\t@list (a file listing images), or an image file or - holding one or more images;\n"
+         << "\toutput names (and other per-frame image names) are patterns: %s is the input name\n"
+         << "\twithout directory and extension, %d (or %05d) the frame number\n"
+         << "example:\n\t" << fileName << " sphereParameters.txt input1.pgm input2.pgm input3.pgm directions.txt\n"
+         << "\t" << fileName << " -batch sphereProperties.txt 'light1/*.pgm' light2/%s.pgm light3/%s.pgm directions/%s.txt\n";
 }
\ No newline at end of file
@@ -13,6 +13,8 @@
                   <arg5> is a step
                   <arg6> is a threshold value
                   <arg7> is an output image
+ Batch usage    : ./s3 -batch <arg1> <inputs> <arg3> <arg4> <arg5> <arg6> <arg7>
+                  runs the program on every image of <inputs> (see showUsage)
  Comments       : The output is image 1 with the normals shown as a "needle map". The 
                   gridpoints are shown in black (value 0). "Needles" originate from each
                   gridpoint as lines (orthographic projections of the scaled by factor 10
@@ -24,7 +26,9 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <cstring>
 #include "Image.h"
+#include "Batch.h"
 #include "DisjSets.h"
 #include "HoughDatabase.h"
 #include "Database.h"
@@ -36,10 +40,19 @@ using namespace std;
  */
 void showUsage(string fileName);
 
+/**
+ * Runs the program on every image of a batch (see showUsage).
+ */
+int runBatch(int argc, char * argv[]);
+
 /******************************************************************************************
  * MAIN
  ******************************************************************************************/
 int main(int argc, char * argv[]) {
+
+    if (argc>1 && strcmp(argv[1], "-batch")==0) {
+        return runBatch(argc, argv);
+    }
     
     if (argc!=8) {
         showUsage(argv[0]);
@@ -48,48 +61,119 @@ int main(int argc, char * argv[]) {
     
     /* Read images */
     
-    Image *input1;
-    input1 = new Image;
-    assert(input1 != 0);
-    Image *input2;
-    input2 = new Image;
-    assert(input2 != 0);
-    Image *input3;
-    input3 = new Image;
-    assert(input3 != 0);
-    
-    if (readImage(input1, argv[2])) {
-        printf("Can't open file %s\n", argv[2]);
+    MappedPgm input1; /* pixels are used in place, directly from the input files */
+    MappedPgm input2;
+    MappedPgm input3;
+    
+    if (mapPgm(&input1, argv[2])) {
+        fprintf(stderr, "Can't open file %s\n", argv[2]);
         return 0;
     }
-    if (readImage(input2, argv[3])) {
-        printf("Can't open file %s\n", argv[3]);
+    if (mapPgm(&input2, argv[3])) {
+        fprintf(stderr, "Can't open file %s\n", argv[3]);
         return 0;
     }
-    if (readImage(input3, argv[4])) {
-        printf("Can't open file %s\n", argv[4]);
+    if (mapPgm(&input3, argv[4])) {
+        fprintf(stderr, "Can't open file %s\n", argv[4]);
         return 0;
     }
     
     /* Copy input1 image to draw needle map */
     
-    Image *output;
-    output = new Image(*input1);
-    assert(output != 0);
+    Image<uint8_t> output(input1.view());
+    output.setColors(input1.getColors());
 
     
     /* Read light source directions, compute and draw normals */
     
-    if (computeAndDrawNormals(argv[1], input1, input2, input3, atoi(argv[5]), atoi(argv[6]), output)) {
-        printf("Can't compute and draw normals\n");
+    if (computeAndDrawNormals(argv[1], input1.view(), input2.view(), input3.view(), atoi(argv[5]), atoi(argv[6]), &output)) {
+        fprintf(stderr, "Can't compute and draw normals\n");
+        return 0;
+    }
+    
+    if (writeImage(&output, argv[7])) {
+        fprintf(stderr, "Can't write to file %s\n", argv[7]);
+        return 0;
+    }
+    
+    return 0;
+}
+
+/******************************************************************************************
+ * runBatch
+ ******************************************************************************************/
+int runBatch(int argc, char * argv[]) {
+    
+    if (argc!=9) {
+        showUsage(argv[0]);
         return 0;
     }
     
-    if (writeImage(output, argv[7])) {
-        printf("Can't write to file %s\n", argv[7]);
+    BatchTimer timer;
+    BatchInputs inputs;
+    if (inputs.open(argv[3])) {
         return 0;
     }
     
+    /* the light source directions are read once */
+    double S[3][3];
+    if (readLightDirections(argv[2], S)) {
+        fprintf(stderr, "Can't open file %s\n", argv[2]);
+        return 0;
+    }
+    int step = atoi(argv[6]);
+    int threshold = atoi(argv[7]);
+    
+    /* decode the next images while the normals of the current ones are computed */
+    struct Frame {
+        MappedPgm input1, input2, input3; /* pixels are used in place, directly from the input files */
+    };
+    BatchPrefetcher<Frame> frames(inputs, [&](Frame *frame, FILE *input, int k) {
+        string name2 = makeBatchName(argv[4], inputs.getName(k), k);
+        string name3 = makeBatchName(argv[5], inputs.getName(k), k);
+        if (mapPgm(&frame->input1, input)) {
+            return -1;
+        }
+        if (mapPgm(&frame->input2, name2.c_str())) {
+            fprintf(stderr, "Can't open file %s\n", name2.c_str());
+            return -1;
+        }
+        if (mapPgm(&frame->input3, name3.c_str())) {
+            fprintf(stderr, "Can't open file %s\n", name3.c_str());
+            return -1;
+        }
+        return 0;
+    });
+    Image<uint8_t> output; /* input1 with the needle map */
+    
+    Frame *frame;
+    int k, status;
+    while ((frame = frames.next(k, status)) != NULL) {
+        if (status) {
+            fprintf(stderr, "Can't load frame %d (%s)\n", k, inputs.getName(k).c_str());
+            timer.countFrame(false);
+            continue;
+        }
+        string outputName = makeBatchName(argv[8], inputs.getName(k), k);
+        
+        /* Copy input1 image to draw needle map */
+        output.copyPixels(frame->input1.view());
+        output.setColors(frame->input1.getColors());
+        
+        if (computeAndDrawNormals(S, frame->input1.view(), frame->input2.view(), frame->input3.view(), step, threshold, &output)) {
+            fprintf(stderr, "Can't compute and draw normals\n");
+            timer.countFrame(false);
+            continue;
+        }
+        if (writeImage(&output, outputName.c_str())) {
+            fprintf(stderr, "Can't write to file %s\n", outputName.c_str());
+            timer.countFrame(false);
+            continue;
+        }
+        timer.countFrame(true);
+    }
+    timer.report();
+    
     return 0;
 }
 
@@ -108,5 +192,11 @@ void showUsage(string fileName) {
          << "\t<arg5> is an input step\n"
          << "\t<arg6> is an input threshold value\n"
          << "\t<arg7> is an output image\n"
-         << "example:\n\t" << fileName << " directions.txt input1.pgm input2.pgm input3.pgm 30 90 output.pgm\n";
+         << "batch:\t" << fileName << " -batch <arg1> <inputs> <arg3> <arg4> <arg5> <arg6> <arg7>\n"
+         << "\t<inputs> is a directory, a quoted glob pattern, a numbered sequence such as frame_%05d.pgm,\n"
+         << "\t@list (a file listing images), or an image file or - holding one or more images;\n"
+         << "\toutput names (and other per-frame image names) are patterns: %s is the input name\n"
+         << "\twithout directory and extension, %d (or %05d) the frame number\n"
+         << "example:\n\t" << fileName << " directions.txt input1.pgm input2.pgm input3.pgm 30 90 output.pgm\n"
+         << "\t" << fileName << " -batch directions.txt 'light1/*.pgm' light2/%s.pgm light3/%s.pgm 10 85 normals/%s.pgm\n";
 }
\ No newline at end of file
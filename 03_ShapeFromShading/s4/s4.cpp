@@ -11,6 +11,8 @@
                   <arg4> is an input image 3
                   <arg5> is a threshold value
                   <arg6> is an output image
+ Batch usage    : ./s4 -batch <arg1> <inputs> <arg3> <arg4> <arg5> <arg6>
+                  runs the program on every image of <inputs> (see showUsage)
  Comments       : The albedos are computed for all pixels visible from all 3 light sources, 
                   and scaled up or down to fit in the range 0 - 255.
  ******************************************************************************************/
@@ -20,7 +22,9 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <cstring>
 #include "Image.h"
+#include "Batch.h"
 #include "DisjSets.h"
 #include "HoughDatabase.h"
 #include "Database.h"
@@ -32,56 +36,130 @@ using namespace std;
  */
 void showUsage(string fileName);
 
+/**
+ * Runs the program on every image of a batch (see showUsage).
+ */
+int runBatch(int argc, char * argv[]);
+
 /******************************************************************************************
  * MAIN
  ******************************************************************************************/
 int main(int argc, char * argv[]) {
+
+    if (argc>1 && strcmp(argv[1], "-batch")==0) {
+        return runBatch(argc, argv);
+    }
     
     if (argc!=7) {
         showUsage(argv[0]);
         return 0;
     }
     
-    Image *input1;
-    input1 = new Image;
-    assert(input1 != 0);
-    Image *input2;
-    input2 = new Image;
-    assert(input2 != 0);
-    Image *input3;
-    input3 = new Image;
-    assert(input3 != 0);
-    Image *albedo;
-    albedo = new Image;
-    assert(albedo != 0);
+    MappedPgm input1; /* pixels are used in place, directly from the input files */
+    MappedPgm input2;
+    MappedPgm input3;
+    Image<int32_t> albedo; /* albedos are scaled to 0..255 only after all are computed */
     
     /* Read images */
     
-    if (readImage(input1, argv[2])) {
-        printf("Can't open file %s\n", argv[2]);
+    if (mapPgm(&input1, argv[2])) {
+        fprintf(stderr, "Can't open file %s\n", argv[2]);
         return 0;
     }
-    if (readImage(input2, argv[3])) {
-        printf("Can't open file %s\n", argv[3]);
+    if (mapPgm(&input2, argv[3])) {
+        fprintf(stderr, "Can't open file %s\n", argv[3]);
         return 0;
     }
-    if (readImage(input3, argv[4])) {
-        printf("Can't open file %s\n", argv[4]);
+    if (mapPgm(&input3, argv[4])) {
+        fprintf(stderr, "Can't open file %s\n", argv[4]);
         return 0;
     }
     
     /* Read light source directions, compute and draw albedos */
     
-    if (computeAndDrawAlbedos(argv[1], input1, input2, input3, atoi(argv[5]), albedo)) {
-        printf("Can't compute and draw albedos\n");
+    if (computeAndDrawAlbedos(argv[1], input1.view(), input2.view(), input3.view(), atoi(argv[5]), &albedo)) {
+        fprintf(stderr, "Can't compute and draw albedos\n");
+        return 0;
+    }
+    
+    if (writeImage(&albedo, argv[6])) {
+        fprintf(stderr, "Can't write to file %s\n", argv[6]);
+        return 0;
+    }
+    
+    return 0;
+}
+
+/******************************************************************************************
+ * runBatch
+ ******************************************************************************************/
+int runBatch(int argc, char * argv[]) {
+    
+    if (argc!=8) {
+        showUsage(argv[0]);
         return 0;
     }
     
-    if (writeImage(albedo, argv[6])) {
-        printf("Can't write to file %s\n", argv[6]);
+    BatchTimer timer;
+    BatchInputs inputs;
+    if (inputs.open(argv[3])) {
         return 0;
     }
     
+    /* the light source directions are read once */
+    double S[3][3];
+    if (readLightDirections(argv[2], S)) {
+        fprintf(stderr, "Can't open file %s\n", argv[2]);
+        return 0;
+    }
+    int threshold = atoi(argv[6]);
+    
+    /* decode the next images while the albedos of the current ones are computed */
+    struct Frame {
+        MappedPgm input1, input2, input3; /* pixels are used in place, directly from the input files */
+    };
+    BatchPrefetcher<Frame> frames(inputs, [&](Frame *frame, FILE *input, int k) {
+        string name2 = makeBatchName(argv[4], inputs.getName(k), k);
+        string name3 = makeBatchName(argv[5], inputs.getName(k), k);
+        if (mapPgm(&frame->input1, input)) {
+            return -1;
+        }
+        if (mapPgm(&frame->input2, name2.c_str())) {
+            fprintf(stderr, "Can't open file %s\n", name2.c_str());
+            return -1;
+        }
+        if (mapPgm(&frame->input3, name3.c_str())) {
+            fprintf(stderr, "Can't open file %s\n", name3.c_str());
+            return -1;
+        }
+        return 0;
+    });
+    
+    Image<int32_t> albedo; /* albedos are scaled to 0..255 only after all are computed */
+    
+    Frame *frame;
+    int k, status;
+    while ((frame = frames.next(k, status)) != NULL) {
+        if (status) {
+            fprintf(stderr, "Can't load frame %d (%s)\n", k, inputs.getName(k).c_str());
+            timer.countFrame(false);
+            continue;
+        }
+        string outputName = makeBatchName(argv[7], inputs.getName(k), k);
+        if (computeAndDrawAlbedos(S, frame->input1.view(), frame->input2.view(), frame->input3.view(), threshold, &albedo)) {
+            fprintf(stderr, "Can't compute and draw albedos\n");
+            timer.countFrame(false);
+            continue;
+        }
+        if (writeImage(&albedo, outputName.c_str())) {
+            fprintf(stderr, "Can't write to file %s\n", outputName.c_str());
+            timer.countFrame(false);
+            continue;
+        }
+        timer.countFrame(true);
+    }
+    timer.report();
+    
     return 0;
 }
 
@@ -100,5 +178,11 @@ void showUsage(string fileName) {
          << "\t<arg5> is an input step\n"
          << "\t<arg6> is an input threshold value\n"
          << "\t<arg7> is an output image\n"
-         << "example:\n\t" << fileName << " directions.txt input1.pgm input2.pgm input3.pgm 90 output.pgm\n";
+         << "batch:\t" << fileName << " -batch <arg1> <inputs> <arg3> <arg4> <arg5> <arg6>\n"
+         << "\t<inputs> is a directory, a quoted glob pattern, a numbered sequence such as frame_%05d.pgm,\n"
+         << "\t@list (a file listing images), or an image file or - holding one or more images;\n"
+         << "\toutput names (and other per-frame image names) are patterns: %s is the input name\n"
+         << "\twithout directory and extension, %d (or %05d) the frame number\n"
+         << "example:\n\t" << fileName << " directions.txt input1.pgm input2.pgm input3.pgm 90 output.pgm\n"
+         << "\t" << fileName << " -batch directions.txt 'light1/*.pgm' light2/%s.pgm light3/%s.pgm 85 albedo/%s.pgm\n";
 }
\ No newline at end of file